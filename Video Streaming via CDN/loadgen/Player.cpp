@@ -0,0 +1,289 @@
+#include "Player.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using std::chrono::duration;
+using std::chrono::duration_cast;
+
+static const int BUF_SIZE = 64 * 1024;
+static const int RETRY_MS = 100; // after a failed request
+
+static double seconds(clk::duration d) { return duration<double>(d).count(); }
+static clk::duration after(double s) { return duration_cast<clk::duration>(duration<double>(s)); }
+
+Player::Player(int id, const options_t *opts, int epfd, vector<FragmentSample> *samples, clk::time_point start_at)
+    : requests(0), errors(0), rebuffers(0), stall_seconds(0), startup_delay(-1), bytes(0), id(id), opts(opts),
+      epfd(epfd), samples(samples), st(IDLE), fd(-1), wake_at(start_at), outoff(0), head_len(0),
+      body_len(0), body_have(0), chunk_pos(0), close_after(false), next_frag(0), buffer(0), playing(false),
+      ever_played(false) {}
+
+void Player::wake(clk::time_point now) {
+    if (st != IDLE)
+        return;
+    play(now);
+    request(now);
+}
+
+void Player::request(clk::time_point now) {
+    if (opts->fragments > 0 && next_frag > opts->fragments) {
+        stop(now);
+        return;
+    }
+    string path = opts->manifest;
+    if (next_frag > 0) {
+        // the proxy picks the bitrate, the player asks for the lowest
+        path = path.substr(0, path.rfind('/') + 1) + std::to_string(opts->ladder[0]) + "Seg" +
+               std::to_string(opts->seg) + "-Frag" + std::to_string(next_frag);
+    } else {
+        started = now;
+    }
+    out = "GET " + path + " HTTP/1.1\r\nHost: " + opts->proxy_ip + ":" + std::to_string(opts->proxy_port) +
+          "\r\nUser-Agent: loadgen\r\nConnection: keep-alive\r\n\r\n";
+    outoff = 0;
+    in.clear();
+    head_len = 0;
+    body_have = 0;
+    chunk_pos = 0;
+    close_after = false;
+    sent_at = now;
+    requests++;
+    wake_at = clk::time_point::max();
+    if (fd == -1) {
+        if (!open(now))
+            return;
+        st = CONNECTING;
+        return;
+    }
+    st = SENDING;
+    handle(0, now);
+}
+
+bool Player::open(clk::time_point now) {
+    fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (fd == -1) {
+        failed(now);
+        return false;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (opts->source) {
+        // the proxy keeps one session per client address, so every player gets its own
+        struct sockaddr_in src;
+        memset(&src, 0, sizeof(src));
+        src.sin_family = AF_INET;
+        src.sin_addr.s_addr = htonl(opts->source + id);
+        if (bind(fd, (struct sockaddr *)&src, sizeof(src)) == -1) {
+            perror("Error binding source address");
+            failed(now);
+            return false;
+        }
+    }
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(opts->proxy_port);
+    inet_pton(AF_INET, opts->proxy_ip.c_str(), &addr.sin_addr);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 && errno != EINPROGRESS) {
+        failed(now);
+        return false;
+    }
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    ev.data.ptr = this;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+    return true;
+}
+
+void Player::handle(uint32_t events, clk::time_point now) {
+    if (st == CONNECTING) {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len);
+        if (err != 0) {
+            failed(now);
+            return;
+        }
+        if (!(events & EPOLLOUT))
+            return;
+        st = SENDING;
+    }
+    if (st == SENDING) {
+        if (!flush())
+            return;
+        st = READING;
+    }
+    if (st == READING)
+        read(now);
+}
+
+bool Player::flush() {
+    while (outoff < out.size()) {
+        ssize_t len = send(fd, out.data() + outoff, out.size() - outoff, MSG_NOSIGNAL);
+        if (len == -1) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                failed(clk::now());
+            return false;
+        }
+        outoff += len;
+    }
+    return true;
+}
+
+bool Player::read(clk::time_point now) {
+    char buf[BUF_SIZE];
+    while (true) {
+        ssize_t len = recv(fd, buf, BUF_SIZE, 0);
+        if (len == -1) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                failed(now);
+            return false;
+        }
+        if (len == 0) {
+            if (head_len > 0 && body_len == -2) {
+                close_after = true;
+                completed(now);
+                return true;
+            }
+            failed(now);
+            return false;
+        }
+        in.append(buf, len);
+        if (head_len == 0) {
+            size_t end = in.find("\r\n\r\n");
+            if (end == string::npos)
+                continue;
+            head_len = end + 4;
+            string head = in.substr(0, head_len);
+            if (atoi(head.c_str() + head.find(' ') + 1) != 200)
+                errors++;
+            close_after = strcasestr(head.c_str(), "Connection: close") != nullptr;
+            const char *cl = strcasestr(head.c_str(), "Content-Length:");
+            if (strcasestr(head.c_str(), "Transfer-Encoding: chunked"))
+                body_len = -1;
+            else if (cl)
+                body_len = strtol(cl + 15, nullptr, 10);
+            else
+                body_len = -2;
+            chunk_pos = head_len;
+        }
+        body_have = in.size() - head_len;
+        if (body_complete()) {
+            completed(now);
+            return true;
+        }
+    }
+}
+
+//  "1f4\r\n<500 bytes>\r\n...0\r\n\r\n", trailers not expected
+bool Player::body_complete() {
+    if (body_len >= 0)
+        return body_have >= (size_t)body_len;
+    if (body_len == -2)
+        return false;
+    while (true) {
+        size_t eol = in.find("\r\n", chunk_pos);
+        if (eol == string::npos)
+            return false;
+        size_t size = strtoul(in.c_str() + chunk_pos, nullptr, 16);
+        if (size == 0)
+            return in.size() >= eol + 4;
+        chunk_pos = eol + 2 + size + 2;
+    }
+}
+
+void Player::completed(clk::time_point now) {
+    play(now);
+    size_t body = in.size() - head_len;
+    bytes += in.size();
+    if (next_frag > 0) {
+        buffer += opts->fragment_seconds;
+        double kbps = body * 8 / 1000. / opts->fragment_seconds;
+        int bitrate = opts->ladder[0];
+        for (int rung : opts->ladder) {
+            if (fabs(rung - kbps) < fabs(bitrate - kbps))
+                bitrate = rung;
+        }
+        samples->push_back(FragmentSample{id, next_frag, seconds(sent_at - opts->epoch), seconds(now - sent_at), body,
+                                          bitrate, buffer});
+        if (!playing && buffer >= opts->startup_seconds) {
+            playing = true;
+            last_tick = now;
+            if (ever_played)
+                stall_seconds += seconds(now - stall_start);
+            else
+                startup_delay = seconds(now - started);
+            ever_played = true;
+        }
+    }
+    next_frag++;
+    in.clear();
+    if (close_after)
+        close_socket();
+    st = IDLE;
+    schedule(now);
+}
+
+/**
+ * @brief Fetch the next fragment now if it fits in the buffer, else once playback has
+ * made room for it.
+ */
+void Player::schedule(clk::time_point now) {
+    if (buffer + opts->fragment_seconds <= opts->max_buffer || !playing) {
+        request(now);
+        return;
+    }
+    wake_at = now + after(buffer + opts->fragment_seconds - opts->max_buffer);
+}
+
+void Player::failed(clk::time_point now) {
+    errors++;
+    close_socket();
+    in.clear();
+    st = IDLE;
+    wake_at = now + std::chrono::milliseconds(RETRY_MS);
+}
+
+void Player::close_socket() {
+    if (fd == -1)
+        return;
+    epoll_ctl(epfd, EPOLL_CTL_DEL, fd, nullptr);
+    close(fd);
+    fd = -1;
+}
+
+// Playback drains the buffer in real time; running dry while playing is a rebuffer.
+void Player::play(clk::time_point now) {
+    if (playing) {
+        double elapsed = seconds(now - last_tick);
+        if (elapsed >= buffer) {
+            stall_start = last_tick + after(buffer);
+            buffer = 0;
+            playing = false;
+            rebuffers++;
+        } else {
+            buffer -= elapsed;
+        }
+    }
+    last_tick = now;
+}
+
+void Player::stop(clk::time_point now) {
+    if (st == DONE)
+        return;
+    play(now);
+    if (!playing && ever_played)
+        stall_seconds += seconds(now - stall_start);
+    close_socket();
+    st = DONE;
+    wake_at = clk::time_point::max();
+}
@@ -0,0 +1,110 @@
+#ifndef _PLAYER_H_
+#define _PLAYER_H_
+
+#include <chrono>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+typedef std::chrono::steady_clock clk;
+
+struct options_t {
+    string proxy_ip;
+    int proxy_port;
+    int players;
+    double duration;         // seconds of the run
+    int fragments;           // per player, 0 for as many as the run allows
+    string manifest;         // path of the .f4m
+    int seg;                 // the fragments are <bitrate>Seg<seg>-Frag<1, 2, ...>
+    double fragment_seconds; // video per fragment
+    double startup_seconds;  // buffered before playback starts, and again after a stall
+    double max_buffer;       // the player stops fetching above this
+    double ramp;             // seconds over which the players start
+    vector<int> ladder;      // kbps, to name the bitrate a fragment's size implies
+    uint32_t source;         // first source address (host order), one per player; 0 lets the kernel pick
+    clk::time_point epoch;   // when the run started
+};
+
+// One fragment as the player saw it.
+struct FragmentSample {
+    int player;
+    int frag;
+    double start;   // request sent, seconds since the run started
+    double latency; // request sent -> last byte
+    size_t bytes;
+    int bitrate; // ladder rung closest to bytes / fragment_seconds
+    double buffer; // seconds buffered once it arrived
+};
+
+/**
+ * A simulated Flash player on one keep-alive connection: the manifest first, then one
+ * fragment after another. Fragments go into a modelled playback buffer that drains in real
+ * time once playback starts; the player fetches while the buffer is below max_buffer and
+ * waits when it is full. Running dry while playing is a rebuffer, and playback resumes
+ * once startup_seconds are buffered again.
+ * Driven by the load generator's epoll loop: handle() on socket events, wake() at timeout.
+ */
+class Player {
+  public:
+    Player(int id, const options_t *opts, int epfd, vector<FragmentSample> *samples, clk::time_point start_at);
+    // Start (or restart after a timeout) whatever comes next.
+    void wake(clk::time_point now);
+    void handle(uint32_t events, clk::time_point now);
+    // When wake() wants to run next, max() while waiting on the socket or finished.
+    clk::time_point next_wake() const { return wake_at; }
+    bool finished() const { return st == DONE; }
+    void stop(clk::time_point now);
+
+    int requests;
+    int errors;
+    int rebuffers;
+    double stall_seconds;
+    double startup_delay; // seconds from the first request to playback, -1 until it plays
+    uint64_t bytes;
+
+  private:
+    enum State { IDLE, CONNECTING, SENDING, READING, DONE };
+    int id;
+    const options_t *opts;
+    int epfd;
+    vector<FragmentSample> *samples;
+    State st;
+    int fd;
+    clk::time_point wake_at;
+    clk::time_point started; // first request
+
+    string out;
+    size_t outoff;
+    string in;
+    size_t head_len;  // 0 until the response head is in
+    long body_len;    // -1 for chunked, -2 until the connection closes
+    size_t body_have; // body bytes, chunk framing included
+    size_t chunk_pos; // where the next chunk size line starts, for chunked bodies
+    bool close_after; // the proxy said Connection: close
+
+    int next_frag; // 0 while the manifest is outstanding
+    clk::time_point sent_at;
+
+    // playback model
+    double buffer; // seconds of video held
+    bool playing;
+    bool ever_played;
+    clk::time_point last_tick;
+    clk::time_point stall_start;
+
+    void request(clk::time_point now);
+    bool open(clk::time_point now);
+    bool flush();
+    bool read(clk::time_point now);
+    bool body_complete();
+    void completed(clk::time_point now);
+    void failed(clk::time_point now);
+    void close_socket();
+    void play(clk::time_point now);
+    void schedule(clk::time_point now);
+};
+
+#endif
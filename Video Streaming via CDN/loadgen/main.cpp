@@ -0,0 +1,275 @@
+#include "Player.h"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fstream>
+#include <getopt.h>
+#include <iostream>
+#include <map>
+#include <signal.h>
+#include <sstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <sys/epoll.h>
+#include <vector>
+
+using std::cout;
+using std::endl;
+using std::map;
+using std::ofstream;
+using std::string;
+using std::vector;
+using std::chrono::duration;
+using std::chrono::duration_cast;
+using std::chrono::milliseconds;
+
+static const int MAX_EVENTS = 256;
+static const int MAX_WAIT_MS = 100;
+
+void help_string() {
+    cout << "Usage: ./loadgen [options] <proxy-ip> <proxy-port>" << endl;
+    cout << "Simulates video players fetching through miProxy and reports what they saw." << endl;
+    cout << "Options: --players <n>        concurrent players (default: 10)" << endl;
+    cout << "         --duration <s>       length of the run (default: 30)" << endl;
+    cout << "         --fragments <n>      stop each player after n fragments (default: no limit)" << endl;
+    cout << "         --manifest <path>    (default: /vod/big_buck_bunny.f4m)" << endl;
+    cout << "         --seg <n>            fragments are <bitrate>Seg<n>-Frag<1..> (default: 1)" << endl;
+    cout << "         --fragment-seconds <s>  video per fragment (default: 1)" << endl;
+    cout << "         --startup <s>        buffered before playback starts or resumes (default: 2)" << endl;
+    cout << "         --max-buffer <s>     players stop fetching above this (default: 30)" << endl;
+    cout << "         --ramp <s>           spread the players' start over this long (default: 1)" << endl;
+    cout << "         --ladder <kbps,...>  bitrates, to tell which one a fragment was (default: 10,100,500,1000)"
+         << endl;
+    cout << "         --source <ip>        bind player i to <ip>+i, so the proxy sees separate clients" << endl;
+    cout << "                              (any 127.x.y.z works on loopback)" << endl;
+    cout << "         --csv <file>         one line per fragment" << endl;
+}
+
+static void fail(const string &msg) {
+    cout << msg << endl;
+    exit(1);
+}
+
+static vector<int> parse_ladder(const string &s) {
+    vector<int> ladder;
+    std::stringstream ss(s);
+    string rung;
+    while (getline(ss, rung, ','))
+        ladder.push_back(atoi(rung.c_str()));
+    std::sort(ladder.begin(), ladder.end());
+    return ladder;
+}
+
+static void parse_opts(int argc, char **argv, options_t &opts, string &csv) {
+    int option_index = 0, opt = 0;
+    opterr = false;
+    struct option longOpts[] = {
+        {"players", required_argument, nullptr, 'n'},
+        {"duration", required_argument, nullptr, 'd'},
+        {"fragments", required_argument, nullptr, 'f'},
+        {"manifest", required_argument, nullptr, 'm'},
+        {"seg", required_argument, nullptr, 'g'},
+        {"fragment-seconds", required_argument, nullptr, 'F'},
+        {"startup", required_argument, nullptr, 'u'},
+        {"max-buffer", required_argument, nullptr, 'b'},
+        {"ramp", required_argument, nullptr, 'r'},
+        {"ladder", required_argument, nullptr, 'l'},
+        {"source", required_argument, nullptr, 's'},
+        {"csv", required_argument, nullptr, 'c'},
+        {"help", no_argument, nullptr, 'h'},
+        {nullptr, 0, nullptr, 0},
+    };
+
+    opts.players = 10;
+    opts.duration = 30;
+    opts.fragments = 0;
+    opts.manifest = "/vod/big_buck_bunny.f4m";
+    opts.seg = 1;
+    opts.fragment_seconds = 1;
+    opts.startup_seconds = 2;
+    opts.max_buffer = 30;
+    opts.ramp = 1;
+    opts.ladder = {10, 100, 500, 1000};
+    opts.source = 0;
+
+    while ((opt = getopt_long(argc, argv, "n:d:f:m:g:F:u:b:r:l:s:c:h", longOpts, &option_index)) != -1) {
+        switch (opt) {
+        case 'n':
+            opts.players = atoi(optarg);
+            break;
+        case 'd':
+            opts.duration = atof(optarg);
+            break;
+        case 'f':
+            opts.fragments = atoi(optarg);
+            break;
+        case 'm':
+            opts.manifest = optarg;
+            break;
+        case 'g':
+            opts.seg = atoi(optarg);
+            break;
+        case 'F':
+            opts.fragment_seconds = atof(optarg);
+            break;
+        case 'u':
+            opts.startup_seconds = atof(optarg);
+            break;
+        case 'b':
+            opts.max_buffer = atof(optarg);
+            break;
+        case 'r':
+            opts.ramp = atof(optarg);
+            break;
+        case 'l':
+            opts.ladder = parse_ladder(optarg);
+            break;
+        case 's': {
+            struct in_addr addr;
+            if (inet_pton(AF_INET, optarg, &addr) != 1)
+                fail("Error: Illegal source address");
+            opts.source = ntohl(addr.s_addr);
+            break;
+        }
+        case 'c':
+            csv = optarg;
+            break;
+        case 'h':
+            help_string();
+            exit(0);
+        default:
+            help_string();
+            exit(1);
+        }
+    }
+    if (argc - optind != 2) {
+        help_string();
+        exit(1);
+    }
+    opts.proxy_ip = argv[optind];
+    opts.proxy_port = atoi(argv[optind + 1]);
+    struct in_addr addr;
+    if (inet_pton(AF_INET, opts.proxy_ip.c_str(), &addr) != 1)
+        fail("Error: Illegal proxy IP address");
+    if (opts.proxy_port <= 0 || opts.proxy_port >= 65536)
+        fail("Error: Illegal proxy port number");
+    if (opts.players <= 0 || opts.duration <= 0 || opts.fragment_seconds <= 0 || opts.ladder.empty() ||
+        opts.max_buffer < opts.fragment_seconds)
+        fail("Error: Illegal options");
+}
+
+static double percentile(const vector<double> &sorted, double p) {
+    if (sorted.empty())
+        return 0;
+    size_t i = std::min(sorted.size() - 1, (size_t)(p * sorted.size()));
+    return sorted[i];
+}
+
+static void report(const options_t &opts, const vector<Player *> &players, const vector<FragmentSample> &samples,
+                   double elapsed) {
+    int requests = 0, errors = 0, rebuffers = 0, stalled_players = 0, started = 0;
+    double stall = 0;
+    uint64_t bytes = 0;
+    vector<double> startup;
+    for (Player *p : players) {
+        requests += p->requests;
+        errors += p->errors;
+        rebuffers += p->rebuffers;
+        stalled_players += p->rebuffers > 0;
+        stall += p->stall_seconds;
+        bytes += p->bytes;
+        if (p->startup_delay >= 0) {
+            started++;
+            startup.push_back(p->startup_delay * 1000);
+        }
+    }
+    vector<double> latency;
+    map<int, int> bitrates;
+    double bitrate_sum = 0;
+    for (const FragmentSample &s : samples) {
+        latency.push_back(s.latency * 1000);
+        bitrates[s.bitrate]++;
+        bitrate_sum += s.bitrate;
+    }
+    std::sort(latency.begin(), latency.end());
+    std::sort(startup.begin(), startup.end());
+
+    printf("players %d, %.1f s, %d started playback\n", opts.players, elapsed, started);
+    printf("requests %d, errors %d\n", requests, errors);
+    printf("fragments %zu, %.1f/s\n", samples.size(), samples.size() / elapsed);
+    printf("throughput %.2f Mbit/s (%llu bytes)\n", bytes * 8 / 1e6 / elapsed, (unsigned long long)bytes);
+    printf("fragment latency ms: p50 %.2f p90 %.2f p99 %.2f max %.2f\n", percentile(latency, 0.5),
+           percentile(latency, 0.9), percentile(latency, 0.99), latency.empty() ? 0 : latency.back());
+    printf("startup delay ms: p50 %.1f p90 %.1f max %.1f\n", percentile(startup, 0.5), percentile(startup, 0.9),
+           startup.empty() ? 0 : startup.back());
+    printf("bitrate kbps: mean %.1f,", samples.empty() ? 0 : bitrate_sum / samples.size());
+    for (auto &b : bitrates)
+        printf(" %d: %d (%.1f%%)", b.first, b.second, 100. * b.second / samples.size());
+    printf("\n");
+    printf("rebuffers %d on %d players, %.2f s stalled (%.2f%% of the run)\n", rebuffers, stalled_players, stall,
+           100. * stall / (elapsed * opts.players));
+}
+
+int main(int argc, char **argv) {
+    options_t opts;
+    string csv;
+    parse_opts(argc, argv, opts, csv);
+    signal(SIGPIPE, SIG_IGN);
+
+    int epfd = epoll_create1(0);
+    if (epfd == -1) {
+        perror("epoll_create1");
+        return 1;
+    }
+    vector<FragmentSample> samples;
+    opts.epoch = clk::now();
+    vector<Player *> players;
+    for (int i = 0; i < opts.players; i++) {
+        auto start_at = opts.epoch + duration_cast<clk::duration>(duration<double>(opts.ramp * i / opts.players));
+        players.push_back(new Player(i, &opts, epfd, &samples, start_at));
+    }
+
+    auto end = opts.epoch + duration_cast<clk::duration>(duration<double>(opts.duration));
+    struct epoll_event events[MAX_EVENTS];
+    while (true) {
+        auto now = clk::now();
+        if (now >= end)
+            break;
+        auto next = end;
+        bool running = false;
+        for (Player *p : players) {
+            running = running || !p->finished();
+            next = std::min(next, p->next_wake());
+        }
+        if (!running)
+            break;
+        int timeout = std::max(0L, (long)duration_cast<milliseconds>(next - now).count());
+        int n = epoll_wait(epfd, events, MAX_EVENTS, std::min(timeout, MAX_WAIT_MS));
+        if (n == -1 && errno != EINTR) {
+            perror("epoll_wait");
+            return 1;
+        }
+        now = clk::now();
+        for (int i = 0; i < n; i++)
+            static_cast<Player *>(events[i].data.ptr)->handle(events[i].events, now);
+        for (Player *p : players) {
+            if (p->next_wake() <= now)
+                p->wake(now);
+        }
+    }
+    auto now = clk::now();
+    for (Player *p : players)
+        p->stop(now);
+    double elapsed = duration<double>(now - opts.epoch).count();
+
+    if (!csv.empty()) {
+        ofstream out(csv);
+        out << "player,fragment,start_s,latency_ms,bytes,bitrate_kbps,buffer_s\n";
+        for (const FragmentSample &s : samples)
+            out << s.player << ',' << s.frag << ',' << s.start << ',' << s.latency * 1000 << ',' << s.bytes << ','
+                << s.bitrate << ',' << s.buffer << '\n';
+    }
+    report(opts, players, samples, elapsed);
+    return 0;
+}
@@ -0,0 +1,143 @@
+#include "Abr.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+using std::max;
+using std::min;
+using std::chrono::duration;
+using std::chrono::steady_clock;
+
+static const EwmaPolicy EWMA;
+static const HarmonicMeanPolicy HARMONIC;
+static const BufferBasedPolicy BBA;
+static const MpcPolicy MPC;
+
+AbrLadder::AbrLadder(const vector<int> &bitrates) : count(min(bitrates.size(), (size_t)ABR_MAX_RUNGS)) {
+    if (count < 2) {
+        std::copy(bitrates.begin(), bitrates.begin() + count, rungs);
+        return;
+    }
+    // evenly spaced picks, the ends included; all of them when the ladder fits
+    for (size_t i = 0; i < count; i++)
+        rungs[i] = bitrates[i * (bitrates.size() - 1) / (count - 1)];
+}
+
+AbrSession::AbrSession(const AbrLadder &ladder, float alpha)
+    : ladder(ladder), alpha(alpha), nsamples(0), next_sample(0), ewma(ladder[0]), buffer(0), last_bitrate(ladder[0]),
+      last_delivery(steady_clock::now()) {}
+
+void AbrSession::add_sample(double tput) {
+    samples[next_sample] = tput;
+    next_sample = (next_sample + 1) % ABR_HISTORY;
+    nsamples = min(nsamples + 1, ABR_HISTORY);
+    ewma = alpha * tput + (1 - alpha) * ewma;
+}
+
+float AbrSession::buffer_now() const {
+    float played = duration<float>(steady_clock::now() - last_delivery).count();
+    return max(0.f, buffer - played);
+}
+
+void AbrSession::delivered(int bitrate) {
+    last_bitrate = bitrate;
+    buffer = min(buffer_now() + ABR_FRAGMENT_SECONDS, ABR_MAX_BUFFER_SECONDS);
+    last_delivery = steady_clock::now();
+}
+
+double AbrSession::harmonic_mean() const {
+    if (nsamples == 0)
+        return 0;
+    double inverse = 0;
+    for (int i = 0; i < nsamples; i++)
+        inverse += 1 / max((double)samples[i], 1e-3);
+    return nsamples / inverse;
+}
+
+// highest rung the estimate covers ABR_SAFETY_MARGIN times over
+static int highest_within(const AbrLadder &ladder, double tput) {
+    size_t i = 0;
+    while (i + 1 < ladder.size() && ladder[i + 1] * ABR_SAFETY_MARGIN <= tput) {
+        i++;
+    }
+    return ladder[i];
+}
+
+void AbrPolicy::update(AbrSession &s, double tput) const { s.add_sample(tput); }
+
+const AbrPolicy *AbrPolicy::by_name(const string &name) {
+    if (name == "ewma")
+        return &EWMA;
+    if (name == "harmonic")
+        return &HARMONIC;
+    if (name == "bba")
+        return &BBA;
+    if (name == "mpc")
+        return &MPC;
+    return nullptr;
+}
+
+int EwmaPolicy::choose(const AbrSession &s) const { return highest_within(s.ladder, s.ewma); }
+
+int HarmonicMeanPolicy::choose(const AbrSession &s) const {
+    if (s.nsamples == 0)
+        return s.ladder[0];
+    return highest_within(s.ladder, s.harmonic_mean());
+}
+
+int BufferBasedPolicy::choose(const AbrSession &s) const {
+    float buffer = s.buffer_now();
+    if (buffer <= ABR_BBA_RESERVOIR_SECONDS)
+        return s.ladder.front();
+    if (buffer >= ABR_BBA_RESERVOIR_SECONDS + ABR_BBA_CUSHION_SECONDS)
+        return s.ladder.back();
+    double fill = (buffer - ABR_BBA_RESERVOIR_SECONDS) / ABR_BBA_CUSHION_SECONDS;
+    double rate = s.ladder.front() + fill * (s.ladder.back() - s.ladder.front());
+    int chosen = s.ladder.front();
+    for (int rung : s.ladder) {
+        if (rung <= rate)
+            chosen = rung;
+    }
+    return chosen;
+}
+
+int MpcPolicy::choose(const AbrSession &s) const {
+    double tput = s.harmonic_mean();
+    if (tput <= 0)
+        return s.ladder[0];
+    // keep the search to ABR_MPC_MAX_PLANS plans however long the ladder is
+    int horizon = 1;
+    double plans = s.ladder.size();
+    while (horizon < ABR_MPC_HORIZON && plans * s.ladder.size() <= ABR_MPC_MAX_PLANS) {
+        plans *= s.ladder.size();
+        horizon++;
+    }
+    int first = s.ladder[0];
+    search(s, 0, horizon, tput, s.buffer_now(), s.last_bitrate, &first);
+    return first;
+}
+
+/**
+ * @brief Best QoE over the rest of the horizon, in Mbps-seconds: bitrate of each step, minus
+ * rebuffering weighted by the top rung (the paper's lambda) and bitrate switches.
+ */
+double MpcPolicy::search(const AbrSession &s, int depth, int horizon, double tput, float buffer, int prev,
+                         int *first) const {
+    if (depth == horizon)
+        return 0;
+    double rebuffer_penalty = s.ladder.back() / 1000.;
+    double best = -std::numeric_limits<double>::infinity();
+    for (int rate : s.ladder) {
+        double download = rate * ABR_FRAGMENT_SECONDS / tput;
+        double rebuffer = max(0., download - buffer);
+        float next = min((float)(max(0., buffer - download) + ABR_FRAGMENT_SECONDS), ABR_MAX_BUFFER_SECONDS);
+        double qoe = rate / 1000. - rebuffer_penalty * rebuffer - ABR_MPC_SWITCH_PENALTY * std::fabs(rate - prev) / 1000.;
+        qoe += search(s, depth + 1, horizon, tput, next, rate, nullptr);
+        if (qoe > best) {
+            best = qoe;
+            if (first)
+                *first = rate;
+        }
+    }
+    return best;
+}
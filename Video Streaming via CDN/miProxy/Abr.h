@@ -0,0 +1,105 @@
+#ifndef _ABR_H_
+#define _ABR_H_
+
+#include "params.h"
+#include <chrono>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+/**
+ * A session's bitrates (kbps, ascending), held inline so a session is one flat struct.
+ * Ladders longer than ABR_MAX_RUNGS are thinned to that many, bottom and top rungs kept.
+ */
+struct AbrLadder {
+    int rungs[ABR_MAX_RUNGS];
+    uint8_t count;
+
+    AbrLadder() : count(0) {}
+    AbrLadder(const vector<int> &bitrates);
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    int operator[](size_t i) const { return rungs[i]; }
+    int front() const { return rungs[0]; }
+    int back() const { return rungs[count - 1]; }
+    const int *begin() const { return rungs; }
+    const int *end() const { return rungs + count; }
+};
+
+/**
+ * Everything a policy knows about one session, fixed size; updates and decisions never
+ * allocate.
+ * The proxy can't see the player's buffer, so it is modelled: every delivered fragment
+ * adds ABR_FRAGMENT_SECONDS, wall time drains it while the player plays.
+ */
+struct AbrSession {
+    AbrLadder ladder;
+    float alpha;                       // EWMA weight of a new sample
+    float samples[ABR_HISTORY];        // last throughput samples (kbps), a ring
+    uint8_t nsamples;
+    uint8_t next_sample;
+    double ewma;                       // kept for every policy, it is what gets logged
+    float buffer;                      // seconds of video the player is estimated to hold
+    int last_bitrate;
+    std::chrono::steady_clock::time_point last_delivery;
+
+    AbrSession() : alpha(0), nsamples(0), next_sample(0), ewma(0), buffer(0), last_bitrate(0) {} // no ladder yet
+    AbrSession(const AbrLadder &ladder, float alpha);
+    void add_sample(double tput);
+    void delivered(int bitrate); // a fragment reached the player, measured or not
+    float buffer_now() const;
+    // Harmonic mean of the recent samples, 0 without any.
+    double harmonic_mean() const;
+};
+
+/**
+ * A bitrate adaptation policy. Policies are stateless and shared by every session on every
+ * worker; what they remember lives in the AbrSession they are handed.
+ */
+class AbrPolicy {
+  public:
+    virtual ~AbrPolicy() {}
+    // Throughput sample (kbps) for a fragment that just went out.
+    virtual void update(AbrSession &s, double tput) const;
+    virtual int choose(const AbrSession &s) const = 0;
+
+    // nullptr for an unknown name
+    static const AbrPolicy *by_name(const string &name);
+};
+
+// The original rule: highest rung the EWMA covers 1.5 times over.
+class EwmaPolicy : public AbrPolicy {
+  public:
+    int choose(const AbrSession &s) const override;
+};
+
+// Same margin over the harmonic mean of the last ABR_HISTORY samples, which one lucky
+// fast fragment can't drag up the way it does an average.
+class HarmonicMeanPolicy : public AbrPolicy {
+  public:
+    int choose(const AbrSession &s) const override;
+};
+
+// BBA-0 (Huang et al.): bottom rung below the reservoir, top rung above reservoir +
+// cushion, and a linear ramp from buffer level to rate in between. Throughput is ignored.
+class BufferBasedPolicy : public AbrPolicy {
+  public:
+    int choose(const AbrSession &s) const override;
+};
+
+// MPC (Yin et al.): try every bitrate plan for the next few fragments against the
+// predicted throughput and buffer, keep the first step of the plan with the best QoE
+// (bitrate, minus rebuffering and switching penalties).
+class MpcPolicy : public AbrPolicy {
+  public:
+    int choose(const AbrSession &s) const override;
+
+  private:
+    double search(const AbrSession &s, int depth, int horizon, double tput, float buffer, int prev,
+                  int *first) const;
+};
+
+#endif
@@ -0,0 +1,208 @@
+#include "Admin.h"
+#include "Socket.h"
+#include "Stats.h"
+#include "Worker.h"
+#include <algorithm>
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+
+using std::chrono::duration_cast;
+using std::chrono::seconds;
+using std::chrono::steady_clock;
+
+static const uint32_t ADMIN_EVENTS = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+
+static bool would_block() { return errno == EAGAIN || errno == EWOULDBLOCK; }
+
+static void line(string &out, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+static void line(string &out, const char *fmt, ...) {
+    char buf[256];
+    va_list ap;
+    va_start(ap, fmt);
+    int len = vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+    if (len > 0)
+        out.append(buf, std::min((size_t)len, sizeof(buf) - 1));
+}
+
+AdminListener::AdminListener(int fd, Admin *admin) : fd(fd), admin(admin) {}
+
+void AdminListener::handle_event(uint32_t events) {
+    while (true) {
+        int confd = accept4(fd, nullptr, nullptr, SOCK_NONBLOCK);
+        if (confd == -1) {
+            if (errno == EINTR)
+                continue;
+            if (!would_block())
+                perror("Error accepting admin connection");
+            return;
+        }
+        AdminRequest *r = new AdminRequest(confd, admin);
+        if (admin->loop.add(confd, ADMIN_EVENTS, r) == -1) {
+            socket_close(confd);
+            delete r;
+        }
+    }
+}
+
+AdminRequest::AdminRequest(int fd, Admin *admin) : fd(fd), admin(admin), outoff(0) {}
+
+void AdminRequest::handle_event(uint32_t events) {
+    if (fd == -1)
+        return;
+    while (outbuf.empty()) {
+        char buf[BUF_SIZE];
+        int len = recv(fd, buf, BUF_SIZE, 0);
+        if (len == -1 && would_block())
+            return;
+        if (len <= 0) {
+            close();
+            return;
+        }
+        inbuf.append(buf, len);
+        if (inbuf.find("\r\n\r\n") != string::npos || inbuf.find("\n\n") != string::npos) {
+            string body = admin->report();
+            outbuf = "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nContent-Length: " + std::to_string(body.size()) +
+                     "\r\nConnection: close\r\n\r\n" + body;
+        } else if (inbuf.size() > (size_t)MAX_HEADER_SIZE) {
+            close();
+            return;
+        }
+    }
+    while (outoff < outbuf.size()) {
+        int len = send(fd, outbuf.data() + outoff, outbuf.size() - outoff, MSG_NOSIGNAL);
+        if (len == -1) {
+            if (!would_block())
+                close();
+            return;
+        }
+        outoff += len;
+    }
+    close();
+}
+
+void AdminRequest::close() {
+    admin->loop.remove(fd);
+    socket_close(fd);
+    fd = -1;
+    admin->loop.retire(this);
+}
+
+Admin::Admin(int listen_fd, const vector<Worker *> *workers, args_t *args)
+    : workers(workers), args(args), started(steady_clock::now()), listener(listen_fd, this) {
+    loop.add(listen_fd, EPOLLIN | EPOLLET, &listener);
+}
+
+void Admin::start() {
+    thread = std::thread([this]() { loop.run(); });
+}
+
+/**
+ * @brief One "name value" per line; latency lines carry their percentiles in microseconds.
+ * Counters are read while the workers keep going, so the lines are not one instant.
+ */
+string Admin::report() {
+    string out;
+    int64_t connections = 0, accepted = 0, requests = 0, failed = 0, failovers = 0, bytes = 0;
+    int64_t buffered = 0, buffer_waits = 0, zerocopy_sends = 0, zerocopy_copied = 0;
+    int64_t fragment_hits = 0, prefetch_hits = 0, manifest_hits = 0, collapsed = 0, chunks_other = 0;
+    int64_t sessions = 0, sessions_evicted = 0, sessions_expired = 0;
+    vector<std::pair<int, int64_t>> chunks;
+    HistogramSnapshot phases[PHASES];
+    for (Worker *w : *workers) {
+        const WorkerStats &s = w->get_stats();
+        connections += s.connections.get();
+        accepted += s.accepted.get();
+        requests += s.requests.get();
+        failed += s.failed.get();
+        failovers += s.failovers.get();
+        buffered += s.buffered_bytes.get();
+        buffer_waits += s.buffer_waits.get();
+        bytes += s.bytes_relayed.get();
+        zerocopy_sends += s.zerocopy_sends.get();
+        zerocopy_copied += s.zerocopy_copied.get();
+        fragment_hits += s.fragment_hits.get();
+        prefetch_hits += s.prefetch_hits.get();
+        manifest_hits += s.manifest_hits.get();
+        collapsed += s.collapsed.get();
+        sessions += s.sessions.get();
+        sessions_evicted += s.sessions_evicted.get();
+        sessions_expired += s.sessions_expired.get();
+        chunks_other += s.chunks_other.get();
+        for (int i = 0; i < STATS_BITRATES; i++) {
+            int bitrate = s.chunk_bitrates[i].load(std::memory_order_relaxed);
+            if (bitrate == 0)
+                break;
+            size_t j = 0;
+            while (j < chunks.size() && chunks[j].first != bitrate)
+                j++;
+            if (j == chunks.size())
+                chunks.push_back(std::make_pair(bitrate, 0));
+            chunks[j].second += s.chunks[i].get();
+        }
+        for (int p = 0; p < PHASES; p++)
+            phases[p].add(s.phases[p]);
+    }
+    std::sort(chunks.begin(), chunks.end());
+
+    line(out, "uptime_seconds %lld\n", (long long)duration_cast<seconds>(steady_clock::now() - started).count());
+    line(out, "workers %zu\n", workers->size());
+    line(out, "connections_active %lld\n", (long long)connections);
+    line(out, "connections_accepted %lld\n", (long long)accepted);
+    line(out, "requests %lld\n", (long long)requests);
+    line(out, "requests_failed %lld\n", (long long)failed);
+    line(out, "requests_failed_over %lld\n", (long long)failovers);
+    line(out, "bytes_relayed %lld\n", (long long)bytes);
+    line(out, "sends_zerocopy %lld\n", (long long)zerocopy_sends);
+    line(out, "sends_zerocopy_copied %lld\n", (long long)zerocopy_copied);
+    line(out, "buffered_bytes %lld\n", (long long)buffered);
+    line(out, "buffer_waits %lld\n", (long long)buffer_waits);
+    line(out, "hits_fragment_cache %lld\n", (long long)fragment_hits);
+    line(out, "hits_prefetch %lld\n", (long long)prefetch_hits);
+    line(out, "hits_manifest_cache %lld\n", (long long)manifest_hits);
+    line(out, "hits_collapsed %lld\n", (long long)collapsed);
+    line(out, "sessions_active %lld\n", (long long)sessions);
+    line(out, "sessions_evicted %lld\n", (long long)sessions_evicted);
+    line(out, "sessions_expired %lld\n", (long long)sessions_expired);
+    for (auto &c : chunks)
+        line(out, "chunks_kbps_%d %lld\n", c.first, (long long)c.second);
+    if (chunks_other > 0)
+        line(out, "chunks_kbps_other %lld\n", (long long)chunks_other);
+    if (args->fragments) {
+        FragmentCacheStats f = args->fragments->stats();
+        line(out, "fragment_cache_hits %llu\n", (unsigned long long)f.hits);
+        line(out, "fragment_cache_misses %llu\n", (unsigned long long)f.misses);
+        line(out, "fragment_cache_evictions %llu\n", (unsigned long long)f.evictions);
+        line(out, "fragment_cache_rejections %llu\n", (unsigned long long)f.rejections);
+        line(out, "fragment_cache_bytes %zu\n", f.bytes);
+        line(out, "fragment_cache_entries %zu\n", f.entries);
+    }
+    if (args->disk) {
+        DiskCacheStats d = args->disk->stats();
+        line(out, "disk_cache_hits %llu\n", (unsigned long long)d.hits);
+        line(out, "disk_cache_misses %llu\n", (unsigned long long)d.misses);
+        line(out, "disk_cache_writes %llu\n", (unsigned long long)d.writes);
+        line(out, "disk_cache_dropped %llu\n", (unsigned long long)d.dropped);
+        line(out, "disk_cache_segments_recycled %llu\n", (unsigned long long)d.recycled);
+        line(out, "disk_cache_entries %zu\n", d.entries);
+    }
+    if (args->sessions) {
+        line(out, "sessions_restored %zu\n", args->sessions->restored());
+        line(out, "sessions_saved %zu\n", args->sessions->saved());
+    }
+    for (int p = 0; p < PHASES; p++) {
+        const HistogramSnapshot &h = phases[p];
+        line(out, "latency_us_%s count=%llu mean=%llu p50=%llu p90=%llu p99=%llu p999=%llu max=%llu\n",
+             phase_name((Phase)p), (unsigned long long)h.total,
+             (unsigned long long)(h.total ? h.sum / h.total : 0), (unsigned long long)h.percentile(0.5),
+             (unsigned long long)h.percentile(0.9), (unsigned long long)h.percentile(0.99),
+             (unsigned long long)h.percentile(0.999), (unsigned long long)h.max);
+    }
+    for (size_t i = 0; i < workers->size(); i++) {
+        const WorkerStats &s = (*workers)[i]->get_stats();
+        line(out, "worker_%zu connections_active=%lld requests=%lld bytes_relayed=%lld\n", i,
+             (long long)s.connections.get(), (long long)s.requests.get(), (long long)s.bytes_relayed.get());
+    }
+    return out;
+}
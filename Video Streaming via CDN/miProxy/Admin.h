@@ -0,0 +1,67 @@
+#ifndef _ADMIN_H_
+#define _ADMIN_H_
+
+#include "EventLoop.h"
+#include "Proxy.h"
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+class Admin;
+class Worker;
+
+// Accepts on the admin port.
+class AdminListener : public EventHandler {
+  public:
+    AdminListener(int fd, Admin *admin);
+    void handle_event(uint32_t events) override;
+
+  private:
+    int fd;
+    Admin *admin;
+};
+
+// One request on the admin port: read a header, whatever it asks for it gets the report.
+class AdminRequest : public EventHandler {
+  public:
+    AdminRequest(int fd, Admin *admin);
+    void handle_event(uint32_t events) override;
+
+  private:
+    int fd;
+    Admin *admin;
+    string inbuf;
+    string outbuf;
+    size_t outoff;
+
+    void close();
+};
+
+/**
+ * Plain text stats on a port of its own (--admin-port), served from a thread of its own
+ * so a scrape never queues behind browser traffic. Every worker's counters and
+ * histograms are added up when the report is made; the workers never wait on it.
+ *   curl http://localhost:<admin-port>/
+ */
+class Admin {
+  public:
+    Admin(int listen_fd, const vector<Worker *> *workers, args_t *args);
+    void start();
+    string report();
+
+  private:
+    friend class AdminListener;
+    friend class AdminRequest;
+    const vector<Worker *> *workers;
+    args_t *args;
+    std::chrono::steady_clock::time_point started;
+    EventLoop loop;
+    AdminListener listener;
+    std::thread thread;
+};
+
+#endif
@@ -0,0 +1,37 @@
+#include "BufferBudget.h"
+#include "params.h"
+#include <algorithm>
+
+BufferBudget::BufferBudget(EventLoop *loop, size_t max_bytes, WorkerStats *stats)
+    : max_bytes(max_bytes), used(0), stats(stats), waker(loop, BUFFER_TICK_MS, [this]() { wake(); }) {}
+
+size_t BufferBudget::admit(EventHandler *waiter, size_t want) {
+    size_t allowed = std::min(want, room());
+    if (allowed == 0) {
+        if (std::find(waiting.begin(), waiting.end(), waiter) == waiting.end()) {
+            waiting.push_back(waiter);
+            stats->buffer_waits.add(1);
+        }
+    }
+    return allowed;
+}
+
+void BufferBudget::adjust(long delta) {
+    used += delta;
+    stats->buffered_bytes.add(delta);
+}
+
+void BufferBudget::cancel(EventHandler *waiter) {
+    auto it = std::find(waiting.begin(), waiting.end(), waiter);
+    if (it != waiting.end())
+        waiting.erase(it);
+}
+
+void BufferBudget::wake() {
+    // edge triggered: an origin socket we stopped reading won't tell us again
+    while (!waiting.empty() && room() > 0) {
+        EventHandler *h = waiting.front();
+        waiting.pop_front();
+        h->handle_event(EPOLLIN);
+    }
+}
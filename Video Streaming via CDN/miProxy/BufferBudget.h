@@ -0,0 +1,40 @@
+#ifndef _BUFFER_BUDGET_H_
+#define _BUFFER_BUDGET_H_
+
+#include "EventLoop.h"
+#include "Stats.h"
+#include <deque>
+#include <stddef.h>
+
+using std::deque;
+
+/**
+ * Per-worker cap on the bytes connections hold on their way from the origins to the
+ * browsers (relay buffers, splice pipes, manifests being read, bodies copied for the
+ * cache); --buffer-mb split evenly between workers. A connection asks for room before
+ * each read from its origin and reports what it holds afterwards. When there is no room
+ * it stops reading and waits here: every BUFFER_TICK_MS, once something was freed, the
+ * waiting connections are woken in the order they came.
+ */
+class BufferBudget {
+  public:
+    BufferBudget(EventLoop *loop, size_t max_bytes, WorkerStats *stats);
+    // Room for up to want more bytes. 0 queues waiter, woken with EPOLLIN once there is room.
+    size_t admit(EventHandler *waiter, size_t want);
+    // Room left, without queueing for it.
+    size_t room() const { return used < max_bytes ? max_bytes - used : 0; }
+    // What a connection holds changed by delta; may go over by a header's rewrite.
+    void adjust(long delta);
+    void cancel(EventHandler *waiter);
+
+  private:
+    size_t max_bytes;
+    size_t used;
+    WorkerStats *stats;
+    deque<EventHandler *> waiting;
+    PeriodicTimer waker;
+
+    void wake();
+};
+
+#endif
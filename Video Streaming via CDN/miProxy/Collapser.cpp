@@ -0,0 +1,204 @@
+#include "Collapser.h"
+#include "Proxy.h"
+#include "UpstreamPool.h"
+#include <algorithm>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using std::lock_guard;
+using std::memory_order_acquire;
+using std::memory_order_release;
+using std::mutex;
+using std::chrono::duration_cast;
+using std::chrono::nanoseconds;
+using std::chrono::steady_clock;
+
+FollowerWakeup::FollowerWakeup(EventLoop *loop) : rung(false) {
+    fd = eventfd(0, EFD_NONBLOCK);
+    if (fd == -1) {
+        perror("Error creating eventfd");
+        exit(-1);
+    }
+    loop->add(fd, EPOLLIN | EPOLLET, this);
+}
+
+FollowerWakeup::~FollowerWakeup() { close(fd); }
+
+void FollowerWakeup::ring(shared_ptr<InflightFetch> fetch) {
+    {
+        lock_guard<mutex> guard(lock);
+        if (std::find(rang.begin(), rang.end(), fetch) == rang.end())
+            rang.push_back(fetch);
+    }
+    if (rung.exchange(true))
+        return;
+    uint64_t one = 1;
+    if (write(fd, &one, sizeof(one)) != sizeof(one))
+        perror("Error ringing followers");
+}
+
+void FollowerWakeup::handle_event(uint32_t events) {
+    uint64_t count;
+    while (read(fd, &count, sizeof(count)) == sizeof(count)) {
+    }
+    // cleared before the fetches are taken, so a chunk appended meanwhile rings again
+    rung.store(false);
+    vector<shared_ptr<InflightFetch>> woken;
+    {
+        lock_guard<mutex> guard(lock);
+        woken.swap(rang);
+    }
+    for (auto &fetch : woken)
+        fetch->wake(this);
+}
+
+InflightFetch::InflightFetch(Collapser *owner, const string &key)
+    : owner(owner), key_(key), status_(WAITING), available_(0) {}
+
+void InflightFetch::wait(FollowerWakeup *wakeup, EventHandler *follower) {
+    lock_guard<mutex> guard(lock);
+    waiters.push_back(Waiter{wakeup, follower});
+}
+
+void InflightFetch::stop_waiting(EventHandler *follower) {
+    lock_guard<mutex> guard(lock);
+    for (auto it = waiters.begin(); it != waiters.end(); ++it) {
+        if (it->follower == follower) {
+            waiters.erase(it);
+            return;
+        }
+    }
+}
+
+void InflightFetch::wake(FollowerWakeup *wakeup) {
+    vector<EventHandler *> woken;
+    {
+        lock_guard<mutex> guard(lock);
+        for (const Waiter &w : waiters) {
+            if (w.wakeup == wakeup)
+                woken.push_back(w.follower);
+        }
+    }
+    for (EventHandler *h : woken)
+        h->handle_event(0); // one that finished or closed during the round just returns
+}
+
+void InflightFetch::start(const string &header, size_t body_len) {
+    auto fragment = std::make_shared<CachedFragment>();
+    fragment->header = header;
+    fragment->body.resize(body_len);
+    fragment_ = fragment;
+    status_.store(STREAMING, memory_order_release);
+    ring_waiters();
+}
+
+void InflightFetch::append(const char *data, size_t len) {
+    size_t have = available_.load(std::memory_order_relaxed);
+    len = std::min(len, fragment_->body.size() - have);
+    memcpy(&fragment_->body[have], data, len);
+    available_.store(have + len, memory_order_release);
+    ring_waiters();
+}
+
+ssize_t InflightFetch::receive(int fd) {
+    size_t have = available_.load(std::memory_order_relaxed);
+    ssize_t len = recv(fd, &fragment_->body[have], fragment_->body.size() - have, 0);
+    if (len > 0) {
+        available_.store(have + len, memory_order_release);
+        ring_waiters();
+    }
+    return len;
+}
+
+void InflightFetch::finish() { end(DONE); }
+
+void InflightFetch::fail() { end(FAILED); }
+
+void InflightFetch::end(Status st) {
+    if (status() == DONE || status() == FAILED)
+        return;
+    // out of the table first: a request from now on leads a fetch of its own (or hits the cache)
+    owner->done(key_, this);
+    status_.store(st, memory_order_release);
+    ring_waiters();
+}
+
+void InflightFetch::ring_waiters() {
+    vector<FollowerWakeup *> ring;
+    {
+        lock_guard<mutex> guard(lock);
+        for (const Waiter &w : waiters) {
+            if (std::find(ring.begin(), ring.end(), w.wakeup) == ring.end())
+                ring.push_back(w.wakeup);
+        }
+    }
+    if (ring.empty())
+        return;
+    shared_ptr<InflightFetch> self = shared_from_this();
+    for (FollowerWakeup *w : ring)
+        w->ring(self);
+}
+
+InflightReader::InflightReader(EventLoop *loop, args_t *args, state_t *state, shared_ptr<InflightFetch> fetch,
+                               UpstreamConn *up, bool reusable, steady_clock::time_point started)
+    : loop(loop), args(args), state(state), fetch(fetch), up(up), reusable(reusable),
+      held(fetch->fragment()->body.size()), started(started) {
+    up->owner = this;
+    if (state->buffers)
+        state->buffers->adjust(held);
+    // the head's read may have brought all of it, or more may be waiting already
+    handle_event(0);
+}
+
+void InflightReader::handle_event(uint32_t events) {
+    while (up) {
+        if (fetch->available() == fetch->fragment()->body.size()) {
+            end(true);
+            return;
+        }
+        ssize_t len = fetch->receive(up->fd);
+        if (len == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return;
+        if (len <= 0)
+            end(false);
+    }
+}
+
+void InflightReader::end(bool ok) {
+    string origin = up->origin;
+    state->pool->release(up, ok && reusable);
+    up = nullptr;
+    if (ok) {
+        fetch->finish();
+        if (args->fragments)
+            args->fragments->insert(fetch->key(), fetch->fragment());
+        double seconds = duration_cast<nanoseconds>(steady_clock::now() - started).count() / 1000000000.0;
+        state->origins->delivered(origin, fetch->available() / 125. / seconds);
+    } else {
+        fetch->fail();
+    }
+    if (state->buffers)
+        state->buffers->adjust(-(long)held);
+    loop->retire(this);
+}
+
+shared_ptr<InflightFetch> Collapser::join(const string &key, bool *leader) {
+    lock_guard<mutex> guard(lock);
+    shared_ptr<InflightFetch> &fetch = inflight[key];
+    *leader = !fetch;
+    if (!fetch)
+        fetch = std::make_shared<InflightFetch>(this, key);
+    return fetch;
+}
+
+void Collapser::done(const string &key, InflightFetch *fetch) {
+    lock_guard<mutex> guard(lock);
+    auto it = inflight.find(key);
+    if (it != inflight.end() && it->second.get() == fetch)
+        inflight.erase(it);
+}
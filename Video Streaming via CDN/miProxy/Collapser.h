@@ -0,0 +1,141 @@
+#ifndef _COLLAPSER_H_
+#define _COLLAPSER_H_
+
+#include "EventLoop.h"
+#include "FragmentCache.h"
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using std::shared_ptr;
+using std::string;
+using std::unordered_map;
+using std::vector;
+
+struct args_t;
+struct state_t;
+class InflightFetch;
+class UpstreamConn;
+
+/**
+ * Per-worker doorbell for connections following a fetch that another worker (or this one)
+ * leads. ring() may be called from any thread and costs one eventfd write until the
+ * worker has answered it; the worker then wakes the followers of just the fetches that
+ * rang, each of which keeps its own.
+ */
+class FollowerWakeup : public EventHandler {
+  public:
+    FollowerWakeup(EventLoop *loop);
+    ~FollowerWakeup();
+    void ring(shared_ptr<InflightFetch> fetch);
+    void handle_event(uint32_t events) override;
+
+  private:
+    int fd;
+    std::atomic<bool> rung;
+    std::mutex lock; // rang
+    vector<shared_ptr<InflightFetch>> rang;
+};
+
+class Collapser;
+
+/**
+ * One origin fetch of a fragment, shared as it comes in. The leader gives it the head and
+ * then the body chunk by chunk; followers send what is there and are woken for more.
+ * The body is allocated at its full length up front and never moves, so followers read
+ * it without the lock, up to available(). Once the head is in, an InflightReader fills
+ * the body and the leader is sent it like any follower.
+ */
+class InflightFetch : public std::enable_shared_from_this<InflightFetch> {
+  public:
+    enum Status { WAITING, STREAMING, DONE, FAILED };
+
+    InflightFetch(Collapser *owner, const string &key);
+    const string &key() const { return key_; }
+    Status status() const { return status_.load(std::memory_order_acquire); }
+    // Head and body, once STREAMING.
+    shared_ptr<const CachedFragment> fragment() const { return fragment_; }
+    size_t available() const { return available_.load(std::memory_order_acquire); }
+    // follower is woken through its worker's wakeup until it stops waiting.
+    void wait(FollowerWakeup *wakeup, EventHandler *follower);
+    void stop_waiting(EventHandler *follower);
+    // Wake the followers on wakeup's worker; from its thread.
+    void wake(FollowerWakeup *wakeup);
+
+    // leader side
+    void start(const string &header, size_t body_len);
+    void append(const char *data, size_t len);
+    // Read the next of the body from fd straight into place; recv's result.
+    ssize_t receive(int fd);
+    void finish();
+    void fail();
+
+  private:
+    struct Waiter {
+        FollowerWakeup *wakeup;
+        EventHandler *follower;
+    };
+
+    Collapser *owner;
+    string key_;
+    std::atomic<Status> status_;
+    shared_ptr<CachedFragment> fragment_;
+    std::atomic<size_t> available_;
+    std::mutex lock; // waiters
+    vector<Waiter> waiters;
+
+    void ring_waiters();
+    void end(Status st);
+};
+
+/**
+ * The origin side of a fetch whose head is in: reads the rest of the body into it as fast
+ * as the origin sends, then finishes it and puts it in the fragment cache. The leading
+ * request hands over its origin connection and is sent the body like a follower, so its
+ * browser neither paces the others nor takes the fetch down when it goes away; only the
+ * origin failing fails it. The whole body counts against the worker's buffer budget until
+ * it is done.
+ */
+class InflightReader : public EventHandler {
+  public:
+    // started: when the request that led it came in, for the origin's delivery rate
+    InflightReader(EventLoop *loop, args_t *args, state_t *state, shared_ptr<InflightFetch> fetch, UpstreamConn *up,
+                   bool reusable, std::chrono::steady_clock::time_point started);
+    void handle_event(uint32_t events) override;
+
+  private:
+    EventLoop *loop;
+    args_t *args;
+    state_t *state;
+    shared_ptr<InflightFetch> fetch;
+    UpstreamConn *up;
+    bool reusable; // the origin's connection goes back to the pool at the end of the body
+    size_t held;   // bytes counted against state->buffers
+    std::chrono::steady_clock::time_point started;
+
+    void end(bool ok);
+};
+
+/**
+ * Process-wide table of fragment fetches in flight, keyed like the fragment cache. The
+ * first request for a fragment leads its fetch; identical requests that come in while it
+ * runs follow it instead of going to the origin, and get the body as the leader reads it.
+ */
+class Collapser {
+  public:
+    // The fetch in flight for key, or a new one for the caller to lead (*leader set).
+    shared_ptr<InflightFetch> join(const string &key, bool *leader);
+
+  private:
+    friend class InflightFetch;
+    std::mutex lock;
+    unordered_map<string, shared_ptr<InflightFetch>> inflight;
+
+    void done(const string &key, InflightFetch *fetch);
+};
+
+#endif
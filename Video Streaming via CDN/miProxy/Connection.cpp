@@ -0,0 +1,1250 @@
+#include "Connection.h"
+#include "Debug.h"
+#include "Http.h"
+#include "Socket.h"
+#include "params.h"
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/errqueue.h>
+#include <netinet/tcp.h>
+
+using std::min;
+using std::chrono::duration_cast;
+using std::chrono::nanoseconds;
+using std::chrono::steady_clock;
+
+static const uint32_t CONN_EVENTS = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+static const char VIDEO_HOST[] = "video.cse.umich.edu"; //  "Host: localhost\r\n"
+static const char BAD_GATEWAY[] = "HTTP/1.1 502 Bad Gateway\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+static const char BAD_REQUEST[] = "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+static const char TOO_LARGE[] = "HTTP/1.1 413 Payload Too Large\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+static const char NOT_IMPLEMENTED[] = "HTTP/1.1 501 Not Implemented\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+
+static bool would_block() { return errno == EAGAIN || errno == EWOULDBLOCK; }
+
+Connection::Connection(int fd, string client_ip, uint32_t client_addr, EventLoop *loop, args_t *args, state_t *state)
+    : fd(fd), up(nullptr), client_ip(client_ip), client_addr(client_addr), loop(loop), args(args), state(state), st(READ_REQUEST), kind(OTHER),
+      retried(false), reusable(false), parser(MAX_HEADER_SIZE, MAX_REQUEST_BODY), client_keep_alive(false), upstream_sent(0), header_len(0), outoff(0), framing(BODY_LENGTH), body_len(0), body_recv(0), upstream_eof(false),
+      splicing(false), pipe_bytes(0), corked(false), buffered(0), hit_off(0), hit_sample(false), zerocopy(ZEROCOPY_UNTRIED), zerocopy_next(0), capturing(false), pending(nullptr), leading(false), client_sent(0), seg(0, 0), bitrate(0), began(steady_clock::now()), idle(false),
+      answered(false) {
+    pipefd[0] = pipefd[1] = -1;
+    state->stats->connections.add(1);
+    state->stats->accepted.add(1);
+    upstream_handler.conn = this;
+    resolve_handler.conn = this;
+    if (state->egress)
+        state->egress->join(&egress, client_ip, this);
+    loop->add(fd, CONN_EVENTS, this);
+}
+
+void Connection::handle_event(uint32_t events) {
+    if (st == CLOSED)
+        return;
+    if (events & EPOLLERR) {
+        // MSG_ZEROCOPY completions come in on the error queue too, only a socket error ends us
+        if (zerocopy == ZEROCOPY_UNTRIED || (reap_zerocopy(), socket_connect_error(fd) != 0)) {
+            close();
+            return;
+        }
+    }
+    advance();
+}
+
+void Connection::handle_upstream_event(uint32_t events) {
+    if (st == CLOSED)
+        return;
+    advance();
+}
+
+/**
+ * @brief Run the state machine until every step that could make progress is waiting on EAGAIN.
+ */
+void Connection::advance() {
+    bool progress = true;
+    while (progress) {
+        switch (st) {
+        case READ_REQUEST:
+            progress = read_request();
+            break;
+        case RESOLVE:
+            progress = false; // resolve_handler picks it up
+            break;
+        case WAIT_DISK:
+            progress = await_disk();
+            break;
+        case WAIT_PREFETCH:
+            progress = await_prefetch();
+            break;
+        case FOLLOW:
+            progress = follow();
+            break;
+        case CONNECT:
+            progress = connect_upstream();
+            break;
+        case SEND_REQUEST:
+            progress = send_request();
+            break;
+        case READ_RESPONSE:
+            progress = read_response();
+            break;
+        case RELAY_BODY:
+            progress = relay_body();
+            break;
+        case CLOSED:
+            progress = false;
+            break;
+        }
+    }
+    account_buffers();
+}
+
+bool Connection::read_request() {
+    int parsed = parser.parse();
+    if (parsed == -1) {
+        // best effort, like fail()
+        if (parser.error == 400)
+            send(fd, BAD_REQUEST, sizeof(BAD_REQUEST) - 1, MSG_NOSIGNAL);
+        else if (parser.error == 413)
+            send(fd, TOO_LARGE, sizeof(TOO_LARGE) - 1, MSG_NOSIGNAL);
+        else if (parser.error == 501)
+            send(fd, NOT_IMPLEMENTED, sizeof(NOT_IMPLEMENTED) - 1, MSG_NOSIGNAL);
+        close();
+        return false;
+    }
+    if (parsed == 1 && parser.buffer().size() >= parser.head_len + parser.content_length) {
+        request.assign(parser.buffer(), 0, parser.head_len + parser.content_length);
+        parser.consume(parser.content_length);
+        start_exchange();
+        return true;
+    }
+    char buf[BUF_SIZE];
+    int len = recv(fd, buf, BUF_SIZE, 0);
+    if (len == -1) {
+        if (!would_block()) {
+            perror("Error receiving request");
+            close();
+        }
+        return false;
+    }
+    if (len == 0) {
+        close();
+        return false;
+    }
+    if (idle) {
+        began = steady_clock::now();
+        idle = false;
+    }
+    parser.feed(buf, len);
+    return true;
+}
+
+/**
+ * @brief Work out what the request is and build the request we send to the origin.
+ */
+void Connection::start_exchange() {
+    DEBUG_OUT("@@@@@ Header:\n" << request << "@@@@@");
+    // a fragment's time includes the wait for its first byte, the player waits for it too
+    start = steady_clock::now();
+    header_done = start;
+    answered = false;
+    state->stats->requests.add(1);
+    state->stats->phases[PHASE_HEADER].record(began, header_done);
+
+    client_keep_alive = parser.keep_alive;
+    retried = false;
+    tried.clear();
+
+    // DNS request needed?
+    switch (state->dns->lookup(client_addr, VIDEO_HOST, &primary_ip)) {
+    case ResolutionCache::HIT: // I have it already (maybe refreshing in the background)
+        if (!choose_origin())
+            return;
+        route_request();
+        return;
+    case ResolutionCache::NEGATIVE:
+        fail();
+        return;
+    case ResolutionCache::MISS:
+        break;
+    }
+    st = RESOLVE;
+    waiting = steady_clock::now();
+    DNSAnswer answer;
+    if (state->resolver->resolve(VIDEO_HOST, &resolve_handler, &answer))
+        resolved(answer);
+}
+
+void Connection::resolved(const DNSAnswer &answer) {
+    if (st != RESOLVE)
+        return;
+    state->stats->phases[PHASE_DNS].record(waiting, steady_clock::now());
+    state->dns->store(client_addr, answer);
+    if (answer.ip.empty()) {
+        fail();
+        return;
+    }
+    primary_ip = answer.ip;
+    if (!choose_origin())
+        return;
+    // the manifest fetches are next, have a connection warming up for them
+    state->pool->preconnect(server_ip);
+    route_request();
+}
+
+/**
+ * @brief Settle on the origin for this attempt, see OriginSet::pick.
+ */
+bool Connection::choose_origin() {
+    server_ip = state->origins->pick(primary_ip, tried);
+    if (server_ip.empty()) {
+        fail();
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief This client's session. One that never fetched the manifest, or was evicted from
+ * the session table since, starts over on the default ladder.
+ */
+BitrateTracker &Connection::find_tracker() {
+    BitrateTracker *tracker = state->trackers->find(client_addr);
+    if (!tracker) {
+        tracker = state->trackers->insert(client_addr, BitrateTracker(args->abr, args->alpha, {10, 100, 500, 1000}));
+        DEBUG_OUT("@@@@@ Please don't run:"
+                  << "@@@@@");
+    }
+    return *tracker;
+}
+
+/**
+ * @brief The origin is known: rewrite the request for it and pick how to answer.
+ */
+void Connection::route_request() {
+    if (!rewrite.parse(request.data(), request.size())) {
+        close();
+        return;
+    }
+    rewrite.set_host(server_ip);
+    seg = rewrite.fragment();
+    if (parser.path.find(".f4m") != string::npos) {
+        start_manifest(rewrite.str());
+        return;
+    } else if (seg.first != 0 && seg.second != 0) {
+        kind = FRAGMENT;
+        bitrate = find_tracker().get_bitrate();
+        if (state->egress)
+            state->egress->set_bitrate(&egress, bitrate);
+        rewrite.set_fragment(bitrate, seg.first, seg.second);
+        DEBUG_OUT("@@@@@ Header:\n" << rewrite.str() << "@@@@@");
+        if (args->fragments || args->collapser) {
+            // built in place, the key's capacity is kept from one request to the next
+            fragment_key.assign(server_ip);
+            fragment_key += ' ';
+            rewrite.request_line(fragment_key);
+        }
+        if (args->fragments) {
+            bool seen_before = false, on_disk = false;
+            hit = args->fragments->lookup(fragment_key, &seen_before, &on_disk);
+            if (hit) {
+                state->stats->fragment_hits.add(1);
+                serve_fragment();
+                return;
+            }
+            // first sighting: relay (and splice) it without a copy, most never come back
+            capturing = seen_before;
+            if (on_disk) {
+                disk_read = state->disk_reads->start(fragment_key, this);
+                st = WAIT_DISK;
+                return;
+            }
+        }
+        fetch_fragment();
+        return;
+    } else { // index or others...
+        kind = OTHER;
+    }
+    st = CONNECT;
+}
+
+/**
+ * @brief Not cached: take this session's prefetch of it, follow someone else's fetch of
+ * it, or fetch it.
+ */
+void Connection::fetch_fragment() {
+    if (state->prefetch) {
+        pending = state->prefetch->claim(client_ip, seg, bitrate);
+        if (pending) {
+            pending->waiter = this;
+            st = WAIT_PREFETCH;
+            return;
+        }
+    }
+    // a fragment seen before may well be on its way for someone else right now
+    if (args->collapser && parser.method == "GET" && (!args->fragments || capturing)) {
+        bool lead = false;
+        inflight = args->collapser->join(fragment_key, &lead);
+        if (!lead) {
+            inflight->wait(state->followers, this);
+            st = FOLLOW;
+            return;
+        }
+        leading = true;
+    }
+    st = CONNECT;
+}
+
+/**
+ * @brief The disk cache has the fragment: serve it once a reader has it in memory, or
+ * carry on as for a miss if the log wrote over it meanwhile.
+ */
+bool Connection::await_disk() {
+    if (!disk_read->done)
+        return false;
+    hit = disk_read->value;
+    disk_read.reset();
+    if (!hit) {
+        fetch_fragment();
+        return true;
+    }
+    args->fragments->promote(fragment_key, hit);
+    state->stats->fragment_hits.add(1);
+    capturing = false;
+    serve_fragment();
+    return true;
+}
+
+/**
+ * @brief Manifests come out of the shared cache when they can. A miss fetches the full
+ * manifest (for the ladder) and the _nolist one (for the player); a stale entry only
+ * revalidates the _nolist one.
+ */
+void Connection::start_manifest(const string &header) {
+    manifest_key = server_ip + parser.path;
+    manifest_request = header;
+    ladder.clear();
+    nolist_header.clear();
+    nolist_body.clear();
+    cached = args->manifests->lookup(manifest_key);
+    if (cached && args->manifests->fresh(*cached)) {
+        state->stats->manifest_hits.add(1);
+        serve_manifest();
+        return;
+    }
+    if (cached) {
+        ladder = cached->bitrates;
+        kind = MANIFEST_NOLIST;
+        upstream_request = ManifestCache::conditional(nolist_request(), *cached);
+    } else {
+        // Request 1 - the ladder
+        kind = MANIFEST_LIST;
+        upstream_request = manifest_request;
+    }
+    st = CONNECT;
+}
+
+string Connection::nolist_request() {
+    string header = manifest_request;
+    header.insert(header.find(".f4m"), "_nolist");
+    return header;
+}
+
+/**
+ * @brief The fragment was prefetched at the bitrate we picked. Serve it once it is in, or
+ * fetch it ourselves if the prefetch failed or the origin said no.
+ */
+bool Connection::await_prefetch() {
+    if (pending->status == Prefetch::RUNNING)
+        return false;
+    shared_ptr<const CachedFragment> result = pending->result;
+    pending->waiter = nullptr;
+    state->prefetch->consumed(pending);
+    pending = nullptr;
+    if (!result || status_code(result->header) != 200) {
+        st = CONNECT;
+        return true;
+    }
+    if (capturing) {
+        args->fragments->insert(fragment_key, result->header, result->body);
+        capturing = false;
+    }
+    state->stats->prefetch_hits.add(1);
+    hit = result;
+    serve_fragment();
+    return true;
+}
+
+/**
+ * @brief Another request is fetching this fragment: once its head is in, send the body
+ * along as it arrives, like a cache hit that is still being filled. If it fails before
+ * that, fetch it ourselves.
+ */
+bool Connection::follow() {
+    switch (inflight->status()) {
+    case InflightFetch::WAITING:
+        return false;
+    case InflightFetch::FAILED:
+        end_collapse();
+        st = CONNECT;
+        return true;
+    default:
+        state->stats->collapsed.add(1);
+        capturing = false; // the leader's copy goes to the cache, we have no response of our own
+        hit = inflight->fragment();
+        serve_fragment();
+        return true;
+    }
+}
+
+/**
+ * @brief Done leading or following. A fetch we led that has no head yet fails, so its
+ * followers fetch for themselves; once it has, its InflightReader sees it through.
+ */
+void Connection::end_collapse() {
+    if (!inflight)
+        return;
+    if (leading && inflight->status() == InflightFetch::WAITING)
+        inflight->fail();
+    else
+        inflight->stop_waiting(this);
+    inflight.reset();
+    leading = false;
+}
+
+/**
+ * @brief The player will want the next fragment soon, most likely at the bitrate the
+ * tracker picks now. Nothing to do if the cache already has it.
+ */
+void Connection::prefetch_next() {
+    pair<int, int> next(seg.first, seg.second + 1);
+    int next_bitrate = find_tracker().get_bitrate();
+    rewrite.set_fragment(next_bitrate, next.first, next.second);
+    if (args->fragments) {
+        fragment_key.assign(server_ip);
+        fragment_key += ' ';
+        rewrite.request_line(fragment_key);
+        if (args->fragments->contains(fragment_key))
+            return;
+    }
+    state->prefetch->start(client_ip, server_ip, rewrite.str(), next, next_bitrate);
+}
+
+bool Connection::connect_upstream() {
+    if (!up) {
+        waiting = steady_clock::now();
+        up = state->pool->acquire(server_ip, &upstream_handler);
+        if (!up)
+            return failover();
+    }
+    if (up->timed_out)
+        return failover();
+    int err = socket_connect_error(up->fd);
+    if (err != 0) {
+        errno = err;
+        perror("connect");
+        return failover();
+    }
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    if (getpeername(up->fd, (struct sockaddr *)&addr, &len) == -1) {
+        return false; // still connecting, wait for writability
+    }
+    state->stats->phases[PHASE_CONNECT].record(waiting, steady_clock::now());
+    upstream_sent = 0;
+    st = SEND_REQUEST;
+    return true;
+}
+
+/**
+ * @brief The browser's request goes out as a writev of its own bytes and the rewritten
+ * pieces; a manifest request we made up ourselves goes out as it is.
+ */
+bool Connection::send_request() {
+    size_t total = upstream_request.empty() ? rewrite.length() : upstream_request.length();
+    while (upstream_sent < total) {
+        ssize_t len;
+        if (upstream_request.empty()) {
+            struct iovec iov[REWRITE_MAX_IOV];
+            struct msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_iov = iov;
+            msg.msg_iovlen = rewrite.iov(upstream_sent, iov);
+            len = sendmsg(up->fd, &msg, MSG_NOSIGNAL); // writev, without the SIGPIPE
+        } else {
+            len = send(up->fd, upstream_request.data() + upstream_sent, upstream_request.length() - upstream_sent,
+                       MSG_NOSIGNAL);
+        }
+        if (len == -1) {
+            if (would_block())
+                return false;
+            return retry_fresh();
+        }
+        upstream_sent += len;
+    }
+    response.clear();
+    header_len = 0;
+    chunked.reset();
+    chunked_body.clear();
+    upstream_eof = false;
+    st = READ_RESPONSE;
+    return true;
+}
+
+bool Connection::read_response() {
+    char buf[BUF_SIZE];
+    size_t want = buffer_room(BUF_SIZE);
+    if (want == 0)
+        return false;
+    int len = recv(up->fd, buf, want, 0);
+    if (len == -1 && would_block()) {
+        return false;
+    }
+    if (len == 0 && header_len > 0 && framing == BODY_UNTIL_CLOSE) {
+        // only manifests are still here once the head is in, and this is their end
+        upstream_eof = true;
+        finish_manifest_fetch();
+        return true;
+    }
+    if (len <= 0) {
+        if (response.empty())
+            return retry_fresh();
+        return failover();
+    }
+    size_t old = response.size();
+    response.append(buf, len);
+    account_buffers();
+    if (header_len == 0) {
+        int hend = headerEnd(response.data(), response.size(), old);
+        if (hend == -1) {
+            if (response.size() >= (size_t)MAX_HEADER_SIZE)
+                fail();
+            return true;
+        }
+        header_len = hend;
+        if (kind != OTHER && status_code(response) >= 500) {
+            // the next origin may well have it; if there is none the browser gets this answer
+            string next = next_origin();
+            if (!next.empty()) {
+                move_to(next);
+                return st != CLOSED;
+            }
+        }
+        framing = body_framing(response, hend, parser.method == "HEAD", &body_len);
+        if (framing == BODY_INVALID) {
+            fail();
+            return false;
+        }
+        reusable = framing != BODY_UNTIL_CLOSE && keeps_alive(response, hend);
+        if (kind == OTHER)
+            DEBUG_OUT("@@@@@ Response Len: " << hend << "\n" << response.substr(0, hend) << "\n@@@@@\n\n");
+    }
+    size_t have = response.size() - header_len;
+    if (kind == MANIFEST_LIST || kind == MANIFEST_NOLIST) {
+        // manifests are small, take the whole thing before deciding what to do with it
+        if (have > (size_t)MANIFEST_MAX_BYTES) {
+            fail();
+            return false;
+        }
+        if (framing == BODY_CHUNKED) {
+            size_t fresh = min((size_t)len, have);
+            long used = chunked.feed(response.data() + response.size() - fresh, fresh, &chunked_body);
+            if (used == -1) {
+                fail();
+                return false;
+            }
+            if ((size_t)used < fresh)
+                reusable = false; // more than the response, don't trust the connection
+        }
+        if ((framing == BODY_LENGTH && have >= body_len) || (framing == BODY_CHUNKED && chunked.done()))
+            finish_manifest_fetch();
+        return true;
+    }
+    // forward here - idc about contents, only whether the browser connection stays open
+    if (framing == BODY_UNTIL_CLOSE)
+        client_keep_alive = false; // the browser can only find the end the way we do
+    if (framing == BODY_CHUNKED) {
+        long used = chunked.feed(response.data() + header_len, have);
+        if (used == -1) {
+            fail();
+            return false;
+        }
+        if ((size_t)used < have) {
+            reusable = false;
+            have = used;
+        }
+    }
+    if (leading) {
+        // followers get what the origin sends only if it is whole and worth having
+        if (framing == BODY_LENGTH && status_code(response) == 200 &&
+            (!state->buffers || state->buffers->room() >= body_len)) {
+            inflight->start(response.substr(0, header_len), body_len);
+            inflight->append(response.data() + header_len, have);
+            response.resize(header_len);
+            // the rest comes in at the origin's pace whatever happens to us; we are a follower now
+            inflight->wait(state->followers, this);
+            new InflightReader(loop, args, state, inflight, up, reusable, start);
+            up = nullptr;
+            capturing = false;
+            hit = inflight->fragment();
+            serve_fragment();
+            return true;
+        }
+        end_collapse();
+    }
+    outbuf.assign(response, 0, header_len);
+    set_connection(outbuf, client_keep_alive ? "keep-alive" : "close");
+    outbuf.append(response, header_len, have);
+    outoff = 0;
+    body_recv = have;
+    // the copy for the cache is held until the end; without room for it, just relay
+    capturing = capturing && framing == BODY_LENGTH && body_len > 0 && args->fragments->fits(body_len) &&
+                status_code(response) == 200 && (!state->buffers || state->buffers->room() >= body_len);
+    if (capturing) {
+        capture.reserve(body_len);
+        capture.assign(response, header_len, have);
+    }
+    rate.start(fd);
+    client_sent = 0;
+    // a chunked body has to be looked at to find its end, the others can go round user space
+    bool long_body = framing == BODY_UNTIL_CLOSE ||
+                     (framing == BODY_LENGTH && body_len - min(body_len, body_recv) >= (size_t)SPLICE_MIN_BYTES);
+    splicing = !capturing && RELAY_SPLICE && long_body && open_pipe();
+    if (splicing)
+        cork(true);
+    st = RELAY_BODY;
+    return true;
+}
+
+void Connection::finish_manifest_fetch() {
+    string head = response.substr(0, header_len);
+    string body;
+    if (framing == BODY_LENGTH) {
+        body = response.substr(header_len, body_len);
+    } else {
+        // the player gets (and the cache keeps) the whole body, so say how long it is
+        body = framing == BODY_CHUNKED ? std::move(chunked_body) : response.substr(header_len);
+        chunked_body.clear();
+        head = frame_by_length(head, body.size());
+    }
+    int status = status_code(head);
+    release_upstream(reusable && (framing != BODY_LENGTH || response.size() == header_len + body_len));
+    retried = false;
+
+    if (kind == MANIFEST_NOLIST && status == 304 && cached) {
+        cached = args->manifests->revalidated(manifest_key, cached);
+        serve_manifest();
+        return;
+    }
+    if (status != 200) {
+        // nothing worth caching, the player gets whatever the origin said
+        serve_response(head, body);
+        return;
+    }
+    if (kind == MANIFEST_LIST) {
+        ladder = parse_manifest(body);
+        if (ladder.empty()) {
+            ladder = {10, 100, 500, 1000};
+        }
+    } else {
+        if (cached && body != cached->body) {
+            ladder.clear(); // the video changed, its ladder may have too
+        }
+        nolist_header = head;
+        nolist_body = body;
+    }
+
+    if (ladder.empty()) {
+        kind = MANIFEST_LIST;
+        upstream_request = manifest_request;
+        st = CONNECT;
+    } else if (nolist_header.empty()) {
+        // Request 2 - what the player gets
+        kind = MANIFEST_NOLIST;
+        upstream_request = nolist_request();
+        st = CONNECT;
+    } else {
+        cached = args->manifests->insert(manifest_key, ladder, nolist_header, nolist_body);
+        serve_manifest();
+    }
+}
+
+void Connection::serve_manifest() {
+    if (!state->trackers->find(client_addr)) {
+        // So I have established a tracker here
+        state->trackers->insert(client_addr, BitrateTracker(args->abr, args->alpha, cached->bitrates));
+    }
+    serve_response(cached->header, cached->body);
+}
+
+/**
+ * @brief Answer from memory: the body is all here already, RELAY_BODY just flushes it.
+ */
+void Connection::serve_response(const string &head, const string &body) {
+    outbuf.assign(head);
+    set_connection(outbuf, client_keep_alive ? "keep-alive" : "close");
+    outbuf.append(body);
+    outoff = 0;
+    framing = BODY_LENGTH;
+    body_len = body.size();
+    body_recv = body_len;
+    splicing = false;
+    start = steady_clock::now();
+    st = RELAY_BODY;
+}
+
+/**
+ * @brief Cache hit: only the head is copied, the body goes out straight from the shared
+ * entry. Sending from memory is as fast as the client's ACKs allow at best, so only a
+ * TCP_INFO sample taken while the socket was not app-limited says anything about the
+ * client's bandwidth. Failing that, the send time does once the body outgrows the socket
+ * buffer; a smaller hit never counts as a sample.
+ */
+void Connection::serve_fragment() {
+    outbuf.assign(hit->header);
+    set_connection(outbuf, client_keep_alive ? "keep-alive" : "close");
+    outoff = 0;
+    hit_off = 0;
+    framing = BODY_LENGTH;
+    body_len = hit->body.size();
+    body_recv = body_len;
+    splicing = false;
+    int sndbuf = 0;
+    socklen_t optlen = sizeof(sndbuf);
+    getsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, &optlen);
+    hit_sample = args->hit_sample == HIT_SAMPLE_MEASURE && body_len > (size_t)sndbuf;
+    rate.start(fd);
+    client_sent = 0;
+    st = RELAY_BODY;
+}
+
+/**
+ * @brief Browser side first: whatever is buffered goes out as far as the socket (and the
+ * egress turn) allows. Then the origin side reads ahead of the browser, but no further
+ * than args->conn_buffer and the worker's buffer budget; a browser that is not keeping
+ * up stops the reads, and its writability (or the budget) starts them again.
+ */
+bool Connection::relay_body() {
+    if (hit)
+        return send_hit();
+    bool progress = false;
+    while (outoff < outbuf.size()) {
+        size_t allowed = egress_allowance(outbuf.size() - outoff);
+        if (allowed == 0)
+            break;
+        int len = send(fd, outbuf.data() + outoff, allowed, MSG_NOSIGNAL);
+        sent_to_client(allowed, len);
+        if (len == -1) {
+            if (!would_block()) {
+                close();
+                return false;
+            }
+            break;
+        }
+        outoff += len;
+        progress = true;
+    }
+    if (splicing) {
+        if (outoff < outbuf.size())
+            return progress; // the head goes first
+        return splice_body();
+    }
+    if (body_done()) {
+        if (outoff < outbuf.size())
+            return progress; // the browser still has the end of it to take
+        finish_exchange();
+        return st != CLOSED;
+    }
+    size_t pending = outbuf.size() - outoff;
+    if (pending >= args->conn_buffer)
+        return progress;
+    // as much as the buffer takes, the browser then gets it in as few sends as its socket allows
+    size_t want = args->conn_buffer - pending;
+    if (framing == BODY_LENGTH)
+        want = min(want, body_len - body_recv);
+    want = buffer_room(want);
+    if (want == 0)
+        return progress;
+    if (outoff > 0) {
+        outbuf.erase(0, outoff);
+        outoff = 0;
+    }
+    size_t old = outbuf.size();
+    outbuf.resize(old + want);
+    int len = recv(up->fd, &outbuf[old], want, 0);
+    if (len == 0 && framing == BODY_UNTIL_CLOSE) {
+        outbuf.resize(old);
+        upstream_eof = true;
+        return true;
+    }
+    if (len <= 0) {
+        outbuf.resize(old);
+        if (len == 0 || !would_block()) {
+            close();
+            return false;
+        }
+        return progress;
+    }
+    outbuf.resize(old + len);
+    if (framing == BODY_CHUNKED) {
+        long used = chunked.feed(outbuf.data() + old, len);
+        if (used == -1) {
+            close(); // the head is out already, all we can do is stop
+            return false;
+        }
+        if (used < len) {
+            outbuf.resize(old + used);
+            reusable = false;
+        }
+        len = used;
+    }
+    body_recv += len;
+    if (capturing)
+        capture.append(outbuf, old, len);
+    account_buffers();
+    return true;
+}
+
+/**
+ * @brief Cache hit (or a follower of someone else's fetch): whatever is left of the head
+ * and as much of the body as the socket takes go out in one sendmsg, so a fragment that
+ * fits the socket buffer is a single syscall and the head shares its first segment.
+ * A large body goes out with MSG_ZEROCOPY, straight from the shared entry; its head is
+ * sent just ahead with MSG_MORE, since outbuf is ours to reuse and can't be pinned.
+ */
+bool Connection::send_hit() {
+    size_t head_left = outbuf.size() - outoff;
+    size_t have = inflight ? inflight->available() : hit->body.size();
+    if (head_left == 0 && hit_off >= have) {
+        if (hit_off >= hit->body.size()) {
+            finish_exchange();
+            return st != CLOSED;
+        }
+        // the leader's next chunk wakes us through state->followers; a failed fetch can't be finished
+        if (inflight->status() == InflightFetch::FAILED)
+            close();
+        return false;
+    }
+    size_t body_left = have - hit_off;
+    bool zero_copy = use_zerocopy(body_left);
+    size_t allowed = egress_allowance(zero_copy && head_left > 0 ? head_left : head_left + body_left);
+    if (allowed == 0)
+        return false;
+    struct iovec iov[2];
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    if (head_left > 0) {
+        iov[msg.msg_iovlen].iov_base = &outbuf[outoff];
+        iov[msg.msg_iovlen++].iov_len = min(head_left, allowed);
+    }
+    if (allowed > head_left) {
+        iov[msg.msg_iovlen].iov_base = const_cast<char *>(hit->body.data() + hit_off);
+        iov[msg.msg_iovlen++].iov_len = allowed - head_left;
+    }
+    int flags = MSG_NOSIGNAL;
+    if (zero_copy)
+        flags |= head_left > 0 ? MSG_MORE : MSG_ZEROCOPY;
+    ssize_t len = sendmsg(fd, &msg, flags);
+    if (len == -1 && errno == ENOBUFS && (flags & MSG_ZEROCOPY)) {
+        // out of pinned page allowance (optmem_max), copy this one
+        flags &= ~MSG_ZEROCOPY;
+        len = sendmsg(fd, &msg, flags);
+    }
+    sent_to_client(allowed, len);
+    if (len == -1) {
+        if (!would_block())
+            close();
+        return false;
+    }
+    if (flags & MSG_ZEROCOPY) {
+        // the kernel numbers every MSG_ZEROCOPY send; hold the body until it says it's done
+        if (zerocopy_sends.empty() || zerocopy_sends.back().second != hit)
+            zerocopy_sends.push_back(std::make_pair(zerocopy_next, hit));
+        zerocopy_sends.back().first = zerocopy_next++;
+        state->stats->zerocopy_sends.add(1);
+    }
+    size_t from_head = min((size_t)len, head_left);
+    outoff += from_head;
+    hit_off += len - from_head;
+    return true;
+}
+
+// Whether a body this long goes out with MSG_ZEROCOPY, turning it on for the socket on first use.
+bool Connection::use_zerocopy(size_t body_left) {
+    if (!SEND_ZEROCOPY || zerocopy == ZEROCOPY_OFF || body_left < (size_t)ZEROCOPY_MIN_BYTES)
+        return false;
+    if (zerocopy == ZEROCOPY_UNTRIED) {
+        int one = 1;
+        zerocopy = setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0 ? ZEROCOPY_ON : ZEROCOPY_OFF;
+    }
+    return zerocopy == ZEROCOPY_ON;
+}
+
+/**
+ * @brief Read MSG_ZEROCOPY completions off the error queue and let go of the bodies they
+ * cover. A completion the kernel had to copy for anyway (loopback, a device without
+ * scatter-gather) turns zero copy off for this connection, pinning would only cost.
+ */
+void Connection::reap_zerocopy() {
+    while (true) {
+        char control[128];
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(fd, &msg, MSG_ERRQUEUE) == -1)
+            return;
+        for (struct cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+            if (!(cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) &&
+                !(cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR))
+                continue;
+            struct sock_extended_err err;
+            memcpy(&err, CMSG_DATA(cm), sizeof(err));
+            if (err.ee_errno != 0 || err.ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+                continue;
+            if (err.ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                zerocopy = ZEROCOPY_OFF;
+                state->stats->zerocopy_copied.add(1);
+            }
+            // sends [ee_info, ee_data] are done, in order, the counter wraps
+            while (!zerocopy_sends.empty() && (int32_t)(err.ee_data - zerocopy_sends.front().first) >= 0)
+                zerocopy_sends.pop_front();
+        }
+    }
+}
+
+void Connection::cork(bool on) {
+    int value = on;
+    if (setsockopt(fd, IPPROTO_TCP, TCP_CORK, &value, sizeof(value)) == 0)
+        corked = on;
+}
+
+/**
+ * @brief Zero-copy relay: origin socket -> pipe -> browser socket, never through user space.
+ * body_recv counts bytes taken from the origin exactly like the copy path, and the exchange
+ * only finishes once the pipe is drained, so timing and byte counts match it too. The pipe
+ * is topped up while the browser drains it, to at most args->conn_buffer.
+ */
+bool Connection::splice_body() {
+    bool progress = false;
+    if (pipe_bytes > 0) {
+        size_t allowed = egress_allowance(pipe_bytes);
+        ssize_t len = allowed ? splice(pipefd[0], nullptr, fd, nullptr, allowed, SPLICE_F_MOVE | SPLICE_F_NONBLOCK)
+                              : -1;
+        if (allowed) {
+            sent_to_client(allowed, len);
+            if (len == -1 && !would_block()) {
+                close();
+                return false;
+            }
+        }
+        if (len > 0) {
+            pipe_bytes -= len;
+            progress = true;
+            if (corked)
+                cork(false); // the head is out with the body's first bytes
+        }
+    }
+    if (body_done()) {
+        if (pipe_bytes > 0)
+            return progress;
+        finish_exchange();
+        return st != CLOSED;
+    }
+    size_t limit = min((size_t)PIPE_SIZE, args->conn_buffer);
+    if (pipe_bytes >= limit)
+        return progress;
+    size_t want = limit - pipe_bytes;
+    if (framing == BODY_LENGTH)
+        want = min(want, body_len - body_recv);
+    want = buffer_room(want);
+    if (want == 0)
+        return progress;
+    ssize_t len = splice(up->fd, nullptr, pipefd[1], nullptr, want, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (len == -1 && (errno == EINVAL || errno == ENOSYS)) {
+        // this pair of fds can't be spliced, carry on through the copy path once the pipe is out
+        if (pipe_bytes > 0)
+            return progress;
+        splicing = false;
+        return true;
+    }
+    if (len == 0 && framing == BODY_UNTIL_CLOSE) {
+        upstream_eof = true;
+        return true;
+    }
+    if (len <= 0) {
+        if (len == 0 || !would_block()) {
+            close();
+            return false;
+        }
+        return progress;
+    }
+    pipe_bytes += len;
+    body_recv += len;
+    account_buffers();
+    return true;
+}
+
+bool Connection::body_done() const {
+    switch (framing) {
+    case BODY_LENGTH:
+        return body_recv >= body_len;
+    case BODY_CHUNKED:
+        return chunked.done();
+    case BODY_UNTIL_CLOSE:
+        return upstream_eof;
+    case BODY_INVALID:
+        break;
+    }
+    return true;
+}
+
+/**
+ * @brief How much may be read from the origin now: want, or less (0 when the worker's
+ * buffer budget is spent; the budget wakes us when there is room).
+ */
+size_t Connection::buffer_room(size_t want) {
+    return state->buffers ? state->buffers->admit(this, want) : want;
+}
+
+// Tell the buffer budget what this connection holds now.
+void Connection::account_buffers() {
+    if (!state->buffers || st == CLOSED)
+        return;
+    size_t held = response.size() + chunked_body.size() + (outbuf.size() - outoff) + pipe_bytes + capture.size();
+    state->buffers->adjust((long)held - (long)buffered);
+    buffered = held;
+}
+
+/**
+ * @brief How much of want may go to the browser now: all of it without an egress budget,
+ * 0 when it is not this client's turn (the scheduler wakes us when it is).
+ */
+size_t Connection::egress_allowance(size_t want) {
+    return state->egress ? state->egress->grant(&egress, want) : want;
+}
+
+// A write of up to allowed bytes to the browser returned len.
+void Connection::sent_to_client(size_t allowed, ssize_t len) {
+    size_t took = len > 0 ? len : 0;
+    if (state->egress && took < allowed)
+        state->egress->refund(&egress, allowed - took);
+    if (took == 0)
+        return;
+    state->stats->bytes_relayed.add(len);
+    if (!answered) {
+        answered = true;
+        state->stats->phases[PHASE_FIRST_BYTE].record(header_done, steady_clock::now());
+    }
+    if (kind != FRAGMENT)
+        return;
+    size_t before = client_sent;
+    client_sent += len;
+    if (client_sent / TCPINFO_SAMPLE_BYTES != before / TCPINFO_SAMPLE_BYTES)
+        rate.sample_client(fd);
+}
+
+bool Connection::open_pipe() {
+    if (pipefd[0] != -1)
+        return true;
+    if (pipe2(pipefd, O_NONBLOCK) == -1) {
+        perror("Error creating relay pipe");
+        pipefd[0] = pipefd[1] = -1;
+        return false;
+    }
+    return true;
+}
+
+void Connection::finish_exchange() {
+    if (corked)
+        cork(false); // nothing more is coming, let the tail go
+    auto end = steady_clock::now();
+    state->stats->phases[PHASE_LAST_BYTE].record(header_done, end);
+    if (kind == FRAGMENT) {
+        auto duration = duration_cast<nanoseconds>(end - start).count() / 1000000000.0;
+
+        rate.sample_client(fd);
+        if (up)
+            rate.sample_upstream(up->fd);
+        // the kernel's estimate if it has one, the stopwatch if not
+        double tput = rate.estimate();
+        if (tput == 0 || (hit && !rate.bandwidth_limited()))
+            tput = body_recv / 125. / duration;
+        hit_sample = hit_sample || (args->hit_sample == HIT_SAMPLE_MEASURE && rate.bandwidth_limited());
+        BitrateTracker &tracker = find_tracker();
+        // the leader's browser got it as the origin sent it, like a relay
+        if (!hit || leading || hit_sample)
+            tracker.update(tput, bitrate);
+        else
+            tracker.delivered(bitrate);
+        if (capturing)
+            args->fragments->insert(fragment_key, response.substr(0, header_len), std::move(capture));
+        if (state->prefetch && (hit || status_code(response) == 200))
+            prefetch_next();
+
+        if (!hit)
+            state->origins->delivered(server_ip, body_recv / 125. / duration);
+        args->log->write(client_ip, seg, server_ip, duration, tput, tracker.get_tput(), bitrate);
+        state->stats->chunk(bitrate);
+    }
+    // reads stop at the end of the body (or reusable is off), so the connection is positioned at the next response
+    release_upstream(reusable);
+    if (client_keep_alive) {
+        reset_exchange();
+    } else {
+        close();
+    }
+}
+
+void Connection::reset_exchange() {
+    end_collapse();
+    kind = OTHER;
+    retried = false;
+    reusable = false;
+    request.clear();
+    upstream_request.clear();
+    manifest_request.clear();
+    cached.reset();
+    nolist_header.clear();
+    nolist_body.clear();
+    upstream_sent = 0;
+    response.clear();
+    header_len = 0;
+    outbuf.clear();
+    outoff = 0;
+    framing = BODY_LENGTH;
+    body_len = 0;
+    body_recv = 0;
+    chunked.reset();
+    string().swap(chunked_body);
+    upstream_eof = false;
+    splicing = false;
+    fragment_key.clear();
+    hit.reset();
+    hit_off = 0;
+    hit_sample = false;
+    capturing = false;
+    string().swap(capture);
+    seg = std::make_pair(0, 0);
+    bitrate = 0;
+    // the next request's header time starts at its first byte, not while the browser is idle
+    began = steady_clock::now();
+    idle = parser.buffer().empty();
+    st = READ_REQUEST;
+}
+
+void Connection::release_upstream(bool reusable) {
+    if (up) {
+        state->pool->release(up, reusable);
+        up = nullptr;
+    }
+}
+
+/**
+ * @brief A pooled connection died before answering; the origin probably timed it out
+ * while idle. Try once more on a new connection before giving up on the request.
+ */
+bool Connection::retry_fresh() {
+    bool was_reused = up && up->requests > 0;
+    if (!was_reused || retried)
+        return failover();
+    release_upstream(false);
+    retried = true;
+    up = state->pool->acquire(server_ip, &upstream_handler, true);
+    st = CONNECT;
+    return true;
+}
+
+/**
+ * @brief Note that server_ip failed this request and, if the request can go elsewhere,
+ * say where. "" once the browser has seen part of an answer, for anything but GET and
+ * HEAD, or after ORIGIN_MAX_ATTEMPTS origins.
+ */
+string Connection::next_origin() {
+    state->origins->failed(server_ip);
+    release_upstream(false);
+    tried.push_back(server_ip);
+    if (answered || (parser.method != "GET" && parser.method != "HEAD") || tried.size() >= (size_t)ORIGIN_MAX_ATTEMPTS)
+        return "";
+    return state->origins->pick(primary_ip, tried);
+}
+
+/**
+ * @brief The origin let this request down before answering: send it to the next one, or
+ * give up with a 502 if there is none.
+ */
+bool Connection::failover() {
+    string next = next_origin();
+    if (next.empty()) {
+        fail();
+        return false;
+    }
+    move_to(next);
+    return st != CLOSED;
+}
+
+void Connection::move_to(const string &origin) {
+    end_collapse(); // the key has the origin in it
+    server_ip = origin;
+    retried = false;
+    response.clear();
+    header_len = 0;
+    state->stats->failovers.add(1);
+    route_request();
+}
+
+/**
+ * @brief Tell the browser the origin let us down (best effort), then drop the connection.
+ */
+void Connection::fail() {
+    if (st != RELAY_BODY) {
+        send(fd, BAD_GATEWAY, sizeof(BAD_GATEWAY) - 1, MSG_NOSIGNAL);
+    }
+    state->stats->failed.add(1);
+    close();
+}
+
+void Connection::close() {
+    if (st == CLOSED)
+        return;
+    release_upstream(false);
+    if (st == RESOLVE)
+        state->resolver->cancel(VIDEO_HOST, &resolve_handler);
+    end_collapse();
+    if (disk_read) {
+        disk_read->waiter = nullptr;
+        disk_read.reset();
+    }
+    if (pending) {
+        // leave the prefetch in its slot, a retry of this request can still have it
+        pending->waiter = nullptr;
+        pending = nullptr;
+    }
+    if (pipefd[0] != -1) {
+        ::close(pipefd[0]);
+        ::close(pipefd[1]);
+    }
+    if (state->egress)
+        state->egress->leave(&egress);
+    if (!zerocopy_sends.empty()) {
+        reap_zerocopy();
+        // the socket outlives our fd until the kernel has sent what it holds, so do the bodies
+        auto now = steady_clock::now();
+        auto &held = state->zerocopy_held;
+        while (!held.empty() && held.front().first <= now)
+            held.pop_front();
+        for (auto &z : zerocopy_sends)
+            held.push_back(std::make_pair(now + std::chrono::milliseconds(ZEROCOPY_LINGER_MS), z.second));
+        zerocopy_sends.clear();
+    }
+    if (state->buffers) {
+        state->buffers->cancel(this);
+        state->buffers->adjust(-(long)buffered);
+        buffered = 0;
+    }
+    socket_close(fd);
+    st = CLOSED;
+    state->stats->connections.add(-1);
+    loop->retire(this);
+}
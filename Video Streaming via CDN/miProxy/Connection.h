@@ -0,0 +1,212 @@
+#ifndef _CONNECTION_H_
+#define _CONNECTION_H_
+
+#include "BufferBudget.h"
+#include "Collapser.h"
+#include "EgressScheduler.h"
+#include "EventLoop.h"
+#include "FragmentCache.h"
+#include "Http.h"
+#include "ManifestCache.h"
+#include "Prefetcher.h"
+#include "TcpInfo.h"
+#include "Proxy.h"
+#include "Resolver.h"
+#include "UpstreamPool.h"
+#include <chrono>
+#include <deque>
+#include <stdint.h>
+#include <string>
+#include <utility>
+
+using std::deque;
+using std::pair;
+using std::string;
+
+/**
+ * One browser connection, driven by the event loop as a state machine:
+ *   READ_REQUEST -> [RESOLVE] -> CONNECT -> SEND_REQUEST -> READ_RESPONSE -> RELAY_BODY
+ * A fragment whose prefetch is still running waits for it in WAIT_PREFETCH instead of
+ * going to CONNECT; if the prefetch fails, it carries on to CONNECT from there.
+ * Likewise a fragment someone else is fetching right now (args->collapser) waits in
+ * FOLLOW for that fetch's head and is then sent along as the body comes in. The request
+ * leading a fetch reads its head and hands the body to an InflightReader, then is sent it
+ * the same way.
+ * A fragment the disk cache has waits in WAIT_DISK while a reader thread reads it back.
+ * Fragments and manifests are answered from the shared caches when they can; filling it goes round CONNECT..READ_RESPONSE
+ * twice: once for the full manifest (parsed, not forwarded) and once for the _nolist one.
+ * Response bodies are relayed as they arrive, whichever way their end is found:
+ * Content-Length, chunked (forwarded as it came, followed by a ChunkedDecoder) or the
+ * origin closing (the browser's connection then closes too, it has no other way to tell).
+ * Nothing in here blocks, so a slow origin only stalls its own client.
+ * Reads from the origin stay within a per-connection buffer (args->conn_buffer) and the
+ * worker's BufferBudget, so a slow browser holds back only its own origin.
+ * A cache hit's head and body leave in one sendmsg (a large body with MSG_ZEROCOPY, straight
+ * from the shared entry), and a spliced body's first bytes join its head under TCP_CORK, so
+ * the browser's first segment is never a lone head.
+ * With an egress budget, every write to the browser asks the worker's EgressScheduler
+ * first and the connection waits for its client's turn when it has none.
+ * The origin is whichever the worker's OriginSet ranks best for the nameserver's answer. A
+ * GET or HEAD that the origin fails before the browser has seen a byte of the answer
+ * (no connection, a connect timeout, a dead socket, a 5xx for a fragment or manifest) is
+ * sent again to the next origin, up to ORIGIN_MAX_ATTEMPTS origins.
+ * Keep-alive browsers go back to READ_REQUEST after each response; pipelined requests
+ * wait in the parser's buffer and are answered one after another, in order.
+ */
+class Connection : public EventHandler {
+  public:
+    Connection(int fd, string client_ip, uint32_t client_addr, EventLoop *loop, args_t *args, state_t *state);
+    void handle_event(uint32_t events) override;
+
+  private:
+    enum State {
+        READ_REQUEST,
+        RESOLVE,
+        WAIT_DISK,
+        WAIT_PREFETCH,
+        FOLLOW,
+        CONNECT,
+        SEND_REQUEST,
+        READ_RESPONSE,
+        RELAY_BODY,
+        CLOSED
+    };
+    enum Kind { MANIFEST_LIST, MANIFEST_NOLIST, FRAGMENT, OTHER };
+    enum ZeroCopy { ZEROCOPY_UNTRIED, ZEROCOPY_ON, ZEROCOPY_OFF };
+
+    struct UpstreamHandler : public EventHandler {
+        Connection *conn;
+        void handle_event(uint32_t events) override { conn->handle_upstream_event(events); }
+    };
+    struct ResolveHandler : public ResolveWaiter {
+        Connection *conn;
+        void resolved(const string &name, const DNSAnswer &answer) override {
+            conn->resolved(answer);
+            conn->advance();
+        }
+    };
+
+    int fd;
+    UpstreamConn *up;
+    string client_ip;
+    uint32_t client_addr;  // host order, the session table's key
+    string server_ip;      // origin of the current attempt
+    string primary_ip;     // the nameserver's answer for this request
+    vector<string> tried;  // origins that failed this request
+    EventLoop *loop;
+    args_t *args;
+    state_t *state;
+    UpstreamHandler upstream_handler;
+    ResolveHandler resolve_handler;
+
+    State st;
+    Kind kind;
+    bool retried;  // already retried this exchange on a fresh connection
+    bool reusable; // origin response allows the connection back into the pool
+
+    HttpParser parser;       // browser side, may hold pipelined requests
+    bool client_keep_alive;  // the current request lets us keep the browser connection
+    string request;          // client request (header and body), as received
+    RequestRewriter rewrite; // request as the origin gets it, sent straight from request
+    string upstream_request; // a request of our own for the origin (manifests), sent instead when set
+    size_t upstream_sent;
+    string response;    // origin response header (and the manifest body for MANIFEST_LIST)
+    size_t header_len;  // length of the origin response header, 0 until it is complete
+    string outbuf;      // bytes waiting to go to the client
+    size_t outoff;
+    BodyFraming framing;    // how the origin response's body ends
+    size_t body_len;        // its Content-Length, for BODY_LENGTH
+    size_t body_recv;       // body bytes read from the origin so far, as they came
+    ChunkedDecoder chunked; // for BODY_CHUNKED
+    string chunked_body;    // decoded manifest body, for BODY_CHUNKED
+    bool upstream_eof;      // the origin closed, which ends a BODY_UNTIL_CLOSE body
+    bool splicing;      // relaying the rest of the body with splice()
+    int pipefd[2];      // splice pipe, opened on first use and kept for the connection
+    size_t pipe_bytes;  // bytes sitting in the pipe, not yet at the client
+    bool corked;        // TCP_CORK holds the head back for the first spliced bytes
+    size_t buffered;    // bytes held, as last told to state->buffers
+
+    string manifest_key;     // origin + path
+    string manifest_request; // rewritten request for the full manifest
+    shared_ptr<const ManifestEntry> cached;
+    vector<int> ladder;      // bitrates, once known
+    string nolist_header;    // _nolist response, once fetched
+    string nolist_body;
+
+    string fragment_key;                    // origin + rewritten request line
+    shared_ptr<const CachedFragment> hit;   // fragment being sent from the cache
+    size_t hit_off;
+    bool hit_sample;                        // the send time of this hit goes to the tracker
+    ZeroCopy zerocopy;                      // whether hits may go out with MSG_ZEROCOPY
+    uint32_t zerocopy_next;                 // the kernel's number for our next MSG_ZEROCOPY send
+    // bodies the kernel may still be reading, with the number of the last send from each
+    deque<pair<uint32_t, shared_ptr<const CachedFragment>>> zerocopy_sends;
+    bool capturing;                         // keep a copy of the body for the cache
+    string capture;
+    shared_ptr<DiskRead> disk_read;         // the disk cache reading the fragment back for us
+    Prefetch *pending;                      // this session's prefetch of the fragment asked for
+    shared_ptr<InflightFetch> inflight;     // the fetch of it this request leads or follows
+    bool leading;
+
+    EgressFlow egress;     // this connection's turn at the egress budget, when there is one
+    TcpRateEstimator rate; // kernel's view of this fragment's delivery
+    size_t client_sent;    // fragment bytes written to the browser so far
+
+    pair<int, int> seg;
+    int bitrate;
+    std::chrono::steady_clock::time_point start;
+
+    // phase timestamps for state->stats, see Stats.h
+    std::chrono::steady_clock::time_point began;       // accepted, or the request's first byte came in
+    std::chrono::steady_clock::time_point header_done; // request header complete
+    std::chrono::steady_clock::time_point waiting;     // RESOLVE or CONNECT entered
+    bool idle;                                         // keep-alive, no byte of the next request yet
+    bool answered;                                     // a response byte went out for this request
+
+    void handle_upstream_event(uint32_t events);
+    void advance();
+    bool read_request();
+    void start_exchange();
+    void resolved(const DNSAnswer &answer);
+    bool choose_origin();
+    void route_request();
+    BitrateTracker &find_tracker();
+    void fetch_fragment();
+    bool await_disk();
+    bool await_prefetch();
+    bool follow();
+    void end_collapse();
+    void prefetch_next();
+    bool connect_upstream();
+    bool send_request();
+    bool read_response();
+    bool body_done() const;
+    bool relay_body();
+    bool send_hit();
+    bool use_zerocopy(size_t body_left);
+    void reap_zerocopy();
+    void cork(bool on);
+    bool splice_body();
+    bool open_pipe();
+    size_t buffer_room(size_t want);
+    void account_buffers();
+    size_t egress_allowance(size_t want);
+    void sent_to_client(size_t allowed, ssize_t len);
+    void start_manifest(const string &header);
+    string nolist_request();
+    void finish_manifest_fetch();
+    void serve_manifest();
+    void serve_response(const string &head, const string &body);
+    void serve_fragment();
+    void finish_exchange();
+    void reset_exchange();
+    void release_upstream(bool reusable);
+    bool retry_fresh();
+    string next_origin();
+    bool failover();
+    void move_to(const string &origin);
+    void fail();
+    void close();
+};
+
+#endif
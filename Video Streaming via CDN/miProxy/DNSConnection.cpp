@@ -1,23 +1,40 @@
-
 #include "DNSConnection.h"
 
 using std::string;
 
 NoDNS::NoDNS(string ip) : web_sever_ip(ip) {}
 
-string NoDNS::resolve(string query) { return web_sever_ip; }
+bool NoDNS::fixed(string *ip) {
+    *ip = web_sever_ip;
+    return true;
+}
+
+DNS::DNS(string ip, uint16_t port) : x(0), dns_ip(ip), dns_port(port) {}
+
+bool DNS::fixed(string *ip) { return false; }
 
-DNS::DNS(string ip, uint16_t port) : dns_ip(ip), dns_port(port) {}
+uint16_t DNS::next_id() { return (uint16_t)x++; }
 
-string DNS::resolve(string query) {
-    int dnsfd = make_sock(dns_ip.c_str(), dns_port);
-    socket_raii s(dnsfd);
+static void put_frame(string &out, const string &frame) {
+    uint32_t len = htonl(frame.length());
+    out.append((const char *)&len, sizeof(len));
+    out.append(frame);
+}
 
+// Length of the frame starting at off, -1 if its prefix isn't all there yet.
+static int frame_length(const string &buf, size_t off) {
+    uint32_t len;
+    if (buf.size() < off + sizeof(len))
+        return -1;
+    memcpy(&len, buf.data() + off, sizeof(len));
+    return ntohl(len);
+}
+
+string DNS::encode_query(const string &name, uint16_t id) {
     // send header and question
     DNSHeader header;
     DNSQuestion question;
-    header.ID = x;
-    x++;
+    header.ID = id;
     header.QR = 0;
     header.OPCODE = 0;
     header.AA = 0;
@@ -31,37 +48,40 @@ string DNS::resolve(string query) {
     header.NSCOUNT = 0;
     header.ARCOUNT = 0;
 
-    strcpy(question.QNAME, query.c_str());
+    strncpy(question.QNAME, name.c_str(), sizeof(question.QNAME) - 1);
     question.QTYPE = 1;
     question.QCLASS = 1;
 
-    string header_string = DNSHeader::encode(header);
-    string question_string = DNSQuestion::encode(question);
-
-    int header_len = htonl(header_string.length());
-    int question_len = htonl(question_string.length());
+    string out;
+    put_frame(out, DNSHeader::encode(header));
+    put_frame(out, DNSQuestion::encode(question));
+    return out;
+}
 
-    char buf[BUF_SIZE];
+size_t DNS::response_length(const string &buf) {
+    int header_len = frame_length(buf, 0);
+    if (header_len < 0)
+        return 0;
+    size_t record_at = sizeof(uint32_t) + header_len;
+    int record_len = frame_length(buf, record_at);
+    if (record_len < 0 || buf.size() < record_at + sizeof(uint32_t) + record_len)
+        return 0;
+    return record_at + sizeof(uint32_t) + record_len;
+}
 
-    socket_send(dnsfd, &header_len, sizeof(header_len));
-    socket_send(dnsfd, header_string.c_str(), header_string.length());
-    socket_send(dnsfd, &question_len, sizeof(question_len));
-    socket_send(dnsfd, question_string.c_str(), question_string.length());
+// recv header and record
+DNSAnswer DNS::decode_response(const string &buf, uint16_t *id) {
+    int header_len = frame_length(buf, 0);
+    DNSHeader header = DNSHeader::decode(buf.substr(sizeof(uint32_t), header_len));
+    size_t record_at = sizeof(uint32_t) + header_len;
+    int record_len = frame_length(buf, record_at);
+    DNSRecord record = DNSRecord::decode(buf.substr(record_at + sizeof(uint32_t), record_len));
 
-    // recv header and record
-    memset(buf, 0, BUF_SIZE);
-    int len;
-    socket_recv_all(dnsfd, &len, sizeof(len));
-    int header_len_recv = ntohl(len);
-    socket_recv_all(dnsfd, buf, header_len_recv);
-    string header_string_recv(buf, header_len_recv);
-    DNSHeader header_recv = DNSHeader::decode(header_string_recv);
-    memset(buf, 0, BUF_SIZE);
-    socket_recv_all(dnsfd, &len, sizeof(len));
-    int record_len_recv = ntohl(len);
-    socket_recv_all(dnsfd, buf, record_len_recv);
-    string record_string_recv(buf, record_len_recv);
-    DNSRecord record_recv = DNSRecord::decode(record_string_recv);
-    assert(header_recv.RCODE != 3);
-    return string(record_recv.RDATA, record_recv.RDATA + record_recv.RDLENGTH);
-}
\ No newline at end of file
+    *id = header.ID;
+    DNSAnswer answer;
+    answer.rcode = header.RCODE;
+    answer.ttl = record.TTL;
+    if (header.RCODE == 0)
+        answer.ip = string(record.RDATA, record.RDATA + std::min((int)record.RDLENGTH, (int)sizeof(record.RDATA)));
+    return answer;
+}
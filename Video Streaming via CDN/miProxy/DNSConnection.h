@@ -5,14 +5,22 @@
 #include "DNSQuestion.h"
 #include "DNSRecord.h"
 #include "Socket.h"
-#include <assert.h>
+#include <atomic>
 #include <string>
 
 using std::string;
 
+// What the nameserver said about a name. rcode is -1 when it said nothing in time.
+struct DNSAnswer {
+  int rcode;
+  string ip;
+  int ttl; // seconds
+};
+
 class DNSConnection {
 public:
-  virtual string resolve(string query) = 0;
+  // The answer when no query is needed (--nodns). false means ask the nameserver.
+  virtual bool fixed(string *ip) = 0;
   virtual ~DNSConnection() {}
 };
 
@@ -22,17 +30,28 @@ private:
 
 public:
   NoDNS(string ip);
-  string resolve(string query) override;
+  bool fixed(string *ip) override;
 };
 
+/**
+ * The nameserver's wire format: a length-prefixed header then a length-prefixed question,
+ * answered the same way with a record in place of the question. It takes one query per
+ * TCP connection. The sockets themselves are the Resolver's business.
+ */
 class DNS : public DNSConnection {
 private:
+  std::atomic<int> x; // query ids, shared by the workers
+
+public:
   string dns_ip;
   uint16_t dns_port;
-  int x;
 
-public:
   DNS(string ip, uint16_t port);
-  string resolve(string query) override;
+  bool fixed(string *ip) override;
+  uint16_t next_id();
+  static string encode_query(const string &name, uint16_t id);
+  // Length of the whole response once buf holds it, 0 while it is incomplete.
+  static size_t response_length(const string &buf);
+  static DNSAnswer decode_response(const string &buf, uint16_t *id);
 };
-#endif
\ No newline at end of file
+#endif
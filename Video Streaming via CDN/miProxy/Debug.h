@@ -0,0 +1,13 @@
+#ifndef _DEBUG_H_
+#define _DEBUG_H_
+
+// Development traces. Only a debug build (make debug, which defines MIPROXY_DEBUG) prints
+// them; otherwise the whole statement, operands included, compiles to nothing.
+#ifdef MIPROXY_DEBUG
+#include <iostream>
+#define DEBUG_OUT(x) (std::cout << x)
+#else
+#define DEBUG_OUT(x) ((void)0)
+#endif
+
+#endif
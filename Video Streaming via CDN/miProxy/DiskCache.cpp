@@ -0,0 +1,480 @@
+#include "DiskCache.h"
+#include "params.h"
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+using std::lock_guard;
+using std::mutex;
+using std::unique_lock;
+
+static const uint32_t INDEX_MAGIC = 0x4d504958; // "XIPM"
+static const uint32_t INDEX_VERSION = 1;
+static const uint32_t RECORD_MAGIC = 0x4d505852; // "RXPM"
+static const size_t META_BYTES = 4096;           // the index file's first page
+
+// At the start of the index file. Only the writer moves the head.
+struct DiskCache::Meta {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t segments;
+    uint64_t segment_bytes;
+    uint64_t slots;
+    uint64_t head_segment; // where the next record goes
+    uint64_t head_offset;
+};
+
+// hash 0 is an empty slot, so no key hashes to 0
+struct DiskCache::Slot {
+    uint64_t hash;
+    uint32_t segment;
+    uint32_t offset;
+    uint32_t length;
+    uint32_t pad;
+};
+
+// In front of every record, then the key, the header and the body, padded to 8 bytes.
+struct RecordHead {
+    uint32_t magic;
+    uint32_t key_len;
+    uint32_t header_len;
+    uint32_t body_len;
+    uint64_t hash;
+};
+
+// FNV-1a, so the same key hashes the same after a rebuild or on another libstdc++
+static uint64_t key_hash(const string &key) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (unsigned char c : key) {
+        h ^= c;
+        h *= 0x100000001b3ULL;
+    }
+    return h ? h : 1;
+}
+
+static size_t next_pow2(size_t n) {
+    size_t p = 1;
+    while (p < n)
+        p <<= 1;
+    return p;
+}
+
+static size_t record_size(size_t key, size_t header, size_t body) {
+    return (sizeof(RecordHead) + key + header + body + 7) & ~(size_t)7;
+}
+
+static bool full_pread(int fd, char *buf, size_t len, off_t off) {
+    while (len > 0) {
+        ssize_t n = pread(fd, buf, len, off);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        buf += n;
+        len -= n;
+        off += n;
+    }
+    return true;
+}
+
+static bool full_pwrite(int fd, const char *buf, size_t len, off_t off) {
+    while (len > 0) {
+        ssize_t n = pwrite(fd, buf, len, off);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        buf += n;
+        len -= n;
+        off += n;
+    }
+    return true;
+}
+
+DiskCache::DiskCache()
+    : segment_bytes(0), map(nullptr), map_len(0), meta(nullptr), slots(nullptr), slot_mask(0), entries(0),
+      queued_bytes(0), stopping(false), hits(0), misses(0), writes(0), dropped(0), recycled(0) {}
+
+DiskCache *DiskCache::open(const string &dir, size_t max_bytes) {
+    size_t segment_bytes = (size_t)DISK_SEGMENT_MB << 20;
+    size_t nsegments = std::max((size_t)2, max_bytes / segment_bytes);
+    size_t nslots = next_pow2(nsegments * segment_bytes / DISK_INDEX_BYTES_PER_SLOT);
+    if (mkdir(dir.c_str(), 0755) == -1 && errno != EEXIST) {
+        perror(("Error creating disk cache " + dir).c_str());
+        return nullptr;
+    }
+
+    DiskCache *cache = new DiskCache();
+    cache->segment_bytes = segment_bytes;
+    for (size_t i = 0; i < nsegments; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "/segment.%03zu", i);
+        int fd = ::open((dir + name).c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        // reserve the blocks up front so the log never fragments or runs out of space half way
+        if (fd == -1 || (posix_fallocate(fd, 0, segment_bytes) != 0 && ftruncate(fd, segment_bytes) == -1)) {
+            perror(("Error opening disk cache segment in " + dir).c_str());
+            if (fd != -1)
+                close(fd);
+            delete cache;
+            return nullptr;
+        }
+        cache->segments.push_back(fd);
+    }
+    cache->recycles.assign(nsegments, 0);
+    cache->segment_hashes.resize(nsegments);
+
+    int fd = ::open((dir + "/index").c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    cache->map_len = META_BYTES + nslots * sizeof(Slot);
+    if (fd == -1 || ftruncate(fd, cache->map_len) == -1) {
+        perror(("Error opening disk cache index in " + dir).c_str());
+        if (fd != -1)
+            close(fd);
+        delete cache;
+        return nullptr;
+    }
+    cache->map = mmap(nullptr, cache->map_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (cache->map == MAP_FAILED) {
+        perror("Error mapping disk cache index");
+        cache->map = nullptr;
+        delete cache;
+        return nullptr;
+    }
+    cache->meta = (Meta *)cache->map;
+    cache->slots = (Slot *)((char *)cache->map + META_BYTES);
+    cache->slot_mask = nslots - 1;
+
+    Meta *m = cache->meta;
+    if (m->magic != INDEX_MAGIC || m->version != INDEX_VERSION || m->segments != nsegments ||
+        m->segment_bytes != segment_bytes || m->slots != nslots || m->head_segment >= nsegments ||
+        m->head_offset > segment_bytes) {
+        // new, or laid out for another size: start empty
+        memset(cache->map, 0, cache->map_len);
+        m->magic = INDEX_MAGIC;
+        m->version = INDEX_VERSION;
+        m->segments = nsegments;
+        m->segment_bytes = segment_bytes;
+        m->slots = nslots;
+    }
+    for (size_t i = 0; i < nslots; i++) {
+        const Slot &slot = cache->slots[i];
+        if (slot.hash == 0)
+            continue;
+        cache->entries++;
+        if (slot.segment < nsegments)
+            cache->segment_hashes[slot.segment].push_back(slot.hash);
+    }
+
+    cache->writer = std::thread([cache]() { cache->write_loop(); });
+    for (int i = 0; i < DISK_READERS; i++)
+        cache->readers.push_back(std::thread([cache]() { cache->read_loop(); }));
+    return cache;
+}
+
+DiskCache::~DiskCache() {
+    if (writer.joinable()) {
+        {
+            lock_guard<mutex> guard(queue_lock);
+            lock_guard<mutex> read_guard(read_lock);
+            stopping = true;
+        }
+        wake.notify_one();
+        read_wake.notify_all();
+        writer.join();
+        for (std::thread &reader : readers)
+            reader.join();
+    }
+    if (map) {
+        msync(map, map_len, MS_SYNC);
+        munmap(map, map_len);
+    }
+    for (int fd : segments)
+        close(fd);
+}
+
+// Linear probing from the hash's home slot. Called with lock held.
+DiskCache::Slot *DiskCache::find(uint64_t hash) {
+    for (size_t i = hash & slot_mask;; i = (i + 1) & slot_mask) {
+        if (slots[i].hash == hash)
+            return &slots[i];
+        if (slots[i].hash == 0)
+            return nullptr;
+    }
+}
+
+// Called with lock held. false if the index is too full to take it.
+bool DiskCache::put(uint64_t hash, uint32_t segment, uint32_t offset, uint32_t length) {
+    size_t i = hash & slot_mask;
+    while (slots[i].hash != 0 && slots[i].hash != hash)
+        i = (i + 1) & slot_mask;
+    if (slots[i].hash == 0) {
+        // keep probes short, past 3/4 the odd miss is cheaper than the long runs
+        if ((entries + 1) * 4 > (slot_mask + 1) * 3)
+            return false;
+        entries++;
+    }
+    slots[i] = Slot{hash, segment, offset, length, 0};
+    return true;
+}
+
+/**
+ * @brief Empty slot i without leaving a hole in anyone's probe sequence: later entries of
+ * the run move back into the gap unless their home slot lies cyclically in (i, j].
+ * Called with lock held.
+ */
+void DiskCache::erase_at(size_t i) {
+    size_t j = i;
+    while (true) {
+        j = (j + 1) & slot_mask;
+        if (slots[j].hash == 0)
+            break;
+        size_t home = slots[j].hash & slot_mask;
+        bool stays = i <= j ? (i < home && home <= j) : (i < home || home <= j);
+        if (!stays) {
+            slots[i] = slots[j];
+            i = j;
+        }
+    }
+    slots[i].hash = 0;
+    entries--;
+}
+
+/**
+ * @brief The log is about to write over segment: drop its slots, DISK_FORGET_BATCH per
+ * hold of the lock, so lookups on the workers never wait for a whole segment's worth.
+ * What is still in the index meanwhile still points at intact records. Writer only,
+ * called without lock.
+ */
+void DiskCache::forget_segment(uint32_t segment) {
+    vector<uint64_t> hashes;
+    hashes.swap(segment_hashes[segment]);
+    for (size_t i = 0; i < hashes.size();) {
+        lock_guard<mutex> guard(lock);
+        for (size_t end = std::min(hashes.size(), i + DISK_FORGET_BATCH); i < end; i++) {
+            Slot *slot = find(hashes[i]);
+            // a key written again since lives in another segment now
+            if (slot && slot->segment == segment)
+                erase_at(slot - slots);
+        }
+    }
+    lock_guard<mutex> guard(lock);
+    recycles[segment]++;
+    recycled++;
+}
+
+shared_ptr<const CachedFragment> DiskCache::load(const string &key) {
+    uint64_t hash = key_hash(key);
+    uint32_t segment, offset, length;
+    uint64_t generation;
+    {
+        lock_guard<mutex> guard(lock);
+        Slot *slot = find(hash);
+        if (!slot) {
+            misses++;
+            return nullptr;
+        }
+        segment = slot->segment;
+        offset = slot->offset;
+        length = slot->length;
+        generation = recycles[segment];
+    }
+
+    // usually the page cache's, a fragment that has to come off the platter is still quicker
+    // than the origin
+    RecordHead head;
+    auto value = std::make_shared<CachedFragment>();
+    bool ok = full_pread(segments[segment], (char *)&head, sizeof(head), offset) && head.magic == RECORD_MAGIC &&
+              head.hash == hash && head.key_len == key.size() &&
+              record_size(head.key_len, head.header_len, head.body_len) == length;
+    if (ok) {
+        string stored_key(head.key_len, '\0');
+        value->header.resize(head.header_len);
+        value->body.resize(head.body_len);
+        struct iovec iov[3] = {{&stored_key[0], head.key_len},
+                               {&value->header[0], head.header_len},
+                               {&value->body[0], head.body_len}};
+        size_t want = (size_t)head.key_len + head.header_len + head.body_len;
+        ssize_t n;
+        do {
+            n = preadv(segments[segment], iov, 3, offset + sizeof(head));
+        } while (n == -1 && errno == EINTR);
+        ok = n == (ssize_t)want && stored_key == key;
+    }
+    {
+        // the writer may have come round and reused the segment while we read it
+        lock_guard<mutex> guard(lock);
+        ok = ok && recycles[segment] == generation;
+    }
+    if (!ok) {
+        misses++;
+        return nullptr;
+    }
+    hits++;
+    return value;
+}
+
+void DiskCache::read(shared_ptr<DiskRead> read, DiskReads *reply) {
+    {
+        lock_guard<mutex> guard(read_lock);
+        reads.push_back(std::make_pair(read, reply));
+    }
+    read_wake.notify_one();
+}
+
+// Reads still queued when the cache closes are never answered, the proxy is going away.
+void DiskCache::read_loop() {
+    while (true) {
+        pair<shared_ptr<DiskRead>, DiskReads *> next;
+        {
+            unique_lock<mutex> guard(read_lock);
+            read_wake.wait(guard, [this]() { return stopping || !reads.empty(); });
+            if (stopping)
+                return;
+            next = std::move(reads.front());
+            reads.pop_front();
+        }
+        next.first->value = load(next.first->key);
+        next.second->complete(next.first);
+    }
+}
+
+bool DiskCache::contains(const string &key) {
+    lock_guard<mutex> guard(lock);
+    return find(key_hash(key)) != nullptr;
+}
+
+void DiskCache::store(const string &key, shared_ptr<const CachedFragment> value) {
+    size_t size = record_size(key.size(), value->header.size(), value->body.size());
+    {
+        lock_guard<mutex> guard(queue_lock);
+        if (queued_bytes + size > (size_t)DISK_QUEUE_MB << 20) {
+            dropped++;
+            return;
+        }
+        queued_bytes += size;
+        queue.push_back(std::make_pair(key, value));
+    }
+    wake.notify_one();
+}
+
+void DiskCache::write_loop() {
+    while (true) {
+        pair<string, shared_ptr<const CachedFragment>> next;
+        {
+            unique_lock<mutex> guard(queue_lock);
+            wake.wait(guard, [this]() { return stopping || !queue.empty(); });
+            if (queue.empty())
+                return;
+            next = std::move(queue.front());
+            queue.pop_front();
+        }
+        append(next.first, *next.second);
+        lock_guard<mutex> guard(queue_lock);
+        queued_bytes -= record_size(next.first.size(), next.second->header.size(), next.second->body.size());
+    }
+}
+
+/**
+ * @brief Write one record at the head of the log, moving on to the next segment (and
+ * forgetting what it held) if it doesn't fit in this one. The slot is only filled once
+ * the record is written, so a reader never finds a half-written one; the head is moved
+ * first, so a crash in between leaves a gap rather than a slot pointing at garbage.
+ */
+void DiskCache::append(const string &key, const CachedFragment &value) {
+    size_t size = record_size(key.size(), value.header.size(), value.body.size());
+    if (size > segment_bytes) {
+        dropped++;
+        return;
+    }
+    uint64_t hash = key_hash(key);
+    uint32_t segment, offset;
+    uint64_t generation;
+    // only the writer moves the head, it can look without the lock
+    if (meta->head_offset + size > segment_bytes) {
+        uint32_t next = (meta->head_segment + 1) % segments.size();
+        forget_segment(next);
+        lock_guard<mutex> guard(lock);
+        meta->head_segment = next;
+        meta->head_offset = 0;
+    }
+    {
+        lock_guard<mutex> guard(lock);
+        segment = meta->head_segment;
+        offset = meta->head_offset;
+        meta->head_offset += size;
+        generation = recycles[segment];
+    }
+
+    RecordHead head = {RECORD_MAGIC, (uint32_t)key.size(), (uint32_t)value.header.size(),
+                       (uint32_t)value.body.size(), hash};
+    string record;
+    record.reserve(size);
+    record.append((const char *)&head, sizeof(head));
+    record.append(key);
+    record.append(value.header);
+    record.append(value.body);
+    record.resize(size, '\0');
+    if (!full_pwrite(segments[segment], record.data(), record.size(), offset)) {
+        perror("Error writing disk cache");
+        dropped++;
+        return;
+    }
+
+    lock_guard<mutex> guard(lock);
+    if (recycles[segment] != generation || !put(hash, segment, offset, size)) {
+        dropped++;
+        return;
+    }
+    segment_hashes[segment].push_back(hash);
+    writes++;
+}
+
+DiskCacheStats DiskCache::stats() {
+    DiskCacheStats s;
+    s.hits = hits;
+    s.misses = misses;
+    s.writes = writes;
+    s.dropped = dropped;
+    s.recycled = recycled;
+    lock_guard<mutex> guard(lock);
+    s.entries = entries;
+    return s;
+}
+
+DiskReads::DiskReads(EventLoop *loop, DiskCache *disk) : disk(disk), ready(loop, [this]() { deliver(); }) {}
+
+shared_ptr<DiskRead> DiskReads::start(const string &key, EventHandler *waiter) {
+    auto read = std::make_shared<DiskRead>();
+    read->key = key;
+    read->done = false;
+    read->waiter = waiter;
+    disk->read(read, this);
+    return read;
+}
+
+void DiskReads::complete(shared_ptr<DiskRead> read) {
+    {
+        lock_guard<mutex> guard(lock);
+        completed.push_back(read);
+    }
+    ready.notify();
+}
+
+void DiskReads::deliver() {
+    vector<shared_ptr<DiskRead>> done;
+    {
+        lock_guard<mutex> guard(lock);
+        done.swap(completed);
+    }
+    for (auto &read : done) {
+        read->done = true;
+        if (read->waiter)
+            read->waiter->handle_event(0);
+    }
+}
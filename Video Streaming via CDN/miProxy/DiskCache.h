@@ -0,0 +1,129 @@
+#ifndef _DISK_CACHE_H_
+#define _DISK_CACHE_H_
+
+#include "EventLoop.h"
+#include "FragmentCache.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using std::deque;
+using std::pair;
+using std::shared_ptr;
+using std::string;
+using std::vector;
+
+struct DiskCacheStats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t writes;
+    uint64_t dropped;  // not written: queue full, too big for a segment or index full
+    uint64_t recycled; // segments reused, dropping everything in them
+    size_t entries;
+};
+
+/**
+ * Second tier under the fragment cache, in a directory that outlives the proxy:
+ *   segment.NNN  DISK_SEGMENT_MB each, preallocated, written as a log
+ *   index        open addressing hash -> (segment, offset, length), mmap'd, so it is
+ *                on disk as soon as the kernel writes it back
+ * Fragments are appended at the head of the log by a writer thread, one segment after
+ * another; when the log comes round to the oldest segment, everything in it is forgotten
+ * and it is written over (FIFO over segments, the disk only ever sees sequential writes).
+ * Reads are queued for DISK_READERS reader threads and come back through the asking
+ * worker's DiskReads, so a worker never waits on the disk. A reader checks the record
+ * against the key, so an index slot left stale by a crash or a recycle is just a miss.
+ */
+class DiskReads;
+
+// A fragment a worker asked the disk cache for.
+struct DiskRead {
+    string key;
+    shared_ptr<const CachedFragment> value; // once done; nullptr if the disk didn't have it after all
+    bool done;
+    EventHandler *waiter; // woken once done, nullptr once it has gone
+};
+
+class DiskCache {
+  public:
+    // nullptr (after saying why) if dir can't be used.
+    static DiskCache *open(const string &dir, size_t max_bytes);
+    ~DiskCache();
+    // Queued for a reader, the answer goes back through reply.
+    void read(shared_ptr<DiskRead> read, DiskReads *reply);
+    bool contains(const string &key);
+    // Queued for the writer; dropped if too much is queued already.
+    void store(const string &key, shared_ptr<const CachedFragment> value);
+    DiskCacheStats stats();
+
+  private:
+    struct Meta;
+    struct Slot;
+
+    vector<int> segments; // fds
+    size_t segment_bytes;
+    void *map;
+    size_t map_len;
+    Meta *meta;
+    Slot *slots;
+    size_t slot_mask;
+    size_t entries;
+    vector<uint64_t> recycles; // per segment, bumped each time it is written over
+    std::mutex lock;           // the index, meta and recycles
+    // per segment, the hashes of the slots put there; the writer's alone, so a recycle
+    // doesn't have to search the whole index
+    vector<vector<uint64_t>> segment_hashes;
+
+    std::mutex queue_lock;
+    std::condition_variable wake;
+    deque<pair<string, shared_ptr<const CachedFragment>>> queue;
+    size_t queued_bytes;
+    bool stopping; // set with both queue_lock and read_lock held
+    std::thread writer;
+
+    std::mutex read_lock;
+    std::condition_variable read_wake;
+    deque<pair<shared_ptr<DiskRead>, DiskReads *>> reads;
+    vector<std::thread> readers;
+
+    std::atomic<uint64_t> hits, misses, writes, dropped, recycled;
+
+    DiskCache();
+    void write_loop();
+    void read_loop();
+    shared_ptr<const CachedFragment> load(const string &key);
+    void append(const string &key, const CachedFragment &value);
+    Slot *find(uint64_t hash);
+    bool put(uint64_t hash, uint32_t segment, uint32_t offset, uint32_t length);
+    void erase_at(size_t i);
+    void forget_segment(uint32_t segment);
+};
+
+/**
+ * One worker's end of the disk cache's reads. A reader thread hands a finished read back
+ * through the worker's eventfd, and its waiter is woken on the worker's own thread.
+ */
+class DiskReads {
+  public:
+    DiskReads(EventLoop *loop, DiskCache *disk);
+    shared_ptr<DiskRead> start(const string &key, EventHandler *waiter);
+
+  private:
+    friend class DiskCache;
+    DiskCache *disk;
+    Notifier ready;
+    std::mutex lock; // completed
+    vector<shared_ptr<DiskRead>> completed;
+
+    void complete(shared_ptr<DiskRead> read); // on a reader thread
+    void deliver();
+};
+
+#endif
@@ -0,0 +1,117 @@
+#include "EgressScheduler.h"
+#include "params.h"
+#include <algorithm>
+
+using std::max;
+using std::min;
+
+EgressScheduler::EgressScheduler(EventLoop *loop, int max_kbps, EgressWeight weighting)
+    : tokens_per_tick((size_t)max_kbps * 1000 / 8 * EGRESS_TICK_MS / 1000),
+      burst(max((size_t)EGRESS_QUANTUM, tokens_per_tick * 2)), tokens(burst), weighting(weighting),
+      refiller(loop, EGRESS_TICK_MS, [this]() { refill(); }) {}
+
+EgressScheduler::~EgressScheduler() {
+    for (auto &c : clients)
+        delete c.second;
+    for (EgressClient *c : gone)
+        delete c;
+}
+
+void EgressScheduler::join(EgressFlow *flow, const string &client, EventHandler *handler) {
+    EgressClient *&c = clients[client];
+    if (!c) {
+        c = new EgressClient;
+        c->ip = client;
+        c->flows = 0;
+        c->quantum = EGRESS_QUANTUM;
+        c->deficit = 0;
+        c->active = false;
+    }
+    c->flows++;
+    flow->client = c;
+    flow->handler = handler;
+    flow->queued = false;
+}
+
+void EgressScheduler::leave(EgressFlow *flow) {
+    EgressClient *c = flow->client;
+    if (!c)
+        return;
+    if (flow->queued) {
+        c->waiting.erase(std::find(c->waiting.begin(), c->waiting.end(), flow));
+        flow->queued = false;
+    }
+    flow->client = nullptr;
+    if (--c->flows > 0)
+        return;
+    deactivate(c);
+    clients.erase(c->ip);
+    // refill() may be going through this client's connections right now
+    gone.push_back(c);
+}
+
+void EgressScheduler::set_bitrate(EgressFlow *flow, int kbps) {
+    if (weighting == EGRESS_BITRATE && flow->client)
+        flow->client->quantum = max((size_t)EGRESS_MIN_QUANTUM, (size_t)EGRESS_QUANTUM * kbps / EGRESS_WEIGHT_KBPS);
+}
+
+size_t EgressScheduler::grant(EgressFlow *flow, size_t want) {
+    EgressClient *c = flow->client;
+    size_t granted = min(want, min(c->deficit, tokens));
+    if (granted == 0) {
+        if (!flow->queued) {
+            flow->queued = true;
+            c->waiting.push_back(flow);
+        }
+        if (!c->active) {
+            c->active = true;
+            active.push_back(c);
+        }
+        return 0;
+    }
+    c->deficit -= granted;
+    tokens -= granted;
+    return granted;
+}
+
+void EgressScheduler::refund(EgressFlow *flow, size_t unused) {
+    if (flow->client)
+        flow->client->deficit += unused;
+    tokens = min(burst, tokens + unused);
+}
+
+void EgressScheduler::deactivate(EgressClient *client) {
+    if (!client->active)
+        return;
+    client->active = false;
+    active.erase(std::find(active.begin(), active.end(), client));
+}
+
+void EgressScheduler::refill() {
+    for (EgressClient *c : gone)
+        delete c;
+    gone.clear();
+    tokens = min(burst, tokens + tokens_per_tick);
+    while (tokens > 0 && !active.empty()) {
+        // one round; clients queued while it runs wait for the next
+        size_t round = active.size();
+        for (size_t i = 0; i < round && tokens > 0 && !active.empty(); i++) {
+            EgressClient *c = active.front();
+            active.pop_front();
+            c->active = false;
+            c->deficit += c->quantum;
+            // edge triggered: a connection that stopped short of EAGAIN won't be woken otherwise
+            deque<EgressFlow *> waiting;
+            waiting.swap(c->waiting);
+            for (EgressFlow *f : waiting)
+                f->queued = false;
+            for (EgressFlow *f : waiting) {
+                // one closed by an earlier one's wake-up has left, but is not freed yet
+                if (f->client == c)
+                    f->handler->handle_event(EPOLLOUT);
+            }
+            if (!c->active)
+                c->deficit = min(c->deficit, c->quantum);
+        }
+    }
+}
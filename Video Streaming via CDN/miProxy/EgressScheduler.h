@@ -0,0 +1,82 @@
+#ifndef _EGRESS_SCHEDULER_H_
+#define _EGRESS_SCHEDULER_H_
+
+#include "EventLoop.h"
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using std::deque;
+using std::string;
+using std::unordered_map;
+using std::vector;
+
+class EgressScheduler;
+
+// How the egress is split between clients.
+enum EgressWeight {
+    EGRESS_EQUAL,   // the same share for everyone
+    EGRESS_BITRATE, // in proportion to the bitrate each client streams now
+};
+
+// A client's standing with the scheduler, shared by all of its connections.
+struct EgressClient {
+    string ip;
+    int flows;         // connections of this client
+    size_t quantum;    // bytes added to deficit each round
+    size_t deficit;    // bytes it may still send this round
+    bool active;       // in the round robin
+    deque<class EgressFlow *> waiting;
+};
+
+// One connection's bytes to its browser.
+class EgressFlow {
+  public:
+    EgressFlow() : client(nullptr), handler(nullptr), queued(false) {}
+
+  private:
+    friend class EgressScheduler;
+    EgressClient *client;
+    EventHandler *handler; // woken with EPOLLOUT once it may send again
+    bool queued;
+};
+
+/**
+ * Per-worker deficit round robin over clients, sharing the worker's part of the egress
+ * budget (--egress-kbps) between them. Every tick the bucket is refilled and the clients
+ * waiting to send are gone round: each gets its quantum added to its deficit and its
+ * waiting connections woken, until the tokens run out or nobody wants more. A client
+ * that no longer waits keeps at most one quantum of deficit, so a socket that was full
+ * for a while can't come back with a burst. A client with many connections gets no more
+ * than one with a single connection.
+ */
+class EgressScheduler {
+  public:
+    EgressScheduler(EventLoop *loop, int max_kbps, EgressWeight weighting);
+    ~EgressScheduler();
+    void join(EgressFlow *flow, const string &client, EventHandler *handler);
+    void leave(EgressFlow *flow);
+    // The client is streaming this bitrate now; only matters for EGRESS_BITRATE.
+    void set_bitrate(EgressFlow *flow, int kbps);
+    // How much of want the flow may send now. 0 queues it: its handler is woken with
+    // EPOLLOUT on the client's next turn.
+    size_t grant(EgressFlow *flow, size_t want);
+    // Granted bytes the socket did not take.
+    void refund(EgressFlow *flow, size_t unused);
+
+  private:
+    size_t tokens_per_tick;
+    size_t burst;
+    size_t tokens;
+    EgressWeight weighting;
+    unordered_map<string, EgressClient *> clients;
+    deque<EgressClient *> active; // round robin order
+    vector<EgressClient *> gone;  // left, freed on the next refill
+    PeriodicTimer refiller;
+
+    void refill();
+    void deactivate(EgressClient *client);
+};
+
+#endif
@@ -0,0 +1,119 @@
+#include "EventLoop.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+static const int MAX_EVENTS = 256;
+
+EventLoop::EventLoop() {
+    epfd = epoll_create1(0);
+    if (epfd == -1) {
+        perror("Error creating epoll instance");
+        exit(-1);
+    }
+}
+
+EventLoop::~EventLoop() { close(epfd); }
+
+int EventLoop::add(int fd, uint32_t events, EventHandler *handler) {
+    struct epoll_event ev;
+    ev.events = events;
+    ev.data.ptr = handler;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+        perror("Error adding fd to epoll");
+        return -1;
+    }
+    return 0;
+}
+
+int EventLoop::modify(int fd, uint32_t events, EventHandler *handler) {
+    struct epoll_event ev;
+    ev.events = events;
+    ev.data.ptr = handler;
+    if (epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &ev) == -1) {
+        perror("Error modifying fd in epoll");
+        return -1;
+    }
+    return 0;
+}
+
+int EventLoop::remove(int fd) {
+    // closing the fd removes it too, but only once every dup of it is closed
+    if (epoll_ctl(epfd, EPOLL_CTL_DEL, fd, nullptr) == -1) {
+        perror("Error removing fd from epoll");
+        return -1;
+    }
+    return 0;
+}
+
+void EventLoop::retire(EventHandler *handler) { retired.push_back(handler); }
+
+void EventLoop::run() {
+    struct epoll_event events[MAX_EVENTS];
+    while (true) {
+        int n = epoll_wait(epfd, events, MAX_EVENTS, -1);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            perror("Error in epoll_wait");
+            return;
+        }
+        for (int i = 0; i < n; i++) {
+            static_cast<EventHandler *>(events[i].data.ptr)->handle_event(events[i].events);
+        }
+        for (EventHandler *h : retired) {
+            delete h;
+        }
+        retired.clear();
+    }
+}
+
+PeriodicTimer::PeriodicTimer(EventLoop *loop, int interval_ms, function<void()> callback) : callback(callback) {
+    fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    if (fd == -1) {
+        perror("Error creating timer");
+        exit(-1);
+    }
+    struct itimerspec spec;
+    spec.it_interval.tv_sec = interval_ms / 1000;
+    spec.it_interval.tv_nsec = (interval_ms % 1000) * 1000000L;
+    spec.it_value = spec.it_interval;
+    timerfd_settime(fd, 0, &spec, nullptr);
+    loop->add(fd, EPOLLIN | EPOLLET, this);
+}
+
+PeriodicTimer::~PeriodicTimer() { close(fd); }
+
+void PeriodicTimer::handle_event(uint32_t events) {
+    uint64_t expirations;
+    while (read(fd, &expirations, sizeof(expirations)) == sizeof(expirations)) {
+    }
+    callback();
+}
+
+Notifier::Notifier(EventLoop *loop, function<void()> callback) : callback(callback) {
+    fd = eventfd(0, EFD_NONBLOCK);
+    if (fd == -1) {
+        perror("Error creating eventfd");
+        exit(-1);
+    }
+    loop->add(fd, EPOLLIN | EPOLLET, this);
+}
+
+Notifier::~Notifier() { close(fd); }
+
+void Notifier::notify() {
+    uint64_t one = 1;
+    if (write(fd, &one, sizeof(one)) != sizeof(one))
+        perror("Error notifying event loop");
+}
+
+void Notifier::handle_event(uint32_t events) {
+    uint64_t count;
+    while (read(fd, &count, sizeof(count)) == sizeof(count)) {
+    }
+    callback();
+}
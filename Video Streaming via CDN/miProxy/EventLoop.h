@@ -0,0 +1,62 @@
+#ifndef _EVENT_LOOP_H_
+#define _EVENT_LOOP_H_
+
+#include <functional>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <vector>
+
+using std::function;
+using std::vector;
+
+// Anything registered with the loop. Events are edge-triggered, so a handler has to
+// drain its fd (read/write until EAGAIN) every time it is called.
+class EventHandler {
+  public:
+    virtual void handle_event(uint32_t events) = 0;
+    virtual ~EventHandler() {}
+};
+
+class EventLoop {
+  private:
+    int epfd;
+    // handlers closed during a batch; deleted once the batch is done so that
+    // events still queued for them don't touch freed memory
+    vector<EventHandler *> retired;
+
+  public:
+    EventLoop();
+    ~EventLoop();
+    int add(int fd, uint32_t events, EventHandler *handler);
+    int modify(int fd, uint32_t events, EventHandler *handler);
+    int remove(int fd);
+    void retire(EventHandler *handler);
+    void run();
+};
+
+// Calls back every interval_ms from inside the loop (timerfd backed).
+class PeriodicTimer : public EventHandler {
+  public:
+    PeriodicTimer(EventLoop *loop, int interval_ms, function<void()> callback);
+    ~PeriodicTimer();
+    void handle_event(uint32_t events) override;
+
+  private:
+    int fd;
+    function<void()> callback;
+};
+
+// Calls back from inside the loop once notify() has been called, from any thread (eventfd backed).
+class Notifier : public EventHandler {
+  public:
+    Notifier(EventLoop *loop, function<void()> callback);
+    ~Notifier();
+    void notify();
+    void handle_event(uint32_t events) override;
+
+  private:
+    int fd;
+    function<void()> callback;
+};
+
+#endif
@@ -0,0 +1,245 @@
+#include "FragmentCache.h"
+#include "DiskCache.h"
+#include "params.h"
+#include <algorithm>
+#include <iterator>
+
+using std::lock_guard;
+using std::mutex;
+
+// per entry bookkeeping on top of the key and the response itself
+static const size_t NODE_OVERHEAD = 128;
+
+static uint64_t mix(uint64_t h) {
+    // splitmix64 finaliser, spreads std::hash's output over all 64 bits
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebULL;
+    h ^= h >> 31;
+    return h;
+}
+
+static size_t next_pow2(size_t n) {
+    size_t p = 1;
+    while (p < n)
+        p <<= 1;
+    return p;
+}
+
+FrequencySketch::FrequencySketch(size_t width)
+    : table(next_pow2(width) / 16 + 1, 0), mask(next_pow2(width) - 1), additions(0),
+      sample_size(10 * next_pow2(width)) {}
+
+size_t FrequencySketch::index(uint64_t hash, int i) const {
+    // double hashing: h1 + i * h2 gives the 4 rows without 4 hash functions
+    uint64_t h2 = (hash >> 32) | 1;
+    return (size_t)((hash + i * h2) & mask);
+}
+
+int FrequencySketch::estimate(uint64_t hash) const {
+    int freq = 15;
+    for (int i = 0; i < 4; i++) {
+        size_t at = index(hash, i);
+        int count = (table[at / 16] >> ((at % 16) * 4)) & 0xf;
+        freq = count < freq ? count : freq;
+    }
+    return freq;
+}
+
+void FrequencySketch::increment(uint64_t hash) {
+    for (int i = 0; i < 4; i++) {
+        size_t at = index(hash, i);
+        uint64_t &word = table[at / 16];
+        int shift = (at % 16) * 4;
+        if (((word >> shift) & 0xf) != 0xf)
+            word += 1ULL << shift;
+    }
+    if (++additions >= sample_size)
+        age();
+}
+
+void FrequencySketch::age() {
+    for (uint64_t &word : table)
+        word = (word >> 1) & 0x7777777777777777ULL;
+    additions /= 2;
+}
+
+FragmentCache::Shard::Shard(size_t sketch_width)
+    : sketch(sketch_width), window_bytes(0), probation_bytes(0), protected_bytes(0) {}
+
+FragmentCache::FragmentCache(size_t max_bytes, size_t nshards, DiskCache *disk)
+    : disk(disk), hits(0), misses(0), evictions(0), rejections(0) {
+    size_t per_shard = max_bytes / nshards;
+    window_max = per_shard * FRAGMENT_CACHE_WINDOW_PERCENT / 100;
+    main_max = per_shard - window_max;
+    protected_max = main_max * FRAGMENT_CACHE_PROTECTED_PERCENT / 100;
+    // enough counters for every fragment that fits, and then some
+    size_t width = std::max((size_t)1024, per_shard / FRAGMENT_CACHE_SKETCH_BYTES);
+    for (size_t i = 0; i < nshards; i++)
+        shards.push_back(new Shard(width));
+}
+
+FragmentCache::Shard &FragmentCache::shard_for(uint64_t hash) {
+    // the low bits pick the sketch counters, the shard comes from the top
+    return *shards[(hash >> 48) % shards.size()];
+}
+
+shared_ptr<const CachedFragment> FragmentCache::lookup(const string &key, bool *seen_before, bool *on_disk) {
+    uint64_t hash = mix(std::hash<string>()(key));
+    Shard &shard = shard_for(hash);
+    {
+        lock_guard<mutex> guard(shard.lock);
+        *seen_before = shard.sketch.estimate(hash) > 0;
+        shard.sketch.increment(hash);
+        auto it = shard.index.find(key);
+        if (it != shard.index.end()) {
+            hits++;
+            on_hit(shard, it->second);
+            return it->second->value;
+        }
+        misses++;
+    }
+    // only the index, without the shard lock; the read itself is left to a reader thread
+    *on_disk = disk && disk->contains(key);
+    return nullptr;
+}
+
+bool FragmentCache::contains(const string &key) {
+    Shard &shard = shard_for(mix(std::hash<string>()(key)));
+    {
+        lock_guard<mutex> guard(shard.lock);
+        if (shard.index.find(key) != shard.index.end())
+            return true;
+    }
+    return disk && disk->contains(key);
+}
+
+bool FragmentCache::fits(size_t body_len) const { return body_len + NODE_OVERHEAD <= main_max; }
+
+void FragmentCache::insert(const string &key, const string &header, string body) {
+    auto value = std::make_shared<CachedFragment>();
+    value->header = header;
+    value->body.swap(body);
+    insert(key, value);
+}
+
+void FragmentCache::insert(const string &key, shared_ptr<const CachedFragment> value) {
+    insert_memory(key, value);
+    if (disk && !disk->contains(key))
+        disk->store(key, value);
+}
+
+void FragmentCache::insert_memory(const string &key, shared_ptr<const CachedFragment> value) {
+    uint64_t hash = mix(std::hash<string>()(key));
+    size_t size = key.size() + value->header.size() + value->body.size() + NODE_OVERHEAD;
+    if (size > main_max) {
+        rejections++;
+        return;
+    }
+
+    Shard &shard = shard_for(hash);
+    lock_guard<mutex> guard(shard.lock);
+    if (shard.index.find(key) != shard.index.end())
+        return; // another viewer's fetch got there first
+    shard.window.push_front(Node{key, hash, size, WINDOW, value});
+    shard.index[key] = shard.window.begin();
+    shard.window_bytes += size;
+    while (shard.window_bytes > window_max && !shard.window.empty()) {
+        node_ref candidate = std::prev(shard.window.end());
+        shard.window_bytes -= candidate->size;
+        admit(shard, candidate);
+    }
+}
+
+// Called with the shard lock held.
+void FragmentCache::on_hit(Shard &shard, node_ref node) {
+    switch (node->segment) {
+    case WINDOW:
+        shard.window.splice(shard.window.begin(), shard.window, node);
+        break;
+    case PROTECTED:
+        shard.protect.splice(shard.protect.begin(), shard.protect, node);
+        break;
+    case PROBATION:
+        // second hit in main, it has earned a protected slot
+        shard.probation_bytes -= node->size;
+        shard.protected_bytes += node->size;
+        node->segment = PROTECTED;
+        shard.protect.splice(shard.protect.begin(), shard.probation, node);
+        while (shard.protected_bytes > protected_max) {
+            node_ref demoted = std::prev(shard.protect.end());
+            shard.protected_bytes -= demoted->size;
+            shard.probation_bytes += demoted->size;
+            demoted->segment = PROBATION;
+            shard.probation.splice(shard.probation.begin(), shard.protect, demoted);
+        }
+        break;
+    }
+}
+
+/**
+ * @brief The window's LRU entry wants into main. Called with the shard lock held and the
+ * candidate still in the window list but no longer counted in window_bytes. It goes in if
+ * main has room, or if it is more popular than every entry that would have to leave to
+ * make room (probation's LRU end first, then protected's); otherwise it is dropped.
+ */
+void FragmentCache::admit(Shard &shard, node_ref candidate) {
+    size_t used = shard.probation_bytes + shard.protected_bytes;
+    if (used + candidate->size > main_max) {
+        int freq = shard.sketch.estimate(candidate->hash);
+        size_t freed = 0;
+        vector<node_ref> victims;
+        for (auto it = shard.probation.rbegin(); it != shard.probation.rend() && used - freed + candidate->size > main_max;
+             ++it) {
+            victims.push_back(std::prev(it.base()));
+            freed += it->size;
+        }
+        for (auto it = shard.protect.rbegin(); it != shard.protect.rend() && used - freed + candidate->size > main_max;
+             ++it) {
+            victims.push_back(std::prev(it.base()));
+            freed += it->size;
+        }
+        for (node_ref victim : victims) {
+            if (shard.sketch.estimate(victim->hash) >= freq) {
+                rejections++;
+                drop(shard, shard.window, candidate);
+                return;
+            }
+        }
+        for (node_ref victim : victims) {
+            evictions++;
+            if (victim->segment == PROBATION) {
+                shard.probation_bytes -= victim->size;
+                drop(shard, shard.probation, victim);
+            } else {
+                shard.protected_bytes -= victim->size;
+                drop(shard, shard.protect, victim);
+            }
+        }
+    }
+    candidate->segment = PROBATION;
+    shard.probation_bytes += candidate->size;
+    shard.probation.splice(shard.probation.begin(), shard.window, candidate);
+}
+
+void FragmentCache::drop(Shard &shard, list<Node> &from, node_ref node) {
+    shard.index.erase(node->key);
+    from.erase(node);
+}
+
+FragmentCacheStats FragmentCache::stats() {
+    FragmentCacheStats s;
+    s.hits = hits;
+    s.misses = misses;
+    s.evictions = evictions;
+    s.rejections = rejections;
+    s.bytes = 0;
+    s.entries = 0;
+    for (Shard *shard : shards) {
+        lock_guard<mutex> guard(shard->lock);
+        s.bytes += shard->window_bytes + shard->probation_bytes + shard->protected_bytes;
+        s.entries += shard->index.size();
+    }
+    return s;
+}
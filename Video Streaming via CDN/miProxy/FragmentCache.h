@@ -0,0 +1,123 @@
+#ifndef _FRAGMENT_CACHE_H_
+#define _FRAGMENT_CACHE_H_
+
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using std::list;
+using std::shared_ptr;
+using std::string;
+using std::unordered_map;
+using std::vector;
+
+class DiskCache;
+
+// A 200 response for one <bitrate>Seg<n>-Frag<m>, as the origin sent it.
+struct CachedFragment {
+    string header;
+    string body;
+};
+
+/**
+ * Count-min sketch of 4 bit counters, 16 to a word, read and bumped at 4 places per key.
+ * Once the number of increments reaches 10x the width every counter is halved, so old
+ * popularity fades and the counters never saturate for good.
+ */
+class FrequencySketch {
+  public:
+    FrequencySketch(size_t width);
+    int estimate(uint64_t hash) const;
+    void increment(uint64_t hash);
+
+  private:
+    vector<uint64_t> table;
+    size_t mask; // width - 1, width is a power of two
+    size_t additions;
+    size_t sample_size;
+
+    size_t index(uint64_t hash, int i) const;
+    void age();
+};
+
+struct FragmentCacheStats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;  // admitted entries pushed out to make room
+    uint64_t rejections; // window candidates the admission filter turned away
+    size_t bytes;
+    size_t entries;
+};
+
+/**
+ * Process-wide, byte-budgeted fragment cache keyed by origin + rewritten request line
+ * (path, bitrate, segment and fragment), shared by the workers. It is split into shards
+ * with a lock each, and every shard runs W-TinyLFU on its slice of the budget:
+ *   - new entries land in a small LRU window,
+ *   - what falls out of the window only gets into the main SLRU (probation + protected)
+ *     if the sketch has seen it more often than every entry it would push out,
+ * so a burst of one-hit wonders (a single viewer seeking around) can't flush the
+ * fragments everyone else is watching. Entries are immutable and handed out by reference,
+ * a hit is sent straight from the shared copy.
+ * With a DiskCache underneath, everything inserted is also written to disk. A memory miss
+ * that the disk has is read back by the caller (see DiskReads) and promoted, inserted
+ * again without writing it out twice.
+ */
+class FragmentCache {
+  public:
+    FragmentCache(size_t max_bytes, size_t shards, DiskCache *disk = nullptr);
+    // Counts the access either way. On a miss, seen_before says whether the key has been
+    // asked for recently, i.e. whether it is worth capturing the body to insert it, and
+    // on_disk whether the disk cache has it.
+    shared_ptr<const CachedFragment> lookup(const string &key, bool *seen_before, bool *on_disk);
+    void insert(const string &key, const string &header, string body);
+    void insert(const string &key, shared_ptr<const CachedFragment> value);
+    // Read back from the disk cache: into memory only, it is on disk already.
+    void promote(const string &key, shared_ptr<const CachedFragment> value) { insert_memory(key, value); }
+    // Whether it is cached (in memory or on disk), without counting as an access.
+    bool contains(const string &key);
+    // Whether a body this large could ever be admitted.
+    bool fits(size_t body_len) const;
+    FragmentCacheStats stats();
+
+  private:
+    enum Segment { WINDOW, PROBATION, PROTECTED };
+    struct Node {
+        string key;
+        uint64_t hash;
+        size_t size;
+        Segment segment;
+        shared_ptr<const CachedFragment> value;
+    };
+    typedef list<Node>::iterator node_ref;
+
+    // most recently used at the front of each list
+    struct Shard {
+        std::mutex lock;
+        FrequencySketch sketch;
+        list<Node> window, probation, protect;
+        unordered_map<string, node_ref> index;
+        size_t window_bytes, probation_bytes, protected_bytes;
+        Shard(size_t sketch_width);
+    };
+
+    vector<Shard *> shards;
+    DiskCache *disk; // nullptr when memory only
+    size_t window_max;    // per shard
+    size_t main_max;      // per shard, probation + protected
+    size_t protected_max; // per shard
+    std::atomic<uint64_t> hits, misses, evictions, rejections;
+
+    Shard &shard_for(uint64_t hash);
+    void insert_memory(const string &key, shared_ptr<const CachedFragment> value);
+    void on_hit(Shard &shard, node_ref node);
+    void admit(Shard &shard, node_ref candidate);
+    void drop(Shard &shard, list<Node> &from, node_ref node);
+};
+
+#endif
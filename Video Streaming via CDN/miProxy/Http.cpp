@@ -0,0 +1,657 @@
+#include "Http.h"
+#include <algorithm>
+#include <ctype.h>
+#include <errno.h>
+#include <limits>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+using std::pair;
+using std::string;
+using std::vector;
+
+int headerEnd(const char *buf, int len, int offset) {
+    if (offset < 3) {
+        offset = 3;
+    }
+    for (int i = offset; i < len; i++)
+        if (buf[i - 3] == '\r' && buf[i - 2] == '\n' && buf[i - 1] == '\r' && buf[i] == '\n')
+            return i + 1;
+    return -1;
+}
+string chunkname(pair<int, int> seg) {
+    char buf[32];
+    int len = snprintf(buf, sizeof(buf), "Seg%d-Frag%d", seg.first, seg.second);
+    return string(buf, len);
+}
+
+// TODO
+/**
+<?xml version="1.0" encoding="UTF-8"?>
+<manifest xmlns="http://ns.adobe.com/f4m/1.0">
+        <id>
+                10
+        </id>
+        <streamType>
+                recorded
+        </streamType>
+        <duration>
+                596.50133333333338
+        </duration>
+        <bootstrapInfo
+                 profile="named"
+                 id="bootstrap5948"
+        >
+                AAAMg2Fic3QAAAAAAAAAjwAAAAPoAAAAAAAJGgAAAAAAAAAAAAAAAAAAAQAAA0Fhc3J0AAAAAAAAAABmAAAAAQAAAAYAAAACAAAABgAAAAMAAAAGAAAABAAAAAYAAAAFAAAABgAAAAYAAAAGAAAABwAAAAYAAAAIAAAABgAAAAkAAAAGAAAACgAAAAYAAAALAAAABgAAAAwAAAAGAAAADQAAAAYAAAAOAAAABQAAAA8AAAAGAAAAEAAAAAYAAAARAAAABgAAABIAAAAGAAAAEwAAAAYAAAAUAAAABQAAABUAAAAGAAAAFgAAAAYAAAAXAAAABgAAABgAAAAGAAAAGQAAAAYAAAAaAAAABgAAABsAAAAGAAAAHAAAAAUAAAAdAAAABgAAAB4AAAAGAAAAHwAAAAUAAAAgAAAABgAAACEAAAAGAAAAIgAAAAUAAAAjAAAABgAAACQAAAAGAAAAJQAAAAYAAAAmAAAABgAAACcAAAAFAAAAKAAAAAYAAAApAAAABgAAACoAAAAGAAAAKwAAAAUAAAAsAAAABgAAAC0AAAAFAAAALgAAAAYAAAAvAAAABgAAADAAAAAFAAAAMQAAAAYAAAAyAAAABgAAADMAAAAGAAAANAAAAAYAAAA1AAAABgAAADYAAAAGAAAANwAAAAYAAAA4AAAABQAAADkAAAAGAAAAOgAAAAUAAAA7AAAABgAAADwAAAAGAAAAPQAAAAYAAAA+AAAABgAAAD8AAAAGAAAAQAAAAAYAAABBAAAABgAAAEIAAAAGAAAAQwAAAAYAAABEAAAABgAAAEUAAAAFAAAARgAAAAYAAABHAAAABgAAAEgAAAAGAAAASQAAAAUAAABKAAAABgAAAEsAAAAGAAAATAAAAAYAAABNAAAABQAAAE4AAAAGAAAATwAAAAYAAABQAAAABQAAAFEAAAAGAAAAUgAAAAYAAABTAAAABgAAAFQAAAAGAAAAVQAAAAYAAABWAAAABgAAAFcAAAAGAAAAWAAAAAYAAABZAAAABgAAAFoAAAAGAAAAWwAAAAYAAABcAAAABgAAAF0AAAAGAAAAXgAAAAYAAABfAAAABgAAAGAAAAAGAAAAYQAAAAYAAABiAAAABgAAAGMAAAAGAAAAZAAAAAUAAABlAAAABgAAAGYAAAAGAQAACRZhZnJ0AAAAAAAAA+gAAAAAkAAAAAEAAAAAAAAAAAAAA+gAAAAMAAAAAAAAKvgAAAdsAAAADQAAAAAAADJCAAAD6AAAAA8AAAAAAAA6EgAAA4QAAAAQAAAAAAAAPXUAAAPoAAAARQAAAAAAAQw6AAACvAAAAEYAAAAAAAEPGAAAA+gAAABHAAAAAAABEwAAAAOEAAAASAAAAAAAARZiAAAD6AAAAFAAAAAAAAE1ogAABqQAAABRAAAAAAABPCUAAAPoAAAAWQAAAAAAAVtlAAADIAAAAFoAAAAAAAFehQAAA+gAAABbAAAAAAABYm0AAAK8AAAAXAAAAAAAAWUIAAAD6AAAAHYAAAAAAAHKmAAABdwAAAB3AAAAAAAB0JUAAAPoAAAAeAAAAAAAAdR9AAADhAAAAHkAAAAAAAHYIgAAA+gAAAB7AAAAAAAB3/IAAAJYAAAAfAAAAAAAAeIpAAAD6AAAAJIAAAAAAAI4GQAAA4QAAACTAAAAAAACO74AAAPoAAAAlQAAAAAAAkOOAAACvAAAAJYAAAAAAAJGSgAAA+gAAACcAAAAAAACXboAAAOEAAAAnQAAAAAAAmFgAAAD6AAAAKEAAAAAAAJxAAAABwgAAACiAAAAAAACeCkAAAPoAAAAqQAAAAAAApOBAAACvAAAAKoAAAAAAAKWPQAAA+gAAACwAAAAAAACra0AAAJYAAAAsQAAAAAAAq/kAAAD6AAAALIAAAAAAAKzzAAABkAAAACzAAAAAAACui0AAAPoAAAAtAAAAAAAAr4VAAADIAAAALUAAAAAAALBFAAAA+gAAAC6AAAAAAAC1JwAAAOEAAAAuwAAAAAAAthBAAAD6AAAAL0AAAAAAALgEQAAA4QAAAC+AAAAAAAC45UAAAPoAAAAwAAAAAAAAutlAAADIAAAAMEAAAAAAALupgAAA+gAAADEAAAAAAAC+l4AAAXcAAAAxQAAAAAAAwBcAAAD6AAAAM8AAAAAAAMnbAAAArwAAADQAAAAAAADKkkAAAPoAAAA3QAAAAAAA10RAAACvAAAAN4AAAAAAANfrAAAA+gAAADgAAAAAAADZ3wAAAakAAAA4QAAAAAAA23+AAAD6AAAAOgAAAAAAAOJVgAAArwAAADpAAAAAAADi/EAAAPoAAAA8gAAAAAAA68ZAAACWAAAAPMAAAAAAAOxcQAAA+gAAAD7AAAAAAAD0LEAAAakAAAA/AAAAAAAA9dVAAAD6AAAAP0AAAAAAAPbPQAAA4QAAAD+AAAAAAAD3uIAAAPoAAAA/wAAAAAAA+LKAAACvAAAAQAAAAAAAAPlZQAAA+gAAAEBAAAAAAAD6U0AAAK8AAABAgAAAAAAA+voAAAD6AAAAQMAAAAAAAPv0AAABdwAAAEEAAAAAAAD9awAAAPoAAABBQAAAAAAA/mUAAACvAAAAQYAAAAAAAP8LgAAA+gAAAEHAAAAAAAEABYAAAakAAABCAAAAAAABAaZAAACvAAAAQkAAAAAAAQJNAAAA+gAAAEKAAAAAAAEDRwAAAK8AAABCwAAAAAABA+2AAAD6AAAARQAAAAAAAQy3gAABwgAAAEVAAAAAAAEOcUAAAPoAAABFwAAAAAABEF0AAADIAAAARgAAAAAAARElAAAA+gAAAEZAAAAAAAESHwAAAK8AAABGgAAAAAABEsWAAAD6AAAASQAAAAAAARyJgAAAyAAAAElAAAAAAAEdWgAAAPoAAABKQAAAAAABITmAAADhAAAASoAAAAAAASIjAAAA+gAAAFEAAAAAAAE7foAAAZAAAABRQAAAAAABPRcAAAD6AAAAU4AAAAAAAUXhAAAAlgAAAFPAAAAAAAFGf0AAAPoAAABUQAAAAAABSHNAAAF3AAAAVIAAAAAAAUnygAAA+gAAAFTAAAAAAAFK7IAAAOEAAABVAAAAAAABS8VAAAD6AAAAWMAAAAAAAVprQAAArwAAAFkAAAAAAAFbEgAAAPoAAABcwAAAAAABabgAAACvAAAAXQAAAAAAAWpnAAAA+gAAAF1AAAAAAAFrYQAAAZAAAABdgAAAAAABbPEAAAD6AAAAXcAAAAAAAW3rAAAArwAAAF4AAAAAAAFukYAAAPoAAABfQAAAAAABc2tAAADIAAAAX4AAAAAAAXQ7gAAA+gAAAGHAAAAAAAF9BYAAAZAAAABiAAAAAAABfpWAAACvAAAAYkAAAAAAAX9NAAAA+gAAAGMAAAAAAAGCOwAAAJYAAABjQAAAAAABgtEAAAD6AAAAY8AAAAAAAYTFAAABkAAAAGQAAAAAAAGGVQAAAPoAAABlAAAAAAABij0AAACvAAAAZUAAAAAAAYr0QAAA+gAAAGYAAAAAAAGN4kAAAK8AAABmQAAAAAABjokAAAD6AAAAaAAAAAAAAZVfAAAA4QAAAGhAAAAAAAGWQAAAAPoAAABpQAAAAAABmigAAAGpAAAAaYAAAAAAAZvZQAAA+gAAAGoAAAAAAAGdzUAAAJYAAABqQAAAAAABnmNAAAD6AAAAa0AAAAAAAaJLQAAA4QAAAGuAAAAAAAGjNIAAAPoAAABrwAAAAAABpCZAAAF3AAAAbAAAAAAAAaWlgAAA+gAAAGxAAAAAAAGmn4AAAOEAAABsgAAAAAABp4kAAAD6AAAAbMAAAAAAAaiDAAAAyAAAAG0AAAAAAAGpU0AAAJYAAABtQAAAAAABqfGAAAD6AAAAb0AAAAAAAbHBgAABkAAAAG+AAAAAAAGzUYAAAPoAAABygAAAAAABvwFAAAB9AAAAcsAAAAAAAb+GgAAA+gAAAHNAAAAAAAHBeoAAAZAAAABzgAAAAAABwwqAAAD6AAAAeEAAAAAAAdWYgAAAyAAAAHiAAAAAAAHWYIAAAPoAAAB5gAAAAAAB2kiAAACWAAAAecAAAAAAAdregAAA+gAAAHqAAAAAAAHdzIAAAMgAAAB6wAAAAAAB3p0AAAD6AAAAe4AAAAAAAeGLAAAA4QAAAHvAAAAAAAHibAAAAPoAAACRAAAAAAACNW4AAAHbAAAAkUAAAAAAAjdJAAAA+gAAAJUAAAAAAAJF7wAAAJYAAAAAAAAAAAAAAAAAAAAAAA=
+        </bootstrapInfo>
+        <media
+                 streamId="10"
+                 url="10"
+                 bitrate="10"
+                 bootstrapInfoId="bootstrap5948"
+        >
+                <metadata>
+                        AgAKb25NZXRhRGF0YQgAAAAAAAhkdXJhdGlvbgBAgqQCuwz4fgAFd2lkdGgAQIqwAAAAAAAABmhlaWdodABAfgAAAAAAAAAMdmlkZW9jb2RlY2lkAgAEYXZjMQAMYXVkaW9jb2RlY2lkAgAEbXA0YQAKYXZjcHJvZmlsZQBAU0AAAAAAAAAIYXZjbGV2ZWwAQEQAAAAAAAAADnZpZGVvZnJhbWVyYXRlAEA+AAAAAAAAAA9hdWRpb3NhbXBsZXJhdGUAQOdwAAAAAAAADWF1ZGlvY2hhbm5lbHMAQAAAAAAAAAAACXRyYWNraW5mbwoAAAACAwAGbGVuZ3RoAEGJmJzAAAAAAAl0aW1lc2NhbGUAQPX5AAAAAAAACGxhbmd1YWdlAgADdW5kAAAJAwAGbGVuZ3RoAEF7TkAAAAAAAAl0aW1lc2NhbGUAQOdwAAAAAAAACGxhbmd1YWdlAgADZW5nAAAJAAAJ
+                </metadata>
+        </media>
+        <media
+                 streamId="100"
+                 url="100"
+                 bitrate="100"
+                 bootstrapInfoId="bootstrap5948"
+        >
+                <metadata>
+                        AgAKb25NZXRhRGF0YQgAAAAAAAhkdXJhdGlvbgBAgqQCuwz4fgAFd2lkdGgAQIqwAAAAAAAABmhlaWdodABAfgAAAAAAAAAMdmlkZW9jb2RlY2lkAgAEYXZjMQAMYXVkaW9jb2RlY2lkAgAEbXA0YQAKYXZjcHJvZmlsZQBAU0AAAAAAAAAIYXZjbGV2ZWwAQEQAAAAAAAAADnZpZGVvZnJhbWVyYXRlAEA+AAAAAAAAAA9hdWRpb3NhbXBsZXJhdGUAQOdwAAAAAAAADWF1ZGlvY2hhbm5lbHMAQAAAAAAAAAAACXRyYWNraW5mbwoAAAACAwAGbGVuZ3RoAEGJmJzAAAAAAAl0aW1lc2NhbGUAQPX5AAAAAAAACGxhbmd1YWdlAgADdW5kAAAJAwAGbGVuZ3RoAEF7TkAAAAAAAAl0aW1lc2NhbGUAQOdwAAAAAAAACGxhbmd1YWdlAgADZW5nAAAJAAAJ
+                </metadata>
+        </media>
+        <media
+                 streamId="500"
+                 url="500"
+                 bitrate="500"
+                 bootstrapInfoId="bootstrap5948"
+        >
+                <metadata>
+                        AgAKb25NZXRhRGF0YQgAAAAAAAhkdXJhdGlvbgBAgqQCuwz4fgAFd2lkdGgAQIqwAAAAAAAABmhlaWdodABAfgAAAAAAAAAMdmlkZW9jb2RlY2lkAgAEYXZjMQAMYXVkaW9jb2RlY2lkAgAEbXA0YQAKYXZjcHJvZmlsZQBAU0AAAAAAAAAIYXZjbGV2ZWwAQEQAAAAAAAAADnZpZGVvZnJhbWVyYXRlAEA+AAAAAAAAAA9hdWRpb3NhbXBsZXJhdGUAQOdwAAAAAAAADWF1ZGlvY2hhbm5lbHMAQAAAAAAAAAAACXRyYWNraW5mbwoAAAACAwAGbGVuZ3RoAEGJmJzAAAAAAAl0aW1lc2NhbGUAQPX5AAAAAAAACGxhbmd1YWdlAgADdW5kAAAJAwAGbGVuZ3RoAEF7TkAAAAAAAAl0aW1lc2NhbGUAQOdwAAAAAAAACGxhbmd1YWdlAgADZW5nAAAJAAAJ
+                </metadata>
+        </media>
+        <media
+                 streamId="1000"
+                 url="1000"
+                 bitrate="1000"
+                 bootstrapInfoId="bootstrap5948"
+        >
+                <metadata>
+                        AgAKb25NZXRhRGF0YQgAAAAAAAhkdXJhdGlvbgBAgqQCuwz4fgAFd2lkdGgAQIqwAAAAAAAABmhlaWdodABAfgAAAAAAAAAMdmlkZW9jb2RlY2lkAgAEYXZjMQAMYXVkaW9jb2RlY2lkAgAEbXA0YQAKYXZjcHJvZmlsZQBAU0AAAAAAAAAIYXZjbGV2ZWwAQEQAAAAAAAAADnZpZGVvZnJhbWVyYXRlAEA+AAAAAAAAAA9hdWRpb3NhbXBsZXJhdGUAQOdwAAAAAAAADWF1ZGlvY2hhbm5lbHMAQAAAAAAAAAAACXRyYWNraW5mbwoAAAACAwAGbGVuZ3RoAEGJmJzAAAAAAAl0aW1lc2NhbGUAQPX5AAAAAAAACGxhbmd1YWdlAgADdW5kAAAJAwAGbGVuZ3RoAEF7TkAAAAAAAAl0aW1lc2NhbGUAQOdwAAAAAAAACGxhbmd1YWdlAgADZW5nAAAJAAAJ
+                </metadata>
+        </media>
+</manifest>
+
+*/
+// Every bitrate="<kbps>" in the manifest. The origin's bytes aren't trusted: a rung that
+// isn't a positive number fitting an int is skipped.
+vector<int> parse_manifest(const string &manifest) {
+    vector<int> brs;
+    size_t cur_loc = manifest.find("bitrate=\"");
+    while (cur_loc != string::npos) {
+        cur_loc += 9; // bitrate="
+        size_t endloc = manifest.find('"', cur_loc);
+        if (endloc == string::npos)
+            break;
+        const char *digits = manifest.c_str() + cur_loc;
+        char *stop;
+        errno = 0;
+        long br = strtol(digits, &stop, 10);
+        if (isdigit((unsigned char)*digits) && stop == manifest.c_str() + endloc && errno != ERANGE && br > 0 &&
+            br <= std::numeric_limits<int>::max())
+            brs.push_back((int)br);
+        cur_loc = manifest.find("bitrate=\"", endloc);
+    }
+    return brs;
+}
+
+/**
+ * @brief Find a header's value within the first head_len bytes: the name is matched
+ * case-insensitively, the blank line ends the search, and the value comes without the
+ * spaces or tabs around it.  "content-length:7015\r\n" and "Content-Length: 7015\r\n" alike.
+ */
+static bool find_header(const string &header, const char *name, size_t head_len, size_t *vstart, size_t *vend) {
+    size_t name_len = strlen(name);
+    size_t end = std::min(head_len, header.length());
+    size_t linestart = header.find("\r\n");
+    while (linestart != string::npos && linestart + 2 < end) {
+        linestart += 2;
+        size_t lineend = header.find("\r\n", linestart);
+        if (lineend == string::npos || lineend == linestart || lineend > end)
+            break; // no more head, anything after the blank line is body
+        if (lineend - linestart > name_len && header[linestart + name_len] == ':' &&
+            strncasecmp(header.c_str() + linestart, name, name_len) == 0) {
+            size_t v = linestart + name_len + 1, e = lineend;
+            while (v < e && (header[v] == ' ' || header[v] == '\t'))
+                v++;
+            while (e > v && (header[e - 1] == ' ' || header[e - 1] == '\t'))
+                e--;
+            *vstart = v;
+            *vend = e;
+            return true;
+        }
+        linestart = lineend;
+    }
+    return false;
+}
+
+bool content_length(const string &header, size_t head_len, size_t *length) {
+    size_t v, e;
+    *length = 0;
+    if (!find_header(header, "Content-Length", head_len, &v, &e))
+        return true; // 304s and friends
+    if (v == e || !isdigit((unsigned char)header[v]))
+        return false;
+    errno = 0;
+    char *stop;
+    unsigned long long n = strtoull(header.c_str() + v, &stop, 10);
+    if (errno == ERANGE || stop != header.c_str() + e || n > std::numeric_limits<size_t>::max())
+        return false;
+    *length = n;
+    return true;
+}
+
+// The proxy-origin hop is ours to manage, whatever the browser asked for.
+void set_connection(string &header, const char *value) {
+    size_t v, e;
+    if (find_header(header, "Connection", string::npos, &v, &e)) {
+        header.replace(v, e - v, value);
+        return;
+    }
+    size_t at = header.length() - 2; // before the blank line
+    header.insert(at, "\r\n");
+    header.insert(at, value);
+    header.insert(at, "Connection: ");
+}
+
+bool keeps_alive(const string &resp_header, size_t head_len) {
+    if (resp_header.compare(0, 8, "HTTP/1.1") != 0)
+        return false;
+    size_t v, e;
+    return !find_header(resp_header, "Connection", head_len, &v, &e) ||
+           !strcasestr(resp_header.substr(v, e - v).c_str(), "close");
+}
+
+//  "HTTP/1.1 304 Not Modified"
+int status_code(const string &resp_header) {
+    size_t sp = resp_header.find(' ');
+    if (sp == string::npos)
+        return 0;
+    return atoi(resp_header.c_str() + sp + 1);
+}
+
+// Value of a header (name matched case-insensitively), "" if it isn't there.
+string header_value(const string &header, const string &name) {
+    size_t v, e;
+    if (!find_header(header, name.c_str(), string::npos, &v, &e))
+        return "";
+    return header.substr(v, e - v);
+}
+
+// Append a header line to a complete head (the one ending in the blank line).
+string add_header(string header, const string &name, const string &value) {
+    header.insert(header.length() - 2, name + ": " + value + "\r\n");
+    return header;
+}
+
+//  HEAD, 1xx, 204 and 304 responses never have a body, whatever their headers say.
+BodyFraming body_framing(const string &resp, size_t head_len, bool head_request, size_t *length) {
+    int status = status_code(resp);
+    *length = 0;
+    if (head_request || (status >= 100 && status < 200) || status == 204 || status == 304)
+        return BODY_LENGTH;
+    string te = header_value(resp, "Transfer-Encoding");
+    if (!te.empty() && strcasestr(te.c_str(), "chunked"))
+        return BODY_CHUNKED;
+    size_t v, e;
+    if (find_header(resp, "Content-Length", head_len, &v, &e))
+        return content_length(resp, head_len, length) ? BODY_LENGTH : BODY_INVALID;
+    return BODY_UNTIL_CLOSE;
+}
+
+string frame_by_length(string header, size_t len) {
+    size_t linestart = header.find("\r\n");
+    while (linestart != string::npos && linestart + 4 <= header.length()) {
+        size_t lineend = header.find("\r\n", linestart + 2);
+        if (lineend == string::npos || lineend == linestart + 2)
+            break;
+        if (strncasecmp(header.c_str() + linestart + 2, "Transfer-Encoding:", 18) == 0 ||
+            strncasecmp(header.c_str() + linestart + 2, "Content-Length:", 15) == 0) {
+            header.erase(linestart, lineend - linestart);
+        } else {
+            linestart = lineend;
+        }
+    }
+    return add_header(header, "Content-Length", std::to_string(len));
+}
+
+void ChunkedDecoder::reset() {
+    st = SIZE;
+    remaining = 0;
+    digits = 0;
+}
+
+//  "1f4;ext=1\r\n<500 bytes>\r\n...0\r\nTrailer: x\r\n\r\n"
+long ChunkedDecoder::feed(const char *data, size_t len, string *decoded) {
+    size_t i = 0;
+    while (i < len && st != DONE) {
+        char c = data[i];
+        switch (st) {
+        case SIZE:
+            if (isxdigit((unsigned char)c)) {
+                if (++digits > 15)
+                    return -1; // no chunk is that big
+                remaining = remaining * 16 + (isdigit((unsigned char)c) ? c - '0' : (c | 0x20) - 'a' + 10);
+            } else if (digits > 0 && (c == ';' || c == ' ' || c == '\t')) {
+                st = EXTENSION;
+            } else if (digits > 0 && c == '\r') {
+                st = SIZE_LF;
+            } else {
+                return -1;
+            }
+            i++;
+            break;
+        case EXTENSION:
+            if (c == '\r')
+                st = SIZE_LF;
+            i++;
+            break;
+        case SIZE_LF:
+            if (c != '\n')
+                return -1;
+            st = remaining == 0 ? TRAILER_START : DATA;
+            i++;
+            break;
+        case DATA: {
+            size_t take = std::min(remaining, len - i);
+            if (decoded)
+                decoded->append(data + i, take);
+            remaining -= take;
+            i += take;
+            if (remaining == 0)
+                st = DATA_CR;
+            break;
+        }
+        case DATA_CR:
+            if (c != '\r')
+                return -1;
+            st = DATA_LF;
+            i++;
+            break;
+        case DATA_LF:
+            if (c != '\n')
+                return -1;
+            st = SIZE;
+            digits = 0;
+            i++;
+            break;
+        case TRAILER_START:
+            st = c == '\r' ? END_LF : TRAILER;
+            i++;
+            break;
+        case TRAILER:
+            if (c == '\r')
+                st = TRAILER_LF;
+            i++;
+            break;
+        case TRAILER_LF:
+            if (c != '\n')
+                return -1;
+            st = TRAILER_START;
+            i++;
+            break;
+        case END_LF:
+            if (c != '\n')
+                return -1;
+            st = DONE;
+            i++;
+            break;
+        case DONE:
+            break;
+        }
+    }
+    return i;
+}
+
+RequestRewriter::RequestRewriter() : req(nullptr), req_len(0), seg(0, 0), name_len(0), host(nullptr), host_len(0) {}
+
+// Offset of the CRLF at or after from, npos if there is none before end.
+static size_t find_crlf(const char *buf, size_t from, size_t end) {
+    while (from + 1 < end) {
+        const char *cr = (const char *)memchr(buf + from, '\r', end - from - 1);
+        if (!cr)
+            return string::npos;
+        size_t at = cr - buf;
+        if (buf[at + 1] == '\n')
+            return at;
+        from = at + 1;
+    }
+    return string::npos;
+}
+
+bool RequestRewriter::parse(const char *r, size_t len) {
+    req = r;
+    req_len = len;
+    seg = std::make_pair(0, 0);
+    name_len = 0;
+    host = nullptr;
+    host_len = 0;
+    host_start = host_end = conn_start = conn_end = string::npos;
+
+    line_end = find_crlf(req, 0, len);
+    if (line_end == string::npos)
+        return false;
+    const char *sp1 = (const char *)memchr(req, ' ', line_end);
+    if (!sp1)
+        return false;
+    size_t path_start = sp1 - req + 1;
+    const char *sp2 = (const char *)memchr(req + path_start, ' ', line_end - path_start);
+    size_t path_end = sp2 ? sp2 - req : line_end;
+
+    //  "/vod/1000Seg2-Frag3"
+    const char *path = req + path_start;
+    size_t path_len = path_end - path_start;
+    const char *s = (const char *)memmem(path, path_len, "Seg", 3);
+    const char *f = (const char *)memmem(path, path_len, "Frag", 4);
+    if (s && f) {
+        seg = std::make_pair(atoi(s + 3), atoi(f + 4));
+        const char *slash = s;
+        while (slash > path && slash[-1] != '/')
+            slash--;
+        name_start = slash - req;
+        name_end = path_end;
+    }
+
+    size_t pos = line_end + 2;
+    while (true) {
+        size_t eol = find_crlf(req, pos, len);
+        if (eol == string::npos)
+            return false;
+        if (eol == pos) {
+            head_end = eol;
+            return true;
+        }
+        const char *colon = (const char *)memchr(req + pos, ':', eol - pos);
+        if (colon) {
+            size_t field_len = colon - (req + pos);
+            size_t vstart = colon - req + 1;
+            while (vstart < eol && req[vstart] == ' ')
+                vstart++;
+            if (field_len == 4 && strncasecmp(req + pos, "Host", 4) == 0 && host_start == string::npos) {
+                host_start = vstart;
+                host_end = eol;
+            } else if (field_len == 10 && strncasecmp(req + pos, "Connection", 10) == 0 &&
+                       conn_start == string::npos) {
+                conn_start = vstart;
+                conn_end = eol;
+            }
+        }
+        pos = eol + 2;
+    }
+}
+
+void RequestRewriter::set_host(const string &h) {
+    host = h.data();
+    host_len = h.size();
+    if (host_start == string::npos) {
+        int len = snprintf(host_line, sizeof(host_line), "Host: %.*s\r\n", (int)host_len, host);
+        host_len = std::min((size_t)len, sizeof(host_line) - 1);
+    }
+}
+
+// Decimal digits of v at out, returns the end. snprintf costs more than the rest of a rewrite.
+static char *put_int(char *out, int v) {
+    unsigned u = v < 0 ? 0u - (unsigned)v : (unsigned)v;
+    if (v < 0)
+        *out++ = '-';
+    char digits[10];
+    int n = 0;
+    do {
+        digits[n++] = '0' + u % 10;
+        u /= 10;
+    } while (u);
+    while (n)
+        *out++ = digits[--n];
+    return out;
+}
+
+//  "<bitrate>Seg<seg>-Frag<frag>", at most 3 * 11 + 8 bytes
+void RequestRewriter::set_fragment(int bitrate, int s, int f) {
+    char *p = put_int(name, bitrate);
+    memcpy(p, "Seg", 3);
+    p = put_int(p + 3, s);
+    memcpy(p, "-Frag", 5);
+    p = put_int(p + 5, f);
+    name_len = p - name;
+}
+
+// The replacements in request order. Insertions go in front of the blank line.
+int RequestRewriter::pieces(Piece *out) const {
+    static const char KEEP_ALIVE[] = "keep-alive";
+    static const char KEEP_ALIVE_LINE[] = "Connection: keep-alive\r\n";
+    int n = 0;
+    if (name_len > 0)
+        out[n++] = Piece{name_start, name_end, name, name_len};
+    Piece h = {0, 0, nullptr, 0}, c;
+    bool has_host = host != nullptr;
+    if (has_host) {
+        if (host_start != string::npos)
+            h = Piece{host_start, host_end, host, host_len};
+        else
+            h = Piece{head_end, head_end, host_line, host_len};
+    }
+    if (conn_start != string::npos)
+        c = Piece{conn_start, conn_end, KEEP_ALIVE, sizeof(KEEP_ALIVE) - 1};
+    else
+        c = Piece{head_end, head_end, KEEP_ALIVE_LINE, sizeof(KEEP_ALIVE_LINE) - 1};
+    if (has_host && h.start <= c.start) {
+        out[n++] = h;
+        out[n++] = c;
+    } else {
+        out[n++] = c;
+        if (has_host)
+            out[n++] = h;
+    }
+    return n;
+}
+
+size_t RequestRewriter::length() const {
+    Piece p[3];
+    int n = pieces(p);
+    size_t len = req_len;
+    for (int i = 0; i < n; i++)
+        len = len - (p[i].end - p[i].start) + p[i].len;
+    return len;
+}
+
+int RequestRewriter::iov(size_t skip, struct iovec *out) const {
+    Piece p[3];
+    int n = pieces(p);
+    int count = 0;
+    size_t orig = 0;
+    // alternate original span, replacement, ..., original tail
+    for (int i = 0; i <= n; i++) {
+        const char *spans[2];
+        size_t lens[2];
+        spans[0] = req + orig;
+        lens[0] = (i < n ? p[i].start : req_len) - orig;
+        spans[1] = i < n ? p[i].data : nullptr;
+        lens[1] = i < n ? p[i].len : 0;
+        for (int j = 0; j < 2; j++) {
+            if (skip >= lens[j]) {
+                skip -= lens[j];
+                continue;
+            }
+            out[count].iov_base = (void *)(spans[j] + skip);
+            out[count].iov_len = lens[j] - skip;
+            count++;
+            skip = 0;
+        }
+        if (i < n)
+            orig = p[i].end;
+    }
+    return count;
+}
+
+void RequestRewriter::request_line(string &out) const {
+    if (name_len == 0) {
+        out.append(req, line_end);
+        return;
+    }
+    out.append(req, name_start);
+    out.append(name, name_len);
+    out.append(req + name_end, line_end - name_end);
+}
+
+string RequestRewriter::str() const {
+    struct iovec v[REWRITE_MAX_IOV];
+    int n = iov(0, v);
+    string out;
+    out.reserve(length());
+    for (int i = 0; i < n; i++)
+        out.append((const char *)v[i].iov_base, v[i].iov_len);
+    return out;
+}
+
+HttpParser::HttpParser(size_t max_head, size_t max_body)
+    : st(REQUEST_LINE), pos(0), scan(0), max_head(max_head), max_body(max_body), stale(false) {
+    reset();
+}
+
+void HttpParser::reset() {
+    method.clear();
+    path.clear();
+    version.clear();
+    host.clear();
+    content_length = 0;
+    keep_alive = false;
+    head_len = 0;
+    error = 0;
+    conn_close = false;
+    has_length = false;
+    bad_length = false;
+    has_encoding = false;
+    conn_keep_alive = false;
+}
+
+void HttpParser::feed(const char *data, size_t len) { buf.append(data, len); }
+
+int HttpParser::parse() {
+    if (st == DONE) {
+        return 1;
+    }
+    if (stale) {
+        reset();
+        stale = false;
+    }
+    while (true) {
+        size_t eol = buf.find("\r\n", scan);
+        if (eol == string::npos) {
+            // a CR at the very end may still be followed by its LF
+            scan = buf.empty() ? 0 : buf.size() - 1;
+            if (scan < pos)
+                scan = pos;
+            return buf.size() > max_head ? -1 : 0;
+        }
+        if (st == REQUEST_LINE) {
+            if (eol == pos) { // stray CRLF between pipelined requests
+                buf.erase(0, 2);
+                scan = pos = 0;
+                continue;
+            }
+            if (!parse_request_line(eol))
+                return -1;
+            st = HEADERS;
+        } else if (eol == pos) {
+            head_len = eol + 2;
+            // the body is buffered whole before the request goes anywhere, so it has to be small
+            // and its length known up front; a chunked one would be taken for the next request
+            if (has_encoding) {
+                error = has_length ? 400 : 501;
+                return -1;
+            }
+            if (bad_length) {
+                error = 400;
+                return -1;
+            }
+            if (content_length > max_body) {
+                error = 413;
+                return -1;
+            }
+            if (version == "HTTP/1.1")
+                keep_alive = !conn_close;
+            else
+                keep_alive = conn_keep_alive;
+            st = DONE;
+            return 1;
+        } else {
+            parse_header(eol);
+        }
+        pos = scan = eol + 2;
+        if (pos > max_head)
+            return -1;
+    }
+}
+
+void HttpParser::consume(size_t body_len) {
+    buf.erase(0, head_len + body_len);
+    pos = scan = 0;
+    st = REQUEST_LINE;
+    stale = true;
+}
+
+//  "GET /vod/1000Seg2-Frag3 HTTP/1.1"
+bool HttpParser::parse_request_line(size_t eol) {
+    size_t sp1 = buf.find(' ', pos);
+    if (sp1 == string::npos || sp1 >= eol)
+        return false;
+    size_t sp2 = buf.find(' ', sp1 + 1);
+    if (sp2 == string::npos || sp2 >= eol)
+        return false;
+    method.assign(buf, pos, sp1 - pos);
+    path.assign(buf, sp1 + 1, sp2 - sp1 - 1);
+    version.assign(buf, sp2 + 1, eol - sp2 - 1);
+    return true;
+}
+
+//  "Content-Length: 7015"
+void HttpParser::parse_header(size_t eol) {
+    size_t colon = buf.find(':', pos);
+    if (colon == string::npos || colon > eol)
+        return;
+    size_t vstart = colon + 1;
+    while (vstart < eol && (buf[vstart] == ' ' || buf[vstart] == '\t'))
+        vstart++;
+    const char *name = buf.data() + pos;
+    size_t name_len = colon - pos;
+    const char *value = buf.data() + vstart;
+    size_t value_len = eol - vstart;
+    if (name_len == 4 && strncasecmp(name, "Host", 4) == 0) {
+        host.assign(value, value_len);
+    } else if (name_len == 14 && strncasecmp(name, "Content-Length", 14) == 0) {
+        // digits only, and every Content-Length has to agree
+        size_t vend = eol;
+        while (vend > vstart && (buf[vend - 1] == ' ' || buf[vend - 1] == '\t'))
+            vend--;
+        char *stop;
+        errno = 0;
+        unsigned long long n = vend > vstart && isdigit((unsigned char)*value) ? strtoull(value, &stop, 10) : 0;
+        if (vend == vstart || !isdigit((unsigned char)*value) || errno == ERANGE || stop != buf.data() + vend ||
+            n > std::numeric_limits<size_t>::max() || (has_length && n != content_length))
+            bad_length = true;
+        else
+            content_length = n;
+        has_length = true;
+    } else if (name_len == 17 && strncasecmp(name, "Transfer-Encoding", 17) == 0) {
+        has_encoding = true;
+    } else if (name_len == 10 && strncasecmp(name, "Connection", 10) == 0) {
+        conn_close = value_len >= 5 && strncasecmp(value, "close", 5) == 0;
+        conn_keep_alive = value_len >= 10 && strncasecmp(value, "keep-alive", 10) == 0;
+    }
+}
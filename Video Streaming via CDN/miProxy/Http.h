@@ -0,0 +1,162 @@
+#ifndef _HTTP_H_
+#define _HTTP_H_
+
+#include <stddef.h>
+#include <string>
+#include <sys/uio.h>
+#include <utility>
+#include <vector>
+
+using std::pair;
+using std::string;
+using std::vector;
+
+int headerEnd(const char *buf, int len, int offset = 0);
+string chunkname(pair<int, int> seg);
+vector<int> parse_manifest(const string &manifest);
+// head_len bounds the search when header is followed by (part of) a body. length is 0
+// without the header; false if it is there but not a decimal number that fits.
+bool content_length(const string &header, size_t head_len, size_t *length);
+// In place, so a head copied into a buffer that is reused allocates nothing once it has grown.
+void set_connection(string &header, const char *value);
+bool keeps_alive(const string &resp_header, size_t head_len = string::npos);
+int status_code(const string &resp_header);
+string header_value(const string &header, const string &name);
+string add_header(string header, const string &name, const string &value);
+
+// How the end of a response body is found.
+enum BodyFraming {
+    BODY_LENGTH,      // Content-Length, or no body at all (length 0)
+    BODY_CHUNKED,     // Transfer-Encoding: chunked
+    BODY_UNTIL_CLOSE, // neither: the body runs until the origin closes the connection
+    BODY_INVALID,     // a Content-Length that can't be read, nothing can be trusted after it
+};
+BodyFraming body_framing(const string &resp, size_t head_len, bool head_request, size_t *length);
+// The head for a body that is now whole and len bytes long: Transfer-Encoding goes,
+// Content-Length is set.
+string frame_by_length(string header, size_t len);
+
+/**
+ * Follows a chunked body as it streams past, to tell where it ends; the bytes themselves
+ * are relayed as they came. Holds no more than the state of the line it is in.
+ */
+class ChunkedDecoder {
+  public:
+    ChunkedDecoder() { reset(); }
+    void reset();
+    // How many of the len bytes belong to the body (fewer once it ends), -1 if it is
+    // malformed. The chunk payload is appended to decoded if one is given.
+    long feed(const char *data, size_t len, string *decoded = nullptr);
+    bool done() const { return st == DONE; }
+
+  private:
+    enum State { SIZE, EXTENSION, SIZE_LF, DATA, DATA_CR, DATA_LF, TRAILER_START, TRAILER, TRAILER_LF, END_LF, DONE };
+    State st;
+    size_t remaining; // of the current chunk, or its size while it is being read
+    int digits;
+};
+
+static const int REWRITE_MAX_IOV = 8; // 3 replaced pieces and the 4 original spans around them, plus 1
+
+/**
+ * The browser's request as the origin gets it, without building it: the request is
+ * parsed once into spans, the pieces that change (the fragment name in the path, the Host
+ * value, the Connection value) are formatted into a fixed scratch buffer, and iov() lays
+ * the original spans and the new pieces out for one writev. No allocations; the request
+ * and the host passed in must stay put while the rewriter is in use.
+ *   GET /vod/1000Seg2-Frag3 HTTP/1.1 -> GET /vod/<bitrate>Seg2-Frag3 HTTP/1.1
+ *   Host: localhost:8888             -> Host: <origin>
+ *   Connection: close                -> Connection: keep-alive (added if missing)
+ */
+class RequestRewriter {
+  public:
+    RequestRewriter();
+    // req is a complete head, possibly followed by a body. false if it isn't a request.
+    bool parse(const char *req, size_t len);
+    // (seg, frag) if the path names a fragment, (0, 0) if not
+    pair<int, int> fragment() const { return seg; }
+    void set_host(const string &host);
+    void set_fragment(int bitrate, int seg, int frag);
+    size_t length() const;
+    // The rewritten request from byte skip on, as at most REWRITE_MAX_IOV iovecs.
+    int iov(size_t skip, struct iovec *out) const;
+    // Append the rewritten request line, without its CRLF.
+    void request_line(string &out) const;
+    string str() const;
+
+  private:
+    struct Piece {
+        size_t start; // original bytes [start, end) are replaced by data
+        size_t end;
+        const char *data;
+        size_t len;
+    };
+    const char *req;
+    size_t req_len;
+    size_t line_end;   // CRLF ending the request line
+    size_t name_start; // fragment name within the path, when there is one
+    size_t name_end;
+    size_t host_start; // Host value, npos if there is no Host header
+    size_t host_end;
+    size_t conn_start; // Connection value, npos if there is no Connection header
+    size_t conn_end;
+    size_t head_end; // the blank line's CRLF
+    pair<int, int> seg;
+    char name[48];
+    size_t name_len; // 0 while the name is left as it is
+    const char *host;
+    size_t host_len;
+    char host_line[64]; // "Host: ...\r\n", for a request that came without one
+
+    int pieces(Piece *out) const;
+};
+
+/**
+ * Incremental parser for HTTP/1.1 request heads over a growable buffer.
+ * feed() whatever came off the socket and call parse(); it picks up where the last call
+ * stopped, so no byte is scanned twice however the head was split across reads. Once a
+ * head is parsed its fields stay valid until the next parse() after consume(), and any
+ * bytes after the head (the body, pipelined requests) stay buffered.
+ */
+class HttpParser {
+  public:
+    string method;
+    string path;
+    string version;
+    string host;
+    size_t content_length;
+    bool keep_alive;
+    size_t head_len; // bytes of request line + headers, including the blank line
+    // after -1, what to answer with: 400 (bad Content-Length, or one next to Transfer-Encoding),
+    // 413 (body over max_body) or 501 (Transfer-Encoding, bodies are only taken by length); else 0
+    int error;
+
+    HttpParser(size_t max_head, size_t max_body);
+    void feed(const char *data, size_t len);
+    // 1 when a whole head is parsed, 0 if more bytes are needed, -1 if malformed or too large
+    int parse();
+    // Drop the parsed head and body_len body bytes, leaving the next request at the front.
+    void consume(size_t body_len);
+    const string &buffer() const { return buf; }
+
+  private:
+    enum State { REQUEST_LINE, HEADERS, DONE };
+    State st;
+    string buf;
+    size_t pos;  // start of the next unparsed line
+    size_t scan; // where the search for its CRLF resumes
+    size_t max_head;
+    size_t max_body;
+    bool conn_close;
+    bool conn_keep_alive;
+    bool has_length;
+    bool bad_length;
+    bool has_encoding; // Transfer-Encoding
+    bool stale; // fields still describe the consumed request
+
+    void reset();
+    bool parse_request_line(size_t eol);
+    void parse_header(size_t eol);
+};
+
+#endif
@@ -1,15 +1,140 @@
 #include "Log.h"
+#include "Http.h"
+#include <arpa/inet.h>
+#include <chrono>
+#include <string.h>
 
-using std::endl;
 using std::string;
+using namespace std::chrono;
 
-Log::Log(string filename) : log(filename) {}
-void Log::write(string browser_ip, string chunkname, string server_ip, double duration, double tput, double avg_tput,
-                int bitrate) {
-  log << browser_ip << " " << chunkname << " " << server_ip << " " << duration << " " << tput << " " << avg_tput << " "
-      << bitrate << endl;
+static const char BINARY_MAGIC[8] = {'M', 'I', 'P', 'X', 'L', 'O', 'G', '1'};
+
+Log::Log(string filename, Format format)
+    : file(fopen(filename.c_str(), "w")), format(format), rings(nullptr), flush_now(false), stopping(false) {
+  if (!file) {
+    perror("Error opening log");
+    exit(-1);
+  }
+  setvbuf(file, nullptr, _IOFBF, LOG_WRITE_BUFFER);
+  if (format == BINARY)
+    fwrite(BINARY_MAGIC, 1, sizeof(BINARY_MAGIC), file);
+  writer = std::thread([this]() { run(); });
+}
+
+LogRing *Log::my_ring() {
+  // one log per process, a thread's ring is registered once and lives as long as the log
+  static thread_local LogRing *ring = nullptr;
+  if (!ring) {
+    ring = new LogRing();
+    ring->next = rings.load();
+    while (!rings.compare_exchange_weak(ring->next, ring)) {
+    }
+  }
+  return ring;
+}
+
+void Log::write(const string &browser_ip, pair<int, int> seg, const string &server_ip, double duration, double tput,
+                double avg_tput, int bitrate) {
+  LogRing *ring = my_ring();
+  uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+  while (tail - ring->head.load(std::memory_order_acquire) >= LOG_RING_RECORDS) {
+    flush_log();
+    std::this_thread::yield();
+  }
+  LogRecord &r = ring->slots[tail % LOG_RING_RECORDS];
+  r.time_ns = duration_cast<nanoseconds>(system_clock::now().time_since_epoch()).count();
+  inet_pton(AF_INET, browser_ip.c_str(), &r.browser_ip);
+  inet_pton(AF_INET, server_ip.c_str(), &r.server_ip);
+  r.seg = seg.first;
+  r.frag = seg.second;
+  r.bitrate = bitrate;
+  r.duration = duration;
+  r.tput = tput;
+  r.avg_tput = avg_tput;
+  ring->tail.store(tail + 1, std::memory_order_release);
+}
+
+void Log::flush_log() {
+  flush_now = true;
+  wake.notify_one();
+}
+
+void Log::format_text(const LogRecord &r, string &out) {
+  char browser[INET_ADDRSTRLEN], server[INET_ADDRSTRLEN];
+  inet_ntop(AF_INET, &r.browser_ip, browser, sizeof(browser));
+  inet_ntop(AF_INET, &r.server_ip, server, sizeof(server));
+  // %g is what ostream << double printed
+  char line[256];
+  int len = snprintf(line, sizeof(line), "%s %s %s %g %g %g %d\n", browser,
+                     chunkname(std::make_pair(r.seg, r.frag)).c_str(), server, r.duration, r.tput, r.avg_tput,
+                     r.bitrate);
+  out.append(line, std::min(len, (int)sizeof(line) - 1));
 }
-void Log::flush_log () {
-    log.flush();
+
+// Move everything the rings hold into batch.
+void Log::drain(string &batch) {
+  for (LogRing *ring = rings.load(); ring; ring = ring->next) {
+    uint64_t head = ring->head.load(std::memory_order_relaxed);
+    uint64_t tail = ring->tail.load(std::memory_order_acquire);
+    for (; head != tail; head++) {
+      const LogRecord &r = ring->slots[head % LOG_RING_RECORDS];
+      if (format == TEXT)
+        format_text(r, batch);
+      else
+        batch.append((const char *)&r, sizeof(r));
+    }
+    ring->head.store(tail, std::memory_order_release);
+  }
+}
+
+void Log::run() {
+  string batch;
+  batch.reserve(LOG_WRITE_BUFFER);
+  while (true) {
+    bool stop = stopping.load();
+    drain(batch);
+    if (!batch.empty()) {
+      fwrite(batch.data(), 1, batch.size(), file);
+      fflush(file);
+      batch.clear();
+    }
+    if (stop)
+      return;
+    std::unique_lock<std::mutex> guard(wake_lock);
+    wake.wait_for(guard, milliseconds(LOG_FLUSH_MS), [this]() { return flush_now.load() || stopping.load(); });
+    flush_now = false;
+  }
+}
+
+void Log::shutdown() {
+  if (!writer.joinable())
+    return;
+  stopping = true;
+  wake.notify_one();
+  writer.join();
+}
+
+Log::~Log() {
+  shutdown();
+  fclose(file);
+}
+
+bool Log::decode(const string &binary_file, FILE *out) {
+  FILE *in = fopen(binary_file.c_str(), "r");
+  if (!in)
+    return false;
+  char magic[sizeof(BINARY_MAGIC)];
+  if (fread(magic, 1, sizeof(magic), in) != sizeof(magic) || memcmp(magic, BINARY_MAGIC, sizeof(magic)) != 0) {
+    fclose(in);
+    return false;
+  }
+  LogRecord r;
+  string line;
+  while (fread(&r, sizeof(r), 1, in) == 1) {
+    line.clear();
+    format_text(r, line);
+    fwrite(line.data(), 1, line.size(), out);
+  }
+  fclose(in);
+  return true;
 }
-Log::~Log() { log.close(); }
\ No newline at end of file
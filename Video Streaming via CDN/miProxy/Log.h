@@ -2,23 +2,81 @@
 #define _LOG_H_
 
 #include "params.h"
-#include <fstream>
-#include <ostream>
-#include <sstream>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <stdint.h>
+#include <stdio.h>
 #include <string>
+#include <thread>
+#include <utility>
 
-using std::ofstream;
+using std::pair;
 using std::string;
 
-class Log {
-private:
-  ofstream log;
+// One chunk log line, as it crosses from a worker to the writer and as the binary log
+// stores it (host byte order, decoded on the same kind of machine).
+struct LogRecord {
+  uint64_t time_ns;    // wall clock, binary log only
+  uint32_t browser_ip; // network order
+  uint32_t server_ip;
+  int32_t seg;
+  int32_t frag;
+  int32_t bitrate;
+  double duration;
+  double tput;
+  double avg_tput;
+};
 
+// Single producer (one worker thread), single consumer (the writer).
+struct LogRing {
+  LogRecord slots[LOG_RING_RECORDS];
+  std::atomic<uint64_t> head; // next to read, the writer's
+  char pad[64];               // keep the two ends on separate cache lines
+  std::atomic<uint64_t> tail; // next to write, the worker's
+  LogRing *next;
+  LogRing() : head(0), tail(0), next(nullptr) {}
+};
+
+/**
+ * Chunk log. write() copies a fixed-size record into the calling thread's own ring, no
+ * locks, no formatting, no syscalls. A background thread drains the rings every
+ * LOG_FLUSH_MS, formats them into
+ *   browser_ip chunkname server_ip duration tput avg_tput bitrate
+ * (or keeps the records as they are for the binary format) and writes the batch out
+ * in one go. A full ring makes its worker wait for the writer rather than lose lines.
+ */
+class Log {
 public:
-  Log(string filename);
-  void write(string, string, string, double, double, double, int);
+  enum Format { TEXT, BINARY };
+
+  Log(string filename, Format format = TEXT);
+  void write(const string &browser_ip, pair<int, int> seg, const string &server_ip, double duration, double tput,
+             double avg_tput, int bitrate);
+  // Wake the writer now rather than at its next tick. Costs a syscall, not for every line.
   void flush_log();
+  // Stop the writer once it has drained every ring into the file and flushed it; lines
+  // written after this are dropped. Call before exit(), which won't wait for the writer.
+  void shutdown();
   ~Log();
+
+  // Offline decoder: binary log in, text log out. false if it isn't a binary log.
+  static bool decode(const string &binary_file, FILE *out);
+
+private:
+  FILE *file;
+  Format format;
+  std::atomic<LogRing *> rings; // every thread's ring, pushed at the front
+  std::atomic<bool> flush_now;
+  std::atomic<bool> stopping;
+  std::mutex wake_lock; // only the writer takes it, to sleep on wake
+  std::condition_variable wake;
+  std::thread writer;
+
+  LogRing *my_ring();
+  void run();
+  void drain(string &batch);
+  static void format_text(const LogRecord &r, string &out);
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,77 @@
+#include "ManifestCache.h"
+#include "Http.h"
+
+using std::lock_guard;
+using std::make_shared;
+using std::mutex;
+using std::chrono::milliseconds;
+using std::chrono::seconds;
+using std::chrono::steady_clock;
+
+ManifestCache::ManifestCache(size_t max_entries, int default_max_age_ms)
+    : max_entries(max_entries), default_max_age(default_max_age_ms) {}
+
+shared_ptr<const ManifestEntry> ManifestCache::lookup(const string &key) {
+    lock_guard<mutex> guard(lock);
+    auto it = entries.find(key);
+    if (it == entries.end())
+        return nullptr;
+    return it->second;
+}
+
+bool ManifestCache::fresh(const ManifestEntry &entry) const {
+    return steady_clock::now() - entry.validated < entry.max_age;
+}
+
+shared_ptr<const ManifestEntry> ManifestCache::insert(const string &key, const vector<int> &bitrates,
+                                                      const string &header, const string &body) {
+    auto entry = make_shared<ManifestEntry>();
+    entry->bitrates = bitrates;
+    entry->header = header;
+    entry->body = body;
+    entry->etag = header_value(header, "ETag");
+    entry->last_modified = header_value(header, "Last-Modified");
+    entry->validated = steady_clock::now();
+    entry->max_age = default_max_age;
+    //  "Cache-Control: public, max-age=60"
+    string cache_control = header_value(header, "Cache-Control");
+    size_t max_age = cache_control.find("max-age=");
+    if (max_age != string::npos) {
+        entry->max_age = seconds(atoi(cache_control.c_str() + max_age + 8));
+    }
+
+    lock_guard<mutex> guard(lock);
+    if (entries.find(key) == entries.end())
+        make_room();
+    entries[key] = entry;
+    return entry;
+}
+
+shared_ptr<const ManifestEntry> ManifestCache::revalidated(const string &key,
+                                                           const shared_ptr<const ManifestEntry> &entry) {
+    auto updated = make_shared<ManifestEntry>(*entry);
+    updated->validated = steady_clock::now();
+    lock_guard<mutex> guard(lock);
+    entries[key] = updated;
+    return updated;
+}
+
+string ManifestCache::conditional(string request, const ManifestEntry &entry) {
+    if (!entry.etag.empty())
+        request = add_header(request, "If-None-Match", entry.etag);
+    if (!entry.last_modified.empty())
+        request = add_header(request, "If-Modified-Since", entry.last_modified);
+    return request;
+}
+
+// Called with the lock held. Manifests are few, a scan for the stalest one is fine.
+void ManifestCache::make_room() {
+    if (entries.size() < max_entries || entries.empty())
+        return;
+    auto oldest = entries.begin();
+    for (auto it = entries.begin(); it != entries.end(); ++it) {
+        if (it->second->validated < oldest->second->validated)
+            oldest = it;
+    }
+    entries.erase(oldest);
+}
@@ -0,0 +1,55 @@
+#ifndef _MANIFEST_CACHE_H_
+#define _MANIFEST_CACHE_H_
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using std::shared_ptr;
+using std::string;
+using std::unordered_map;
+using std::vector;
+
+// Everything a new viewer's manifest request needs: the ladder for its tracker and the
+// _nolist response the player gets.
+struct ManifestEntry {
+    vector<int> bitrates;
+    string header; // _nolist response head, as the origin sent it
+    string body;
+    string etag;
+    string last_modified;
+    std::chrono::steady_clock::time_point validated;
+    std::chrono::milliseconds max_age;
+};
+
+/**
+ * Process-wide cache of manifests keyed by origin + manifest path, shared by the workers.
+ * Entries are immutable; a lookup hands out a reference to the current version, so the
+ * lock only covers the map. Once an entry is older than its max-age (Cache-Control or the
+ * default) it has to be revalidated with the origin before it is served again.
+ */
+class ManifestCache {
+  public:
+    ManifestCache(size_t max_entries, int default_max_age_ms);
+    shared_ptr<const ManifestEntry> lookup(const string &key);
+    bool fresh(const ManifestEntry &entry) const;
+    shared_ptr<const ManifestEntry> insert(const string &key, const vector<int> &bitrates, const string &header,
+                                           const string &body);
+    // The origin answered 304: same content, fresh again.
+    shared_ptr<const ManifestEntry> revalidated(const string &key, const shared_ptr<const ManifestEntry> &entry);
+    // Conditional request for a stale entry.
+    static string conditional(string request, const ManifestEntry &entry);
+
+  private:
+    std::mutex lock;
+    unordered_map<string, shared_ptr<const ManifestEntry>> entries;
+    size_t max_entries;
+    std::chrono::milliseconds default_max_age;
+
+    void make_room();
+};
+
+#endif
@@ -0,0 +1,80 @@
+#include "OriginSet.h"
+#include "params.h"
+#include <algorithm>
+
+using std::chrono::milliseconds;
+using std::chrono::steady_clock;
+
+OriginSet::OriginSet(const vector<string> &configured) {
+    for (const string &ip : configured)
+        add(ip);
+}
+
+void OriginSet::add(const string &ip) { get(ip); }
+
+OriginSet::Origin &OriginSet::get(const string &ip) {
+    auto it = origins.find(ip);
+    if (it != origins.end())
+        return it->second;
+    Origin o;
+    o.connect_ms = 0;
+    o.kbps = 0;
+    o.failures = 0;
+    return origins.insert(std::make_pair(ip, o)).first->second;
+}
+
+// Expected ms to open a connection and move a typical fragment.
+double OriginSet::score(const Origin &o) {
+    double transfer = o.kbps > 0 ? ORIGIN_SCORE_BYTES * 8 / o.kbps : 0;
+    return o.connect_ms + transfer;
+}
+
+string OriginSet::pick(const string &primary, const vector<string> &tried) {
+    auto now = steady_clock::now();
+    Origin &p = get(primary);
+    bool primary_tried = std::find(tried.begin(), tried.end(), primary) != tried.end();
+    const string *best = nullptr, *soonest = nullptr;
+    double best_score = 0;
+    for (auto &o : origins) {
+        if (std::find(tried.begin(), tried.end(), o.first) != tried.end())
+            continue;
+        if (o.second.down_until > now) {
+            if (!soonest || o.second.down_until < origins[*soonest].down_until)
+                soonest = &o.first;
+            continue;
+        }
+        double s = score(o.second);
+        if (!best || s < best_score) {
+            best = &o.first;
+            best_score = s;
+        }
+    }
+    if (!primary_tried && p.down_until <= now &&
+        (!best || score(p) <= best_score * ORIGIN_SWITCH_FACTOR + ORIGIN_SWITCH_SLACK_MS))
+        return primary;
+    if (best)
+        return *best;
+    return soonest ? *soonest : "";
+}
+
+void OriginSet::connected(const string &ip, double ms) {
+    Origin &o = get(ip);
+    o.connect_ms = o.connect_ms == 0 ? ms : (1 - ORIGIN_EWMA_ALPHA) * o.connect_ms + ORIGIN_EWMA_ALPHA * ms;
+    o.failures = 0;
+    o.down_until = steady_clock::time_point();
+}
+
+void OriginSet::delivered(const string &ip, double kbps) {
+    Origin &o = get(ip);
+    o.kbps = o.kbps == 0 ? kbps : (1 - ORIGIN_EWMA_ALPHA) * o.kbps + ORIGIN_EWMA_ALPHA * kbps;
+    o.failures = 0;
+    o.down_until = steady_clock::time_point();
+}
+
+void OriginSet::failed(const string &ip) {
+    Origin &o = get(ip);
+    int shift = std::min(o.failures, 16);
+    long backoff = std::min((long)ORIGIN_BACKOFF_MIN_MS << shift, (long)ORIGIN_BACKOFF_MAX_MS);
+    o.failures++;
+    o.down_until = steady_clock::now() + milliseconds(backoff);
+}
@@ -0,0 +1,47 @@
+#ifndef _ORIGIN_SET_H_
+#define _ORIGIN_SET_H_
+
+#include <chrono>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using std::string;
+using std::unordered_map;
+using std::vector;
+
+/**
+ * Per-worker view of every origin this worker knows about: the --origins list and every
+ * address the nameserver has handed out. Each one is ranked by what fetching from it has
+ * cost lately (EWMA connect time plus the time to move ORIGIN_SCORE_BYTES at its EWMA
+ * throughput); one that was never measured ranks first, so it gets tried.
+ * A failure takes an origin out for ORIGIN_BACKOFF_MIN_MS, doubling with every failure in
+ * a row up to ORIGIN_BACKOFF_MAX_MS; once that runs out the next request probes it again,
+ * and any success puts it back in full.
+ */
+class OriginSet {
+  public:
+    OriginSet(const vector<string> &configured);
+    void add(const string &ip);
+    // Where a client the nameserver sent to primary should fetch from: primary, unless it
+    // is down or clearly slower than the best origin up. Origins in tried are skipped.
+    // With every other origin down, the one back soonest; "" when all have been tried.
+    string pick(const string &primary, const vector<string> &tried);
+    void connected(const string &ip, double ms);
+    void delivered(const string &ip, double kbps);
+    void failed(const string &ip);
+
+  private:
+    struct Origin {
+        double connect_ms; // EWMA, 0 until measured
+        double kbps;       // EWMA, 0 until measured
+        int failures;      // in a row
+        std::chrono::steady_clock::time_point down_until;
+    };
+    unordered_map<string, Origin> origins;
+
+    Origin &get(const string &ip);
+    static double score(const Origin &o);
+};
+
+#endif
@@ -0,0 +1,216 @@
+#include "Prefetcher.h"
+#include "Http.h"
+#include "Socket.h"
+#include "params.h"
+#include <algorithm>
+#include <errno.h>
+
+using std::min;
+using std::chrono::milliseconds;
+using std::chrono::steady_clock;
+
+static bool would_block() { return errno == EAGAIN || errno == EWOULDBLOCK; }
+
+Prefetch::Prefetch(Prefetcher *owner, const string &client, const string &request, pair<int, int> seg, int bitrate)
+    : status(RUNNING), seg(seg), bitrate(bitrate), waiter(nullptr), owner(owner), client(client), up(nullptr),
+      request(request), sent(0), connected(false), header_len(0), body_len(0), throttled(false), dropped(false) {}
+
+void Prefetch::handle_event(uint32_t events) {
+    while (!dropped && status == RUNNING && !throttled && step()) {
+    }
+}
+
+/**
+ * @brief Same steps as a Connection's CONNECT..READ_RESPONSE, minus the browser. Any
+ * trouble just fails the prefetch; the request it was for fetches on its own.
+ */
+bool Prefetch::step() {
+    if (!connected) {
+        if (up->timed_out || socket_connect_error(up->fd) != 0) {
+            finish(FAILED);
+            return false;
+        }
+        struct sockaddr_in addr;
+        socklen_t len = sizeof(addr);
+        if (getpeername(up->fd, (struct sockaddr *)&addr, &len) == -1)
+            return false;
+        connected = true;
+    }
+    if (sent < request.size()) {
+        int len = send(up->fd, request.data() + sent, request.size() - sent, MSG_NOSIGNAL);
+        if (len == -1) {
+            if (!would_block())
+                finish(FAILED);
+            return false;
+        }
+        sent += len;
+        return true;
+    }
+
+    size_t allowed = owner->grant(BUF_SIZE);
+    if (allowed == 0) {
+        throttled = true;
+        owner->throttled.push_back(this);
+        return false;
+    }
+    char buf[BUF_SIZE];
+    int len = recv(up->fd, buf, allowed, 0);
+    owner->refund(allowed - std::max(len, 0));
+    if (len == -1 && would_block())
+        return false;
+    if (len <= 0) {
+        finish(FAILED);
+        return false;
+    }
+    size_t old = response.size();
+    response.append(buf, len);
+    owner->held += len;
+    if (header_len == 0) {
+        int hend = headerEnd(response.data(), response.size(), old);
+        if (hend == -1) {
+            if (response.size() >= (size_t)BUF_SIZE)
+                finish(FAILED);
+            return true;
+        }
+        header_len = hend;
+        string head = response.substr(0, header_len);
+        if (header_value(head, "Content-Length").empty() || !content_length(head, header_len, &body_len)) {
+            finish(FAILED); // no way to tell where it ends
+            return false;
+        }
+    }
+    if (response.size() >= header_len + body_len)
+        finish(DONE);
+    return true;
+}
+
+void Prefetch::finish(Status st) {
+    if (up) {
+        bool reusable = st == DONE && response.size() == header_len + body_len &&
+                        keeps_alive(response.substr(0, header_len));
+        owner->pool->release(up, reusable);
+        up = nullptr;
+    }
+    owner->held -= response.size();
+    if (st == DONE) {
+        auto fragment = std::make_shared<CachedFragment>();
+        fragment->header = response.substr(0, header_len);
+        fragment->body = response.substr(header_len, body_len);
+        owner->held += fragment->header.size() + fragment->body.size();
+        result = fragment;
+    }
+    string().swap(response);
+    status = st;
+    finished = steady_clock::now();
+    EventHandler *w = waiter;
+    if (w)
+        w->handle_event(0);
+}
+
+Prefetcher::Prefetcher(EventLoop *loop, UpstreamPool *pool, int max_kbps, size_t max_held_bytes)
+    : loop(loop), pool(pool), tokens_per_tick((size_t)max_kbps * 1000 / 8 * PREFETCH_TICK_MS / 1000),
+      burst(std::max((size_t)BUF_SIZE, tokens_per_tick * 10)), tokens(burst), max_held(max_held_bytes), held(0),
+      refiller(loop, PREFETCH_TICK_MS, [this]() { refill(); }), sweeper(loop, 1000, [this]() { sweep(); }) {}
+
+Prefetcher::~Prefetcher() {
+    while (!slots.empty())
+        drop(slots.begin()->second);
+}
+
+void Prefetcher::start(const string &client, const string &origin, const string &request, pair<int, int> seg,
+                       int bitrate) {
+    auto it = slots.find(client);
+    if (it != slots.end()) {
+        Prefetch *p = it->second;
+        if (p->seg == seg && p->bitrate == bitrate && p->status != Prefetch::FAILED)
+            return;
+        drop(p);
+    }
+    if (held >= max_held)
+        return;
+    Prefetch *p = new Prefetch(this, client, request, seg, bitrate);
+    p->up = pool->acquire(origin, p);
+    if (!p->up) {
+        delete p;
+        return;
+    }
+    slots[client] = p;
+    // a warm pooled connection can take the request right away
+    p->handle_event(0);
+}
+
+Prefetch *Prefetcher::claim(const string &client, pair<int, int> seg, int bitrate) {
+    auto it = slots.find(client);
+    if (it == slots.end())
+        return nullptr;
+    Prefetch *p = it->second;
+    if (p->waiter)
+        return nullptr;
+    if (p->seg != seg || p->bitrate != bitrate || p->status == Prefetch::FAILED) {
+        drop(p);
+        return nullptr;
+    }
+    return p;
+}
+
+void Prefetcher::consumed(Prefetch *p) {
+    if (!p->dropped)
+        drop(p);
+}
+
+void Prefetcher::drop(Prefetch *p) {
+    p->dropped = true;
+    auto it = slots.find(p->client);
+    if (it != slots.end() && it->second == p)
+        slots.erase(it);
+    held -= p->response.size() + (p->result ? p->result->header.size() + p->result->body.size() : 0);
+    auto queued = std::find(throttled.begin(), throttled.end(), p);
+    if (queued != throttled.end())
+        throttled.erase(queued);
+    if (p->up) {
+        pool->release(p->up, false);
+        p->up = nullptr;
+    }
+    if (p->status == Prefetch::RUNNING) {
+        p->status = Prefetch::FAILED;
+        EventHandler *w = p->waiter;
+        if (w)
+            w->handle_event(0);
+    }
+    loop->retire(p);
+}
+
+size_t Prefetcher::grant(size_t want) {
+    size_t granted = min(want, tokens);
+    tokens -= granted;
+    return granted;
+}
+
+void Prefetcher::refund(size_t unused) { tokens = min(burst, tokens + unused); }
+
+void Prefetcher::refill() {
+    tokens = min(burst, tokens + tokens_per_tick);
+    // edge triggered: what is already waiting in their sockets won't wake them again
+    vector<Prefetch *> waiting;
+    waiting.swap(throttled);
+    for (Prefetch *p : waiting) {
+        // one dropped by an earlier one's waiter is retired, still safe to look at
+        p->throttled = false;
+        p->handle_event(EPOLLIN);
+    }
+}
+
+/**
+ * @brief Nobody asked for these in time (the player seeked, switched or left).
+ */
+void Prefetcher::sweep() {
+    auto cutoff = steady_clock::now() - milliseconds(PREFETCH_SLOT_TTL_MS);
+    vector<Prefetch *> expired;
+    for (auto &slot : slots) {
+        Prefetch *p = slot.second;
+        if (p->status != Prefetch::RUNNING && !p->waiter && p->finished < cutoff)
+            expired.push_back(p);
+    }
+    for (Prefetch *p : expired)
+        drop(p);
+}
@@ -0,0 +1,99 @@
+#ifndef _PREFETCHER_H_
+#define _PREFETCHER_H_
+
+#include "EventLoop.h"
+#include "FragmentCache.h"
+#include "UpstreamPool.h"
+#include <chrono>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+using std::pair;
+using std::shared_ptr;
+using std::string;
+using std::unordered_map;
+using std::vector;
+
+class Prefetcher;
+
+/**
+ * One speculative fetch of the fragment a session is expected to ask for next. The whole
+ * response is read into memory, no faster than the prefetch budget allows, and then sits
+ * in the session's slot until a request takes it or it expires.
+ */
+class Prefetch : public EventHandler {
+  public:
+    enum Status { RUNNING, DONE, FAILED };
+
+    Status status;
+    pair<int, int> seg;
+    int bitrate;
+    shared_ptr<const CachedFragment> result; // once DONE, whatever the origin answered
+    EventHandler *waiter;                    // a request for this fragment waiting on us
+
+    Prefetch(Prefetcher *owner, const string &client, const string &request, pair<int, int> seg, int bitrate);
+    void handle_event(uint32_t events) override;
+
+  private:
+    friend class Prefetcher;
+    Prefetcher *owner;
+    string client;
+    UpstreamConn *up;
+    string request;
+    size_t sent;
+    bool connected;
+    string response;
+    size_t header_len;
+    size_t body_len;
+    bool throttled; // out of budget, waiting for the next refill
+    bool dropped;
+    std::chrono::steady_clock::time_point finished;
+
+    bool step();
+    void finish(Status st);
+};
+
+/**
+ * Per-worker prefetching: at most one slot per client. The bytes prefetches pull from
+ * origins go through a token bucket so they can only use the bandwidth they are given,
+ * and the bodies they hold are capped too.
+ */
+class Prefetcher {
+  public:
+    Prefetcher(EventLoop *loop, UpstreamPool *pool, int max_kbps, size_t max_held_bytes);
+    ~Prefetcher();
+    // Fetch this fragment for the client. A slot holding anything else is cancelled first,
+    // which is how a change of bitrate downgrades (or upgrades) a prefetch in flight.
+    void start(const string &client, const string &origin, const string &request, pair<int, int> seg,
+               int bitrate);
+    // The client's prefetch if it is for this fragment at this bitrate and nobody else
+    // waits on it. Anything else in the slot is cancelled, the request fetches for itself.
+    Prefetch *claim(const string &client, pair<int, int> seg, int bitrate);
+    // The request is done with it, whether it was used or not.
+    void consumed(Prefetch *p);
+
+  private:
+    friend class Prefetch;
+    EventLoop *loop;
+    UpstreamPool *pool;
+    size_t tokens_per_tick;
+    size_t burst;
+    size_t tokens;
+    size_t max_held;
+    size_t held; // body bytes held by prefetches, running or done
+    unordered_map<string, Prefetch *> slots;
+    vector<Prefetch *> throttled;
+    PeriodicTimer refiller;
+    PeriodicTimer sweeper;
+
+    size_t grant(size_t want);
+    void refund(size_t unused);
+    void drop(Prefetch *p);
+    void refill();
+    void sweep();
+};
+
+#endif
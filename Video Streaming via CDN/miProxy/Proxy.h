@@ -0,0 +1,81 @@
+#ifndef _PROXY_H_
+#define _PROXY_H_
+
+#include "Abr.h"
+#include "BufferBudget.h"
+#include "Collapser.h"
+#include "Debug.h"
+#include "DiskCache.h"
+#include "DNSConnection.h"
+#include "EgressScheduler.h"
+#include "FragmentCache.h"
+#include "Log.h"
+#include "ManifestCache.h"
+#include "OriginSet.h"
+#include "Prefetcher.h"
+#include "ResolutionCache.h"
+#include "Resolver.h"
+#include "SessionStore.h"
+#include "SessionTable.h"
+#include "Stats.h"
+#include "UpstreamPool.h"
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+using std::string;
+using std::unordered_map;
+
+// What a fragment served from the cache tells the client's tracker.
+enum HitSample {
+    HIT_SAMPLE_MEASURE, // time the send, but only when the body outgrows the socket buffer
+    HIT_SAMPLE_EXCLUDE, // never, only origin fetches move the estimate
+};
+
+struct args_t {
+    uint16_t listen_port;
+
+    DNSConnection *dns;
+
+    float alpha;
+    const AbrPolicy *abr;
+    Log *log;
+    ManifestCache *manifests;
+    FragmentCache *fragments; // nullptr when disabled
+    DiskCache *disk;          // under fragments, nullptr unless --disk-cache
+    Collapser *collapser;     // nullptr when disabled
+    SessionStore *sessions;   // nullptr unless --session-file
+    HitSample hit_sample;
+    int prefetch_kbps; // prefetch budget across all workers, 0 turns prefetching off
+    int egress_kbps;   // browser-bound budget across all workers, 0 leaves sharing it to TCP
+    EgressWeight egress_weight;
+    size_t conn_buffer;  // bytes read ahead of one browser at most
+    size_t buffer_bytes; // held on the relay path across all workers
+
+    size_t session_bytes; // session table ceiling across all workers
+    int workers;
+    uint16_t admin_port; // 0 when off
+    std::vector<string> origins; // --origins, tried alongside whatever the nameserver says
+};
+
+struct state_t {
+    SessionTable *trackers;
+    ResolutionCache *dns;
+    OriginSet *origins;
+    UpstreamPool *pool;
+    Resolver *resolver;
+    Prefetcher *prefetch; // nullptr when off
+    EgressScheduler *egress; // nullptr when off
+    BufferBudget *buffers;
+    FollowerWakeup *followers;
+    DiskReads *disk_reads; // nullptr without --disk-cache
+    WorkerStats *stats;
+    // bodies closed connections sent with MSG_ZEROCOPY and never heard back about, oldest first
+    std::deque<std::pair<std::chrono::steady_clock::time_point, std::shared_ptr<const CachedFragment>>> zerocopy_held;
+};
+
+#endif
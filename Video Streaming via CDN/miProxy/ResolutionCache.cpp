@@ -0,0 +1,102 @@
+#include "ResolutionCache.h"
+#include "params.h"
+#include <algorithm>
+
+using std::chrono::milliseconds;
+using std::chrono::seconds;
+using std::chrono::steady_clock;
+
+ResolutionCache::ResolutionCache(Resolver *resolver, size_t max_clients) : resolver(resolver), max_clients(max_clients) {}
+
+ResolutionCache::Result ResolutionCache::lookup(uint32_t client, const string &name, string *ip) {
+    auto it = entries.find(client);
+    if (it == entries.end())
+        return MISS;
+    Entry &entry = it->second;
+    recent.splice(recent.begin(), recent, entry.recent);
+    auto now = steady_clock::now();
+    if (entry.negative)
+        return now < entry.expires ? NEGATIVE : MISS;
+    if (now >= entry.expires + milliseconds(DNS_MAX_STALE_MS))
+        return MISS; // too old to trust, wait for a fresh answer
+    *ip = entry.ip;
+    if (now >= entry.expires && !entry.refreshing)
+        refresh(client, entry, name);
+    return HIT;
+}
+
+void ResolutionCache::refresh(uint32_t client, Entry &entry, const string &name) {
+    entry.refreshing = true;
+    vector<uint32_t> &clients = refreshing[name];
+    clients.push_back(client);
+    if (clients.size() > 1)
+        return; // already asked, the answer updates everyone on the list
+    DNSAnswer answer;
+    if (resolver->resolve(name, this, &answer))
+        resolved(name, answer);
+}
+
+void ResolutionCache::resolved(const string &name, const DNSAnswer &answer) {
+    auto it = refreshing.find(name);
+    if (it == refreshing.end())
+        return;
+    vector<uint32_t> clients;
+    clients.swap(it->second);
+    refreshing.erase(it);
+    for (uint32_t client : clients) {
+        auto entry = entries.find(client);
+        if (entry == entries.end())
+            continue; // evicted meanwhile
+        entry->second.refreshing = false;
+        store(client, answer);
+    }
+}
+
+void ResolutionCache::store(uint32_t client, const DNSAnswer &answer) {
+    if (answer.rcode != 0 && answer.rcode != 3)
+        return; // no answer, keep what we had
+    auto it = entries.find(client);
+    if (it == entries.end()) {
+        if (entries.size() >= max_clients) {
+            // the least recently seen client goes; its refresh, if any, finds it gone
+            entries.erase(recent.back());
+            recent.pop_back();
+        }
+        recent.push_front(client);
+        Entry fresh;
+        fresh.refreshing = false;
+        fresh.recent = recent.begin();
+        it = entries.insert(std::make_pair(client, fresh)).first;
+    }
+    Entry &entry = it->second;
+    auto now = steady_clock::now();
+    if (answer.rcode == 3) {
+        entry.negative = true;
+        entry.ip.clear();
+        entry.expires = now + milliseconds(DNS_NEGATIVE_TTL_MS);
+    } else {
+        entry.negative = false;
+        entry.ip = answer.ip;
+        entry.expires = now + std::max(milliseconds(DNS_MIN_TTL_MS), milliseconds(seconds(answer.ttl)));
+    }
+}
+
+bool ResolutionCache::peek(uint32_t client, string *ip) const {
+    auto it = entries.find(client);
+    if (it == entries.end() || it->second.negative ||
+        steady_clock::now() >= it->second.expires + milliseconds(DNS_MAX_STALE_MS))
+        return false;
+    *ip = it->second.ip;
+    return true;
+}
+
+void ResolutionCache::restore(uint32_t client, const string &ip) {
+    if (entries.find(client) != entries.end())
+        return;
+    DNSAnswer answer;
+    answer.rcode = 0;
+    answer.ip = ip;
+    answer.ttl = 0;
+    store(client, answer);
+    entries[client].expires = steady_clock::now();
+}
@@ -0,0 +1,59 @@
+#ifndef _RESOLUTION_CACHE_H_
+#define _RESOLUTION_CACHE_H_
+
+#include "Resolver.h"
+#include <chrono>
+#include <list>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using std::list;
+using std::string;
+using std::unordered_map;
+using std::vector;
+
+/**
+ * Per-worker map from client (IPv4 address, host order) to the origin the nameserver
+ * picked for it, kept for the record's TTL (no less than DNS_MIN_TTL_MS). An expired
+ * answer is still used, for up to DNS_MAX_STALE_MS, while a refresh runs in the background,
+ * so a request only ever waits on the nameserver for a client it has no answer for at all.
+ * NXDOMAIN is remembered for DNS_NEGATIVE_TTL_MS. Past DNS_CACHE_MAX_CLIENTS the least
+ * recently seen client goes.
+ */
+class ResolutionCache : public ResolveWaiter {
+  public:
+    enum Result { MISS, HIT, NEGATIVE };
+
+    ResolutionCache(Resolver *resolver, size_t max_clients);
+    // HIT fills in ip; an expired HIT has started a refresh.
+    Result lookup(uint32_t client, const string &name, string *ip);
+    // A lookup for this client came back. Timeouts are not cached.
+    void store(uint32_t client, const DNSAnswer &answer);
+    // Background refreshes.
+    void resolved(const string &name, const DNSAnswer &answer) override;
+    // The answer held for client, fresh or stale, without counting as a use (snapshots).
+    bool peek(uint32_t client, string *ip) const;
+    // An answer saved before a restart: served, and refreshed, as if it had just expired.
+    void restore(uint32_t client, const string &ip);
+
+  private:
+    struct Entry {
+        string ip;
+        bool negative;
+        bool refreshing;
+        std::chrono::steady_clock::time_point expires;
+        list<uint32_t>::iterator recent;
+    };
+
+    Resolver *resolver;
+    size_t max_clients;
+    unordered_map<uint32_t, Entry> entries;
+    list<uint32_t> recent;                       // clients, most recently seen at the front
+    unordered_map<string, vector<uint32_t>> refreshing; // name -> clients a refresh will update
+
+    void refresh(uint32_t client, Entry &entry, const string &name);
+};
+
+#endif
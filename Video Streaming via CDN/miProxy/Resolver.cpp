@@ -0,0 +1,172 @@
+#include "Resolver.h"
+#include "params.h"
+#include <algorithm>
+#include <errno.h>
+
+using std::chrono::milliseconds;
+using std::chrono::steady_clock;
+
+static const uint32_t QUERY_EVENTS = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+
+static bool would_block() { return errno == EAGAIN || errno == EWOULDBLOCK; }
+
+DNSQuery::DNSQuery(Resolver *resolver, const string &name)
+    : resolver(resolver), name(name), fd(-1), id(0), attempts(0), connected(false), outoff(0) {}
+
+void DNSQuery::handle_event(uint32_t events) {
+    if (fd == -1)
+        return;
+    if (!connected) {
+        if (socket_connect_error(fd) != 0) {
+            retry_soon();
+            return;
+        }
+        struct sockaddr_in addr;
+        socklen_t len = sizeof(addr);
+        if (getpeername(fd, (struct sockaddr *)&addr, &len) == -1)
+            return;
+        connected = true;
+    }
+    if (!send_query())
+        return;
+
+    char buf[BUF_SIZE];
+    while (true) {
+        int len = recv(fd, buf, BUF_SIZE, 0);
+        if (len == -1 && would_block())
+            return;
+        if (len <= 0) {
+            retry_soon();
+            return;
+        }
+        inbuf.append(buf, len);
+        if (DNS::response_length(inbuf) > 0)
+            break;
+    }
+    uint16_t answer_id;
+    DNSAnswer answer = DNS::decode_response(inbuf, &answer_id);
+    if (answer_id != id) {
+        retry_soon(); // an answer to some other question, ask again
+        return;
+    }
+    resolver->complete(this, answer);
+}
+
+bool DNSQuery::send_query() {
+    while (outoff < outbuf.size()) {
+        int len = send(fd, outbuf.data() + outoff, outbuf.size() - outoff, MSG_NOSIGNAL);
+        if (len == -1) {
+            if (!would_block())
+                retry_soon();
+            return false;
+        }
+        outoff += len;
+    }
+    return true;
+}
+
+// This attempt is dead, don't wait out its deadline.
+void DNSQuery::retry_soon() {
+    close_socket();
+    deadline = steady_clock::now();
+}
+
+void DNSQuery::close_socket() {
+    if (fd == -1)
+        return;
+    resolver->loop->remove(fd);
+    socket_close(fd);
+    fd = -1;
+}
+
+Resolver::Resolver(EventLoop *loop, DNSConnection *dns)
+    : loop(loop), dns(dns), timer(loop, DNS_TICK_MS, [this]() { check_deadlines(); }) {}
+
+Resolver::~Resolver() {
+    for (auto &q : inflight) {
+        q.second->close_socket();
+        delete q.second;
+    }
+}
+
+bool Resolver::resolve(const string &name, ResolveWaiter *waiter, DNSAnswer *answer) {
+    if (dns->fixed(&answer->ip)) {
+        answer->rcode = 0;
+        answer->ttl = 0;
+        return true;
+    }
+    auto it = inflight.find(name);
+    if (it != inflight.end()) {
+        it->second->waiters.push_back(waiter);
+        return false;
+    }
+    DNSQuery *q = new DNSQuery(this, name);
+    q->waiters.push_back(waiter);
+    inflight[name] = q;
+    attempt(q);
+    return false;
+}
+
+void Resolver::cancel(const string &name, ResolveWaiter *waiter) {
+    auto it = inflight.find(name);
+    if (it == inflight.end())
+        return;
+    vector<ResolveWaiter *> &waiters = it->second->waiters;
+    waiters.erase(std::remove(waiters.begin(), waiters.end(), waiter), waiters.end());
+    // an unwanted query still runs to completion, its answer may be wanted again soon
+}
+
+/**
+ * @brief Send the query on a new connection with a new ID. A failure to even open the
+ * socket is left for the deadline check, like an attempt that went unanswered.
+ */
+bool Resolver::attempt(DNSQuery *q) {
+    DNS *server = static_cast<DNS *>(dns);
+    q->close_socket();
+    q->attempts++;
+    q->deadline = steady_clock::now() + milliseconds(DNS_TIMEOUT_MS);
+    q->id = server->next_id();
+    q->outbuf = DNS::encode_query(q->name, q->id);
+    q->outoff = 0;
+    q->inbuf.clear();
+    q->connected = false;
+    q->fd = make_sock_nonblocking(server->dns_ip.c_str(), server->dns_port);
+    if (q->fd == -1)
+        return false;
+    if (loop->add(q->fd, QUERY_EVENTS, q) == -1) {
+        socket_close(q->fd);
+        q->fd = -1;
+        return false;
+    }
+    return true;
+}
+
+void Resolver::complete(DNSQuery *q, const DNSAnswer &answer) {
+    q->close_socket();
+    inflight.erase(q->name);
+    // waiters may start new lookups from their callback, the query is out of the map by now
+    vector<ResolveWaiter *> waiters;
+    waiters.swap(q->waiters);
+    for (ResolveWaiter *w : waiters)
+        w->resolved(q->name, answer);
+    loop->retire(q);
+}
+
+void Resolver::check_deadlines() {
+    auto now = steady_clock::now();
+    vector<DNSQuery *> expired;
+    for (auto &q : inflight) {
+        if (q.second->deadline <= now)
+            expired.push_back(q.second);
+    }
+    for (DNSQuery *q : expired) {
+        if (q->attempts < DNS_ATTEMPTS) {
+            attempt(q);
+        } else {
+            DNSAnswer timeout;
+            timeout.rcode = -1;
+            timeout.ttl = 0;
+            complete(q, timeout);
+        }
+    }
+}
@@ -0,0 +1,79 @@
+#ifndef _RESOLVER_H_
+#define _RESOLVER_H_
+
+#include "DNSConnection.h"
+#include "EventLoop.h"
+#include <chrono>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using std::string;
+using std::unordered_map;
+using std::vector;
+
+class Resolver;
+
+// Someone waiting on a name.
+class ResolveWaiter {
+  public:
+    virtual void resolved(const string &name, const DNSAnswer &answer) = 0;
+    virtual ~ResolveWaiter() {}
+};
+
+// One name being looked up, however many are waiting on it.
+class DNSQuery : public EventHandler {
+  public:
+    DNSQuery(Resolver *resolver, const string &name);
+    void handle_event(uint32_t events) override;
+
+  private:
+    friend class Resolver;
+    Resolver *resolver;
+    string name;
+    vector<ResolveWaiter *> waiters;
+    int fd;
+    uint16_t id;
+    int attempts;
+    bool connected;
+    string outbuf;
+    size_t outoff;
+    string inbuf;
+    std::chrono::steady_clock::time_point deadline;
+
+    bool send_query();
+    void retry_soon();
+    void close_socket();
+};
+
+/**
+ * Per-worker asynchronous resolver on the worker's event loop. Queries are coalesced by
+ * name, so a burst of new clients costs one lookup, and each answer is matched to its
+ * query by ID. A query with no answer by its deadline is retried on a new connection,
+ * with a new ID, up to DNS_ATTEMPTS times; then its waiters get rcode -1.
+ * The nameserver answers one query per TCP connection and then closes it, so there is no
+ * long-lived socket to multiplex: each attempt is its own short non-blocking connection.
+ */
+class Resolver {
+  public:
+    Resolver(EventLoop *loop, DNSConnection *dns);
+    ~Resolver();
+    // True with the answer filled in if no query was needed, otherwise waiter is told later.
+    bool resolve(const string &name, ResolveWaiter *waiter, DNSAnswer *answer);
+    // The waiter is going away.
+    void cancel(const string &name, ResolveWaiter *waiter);
+
+  private:
+    friend class DNSQuery;
+    EventLoop *loop;
+    DNSConnection *dns;
+    unordered_map<string, DNSQuery *> inflight;
+    PeriodicTimer timer;
+
+    bool attempt(DNSQuery *q);
+    void complete(DNSQuery *q, const DNSAnswer &answer);
+    void check_deadlines();
+};
+
+#endif
@@ -0,0 +1,234 @@
+#include "SessionStore.h"
+#include "Proxy.h"
+#include "Worker.h"
+#include "params.h"
+#include <arpa/inet.h>
+#include <chrono>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+using std::lock_guard;
+using std::mutex;
+using std::unique_lock;
+using namespace std::chrono;
+
+static const char SESSION_MAGIC[8] = {'M', 'I', 'P', 'X', 'S', 'E', 'S', '1'};
+
+struct SessionHeader {
+    char magic[8];
+    uint64_t written_ns; // wall clock
+    uint32_t history;    // ABR_HISTORY of the writer, the record size depends on it
+    uint32_t count;
+};
+
+// One client, followed by ladder_len int32_t rungs.
+struct SessionRecord {
+    uint32_t client;  // network order
+    uint32_t origin;  // network order, 0 without a resolved origin
+    uint32_t idle_ms; // since the session's last fragment, when it was saved
+    int32_t last_bitrate;
+    double ewma;
+    float samples[ABR_HISTORY];
+    float buffer; // seconds, when it was saved
+    uint8_t nsamples;
+    uint8_t next_sample;
+    uint8_t pad;
+    uint8_t ladder_len;
+};
+
+static uint64_t wall_ns() { return duration_cast<nanoseconds>(system_clock::now().time_since_epoch()).count(); }
+
+SessionStore::SessionStore(const string &path, int workers)
+    : path(path), loaded_count(0), written_ns(0), restored_count(0), asks(workers, nullptr), shards(workers),
+      counts(workers, 0), versions(workers, 0), version(0), stopping(false) {
+    writer = std::thread([this]() { run(); });
+}
+
+SessionStore::~SessionStore() {
+    {
+        lock_guard<mutex> guard(lock);
+        stopping = true;
+    }
+    changed.notify_all();
+    writer.join();
+}
+
+void SessionStore::load() {
+    FILE *in = fopen(path.c_str(), "r");
+    if (!in)
+        return; // first run
+    SessionHeader head;
+    string body;
+    char buf[64 * 1024];
+    bool ok = fread(&head, sizeof(head), 1, in) == 1 && memcmp(head.magic, SESSION_MAGIC, sizeof(SESSION_MAGIC)) == 0 &&
+              head.history == ABR_HISTORY;
+    size_t n;
+    while (ok && (n = fread(buf, 1, sizeof(buf), in)) > 0)
+        body.append(buf, n);
+    fclose(in);
+    if (!ok) {
+        fprintf(stderr, "Warning: %s is not a session snapshot this proxy can read, starting without\n", path.c_str());
+        return;
+    }
+    loaded.swap(body);
+    loaded_count = head.count;
+    written_ns = head.written_ns;
+}
+
+void SessionStore::restore(size_t worker, size_t workers, args_t *args, state_t *state) {
+    uint64_t age_ms = (wall_ns() - std::min(written_ns, wall_ns())) / 1000000;
+    auto now = steady_clock::now();
+    size_t off = 0;
+    for (size_t i = 0; i < loaded_count && off + sizeof(SessionRecord) <= loaded.size(); i++) {
+        SessionRecord r;
+        memcpy(&r, loaded.data() + off, sizeof(r));
+        off += sizeof(r);
+        size_t ladder_bytes = r.ladder_len * sizeof(int32_t);
+        if (off + ladder_bytes > loaded.size())
+            break; // cut short, the rest is lost
+        vector<int> ladder(r.ladder_len);
+        for (size_t j = 0; j < r.ladder_len; j++) {
+            int32_t rung;
+            memcpy(&rung, loaded.data() + off + j * sizeof(rung), sizeof(rung));
+            ladder[j] = rung;
+        }
+        off += ladder_bytes;
+        if (shard_of(ntohl(r.client), workers) != worker || ladder.empty() ||
+            age_ms + r.idle_ms > (uint64_t)SESSION_MAX_AGE_S * 1000 || r.nsamples > ABR_HISTORY ||
+            r.next_sample >= ABR_HISTORY)
+            continue;
+
+        AbrSession session(AbrLadder(ladder), args->alpha);
+        memcpy(session.samples, r.samples, sizeof(session.samples));
+        session.nsamples = r.nsamples;
+        session.next_sample = r.next_sample;
+        session.ewma = r.ewma;
+        session.last_bitrate = r.last_bitrate;
+        // the player kept playing while we were down
+        session.buffer = std::max(0.f, r.buffer - (age_ms + r.idle_ms) / 1000.f);
+        session.last_delivery = now;
+        state->trackers->insert(ntohl(r.client), BitrateTracker(args->abr, session));
+        if (r.origin != 0) {
+            char origin[INET_ADDRSTRLEN];
+            inet_ntop(AF_INET, &r.origin, origin, sizeof(origin));
+            state->dns->restore(ntohl(r.client), origin);
+        }
+        restored_count++;
+    }
+}
+
+void SessionStore::save(size_t worker, const state_t &state) {
+    auto now = steady_clock::now();
+    string out;
+    size_t count = 0;
+    out.reserve(state.trackers->size() * (sizeof(SessionRecord) + 4 * sizeof(int32_t)));
+    state.trackers->for_each([&](uint32_t client, const BitrateTracker &tracker) {
+        const AbrSession &s = tracker.get_session();
+        auto idle = duration_cast<milliseconds>(now - s.last_delivery).count();
+        if (idle > (int64_t)SESSION_MAX_AGE_S * 1000)
+            return;
+        SessionRecord r;
+        memset(&r, 0, sizeof(r));
+        r.client = htonl(client);
+        string origin;
+        if (state.dns->peek(client, &origin))
+            inet_pton(AF_INET, origin.c_str(), &r.origin);
+        r.idle_ms = idle;
+        r.last_bitrate = s.last_bitrate;
+        r.ewma = s.ewma;
+        memcpy(r.samples, s.samples, sizeof(r.samples));
+        r.buffer = s.buffer;
+        r.nsamples = s.nsamples;
+        r.next_sample = s.next_sample;
+        r.ladder_len = s.ladder.size();
+        out.append((const char *)&r, sizeof(r));
+        for (size_t j = 0; j < r.ladder_len; j++) {
+            int32_t rung = s.ladder[j];
+            out.append((const char *)&rung, sizeof(rung));
+        }
+        count++;
+    });
+    {
+        lock_guard<mutex> guard(lock);
+        shards[worker].swap(out);
+        counts[worker] = count;
+        versions[worker] = ++version;
+    }
+    changed.notify_all();
+}
+
+void SessionStore::attach(size_t worker, Notifier *ask) {
+    lock_guard<mutex> guard(lock);
+    asks[worker] = ask;
+}
+
+void SessionStore::snapshot() {
+    lock_guard<mutex> snapshotting(snapshot_lock);
+    {
+        unique_lock<mutex> guard(lock);
+        uint64_t since = version;
+        for (Notifier *ask : asks) {
+            if (ask)
+                ask->notify();
+        }
+        // a worker stuck past the wait keeps its previous records in the file
+        changed.wait_for(guard, milliseconds(SESSION_SAVE_WAIT_MS), [this, since]() {
+            for (uint64_t v : versions) {
+                if (v <= since)
+                    return false;
+            }
+            return true;
+        });
+    }
+    write_file();
+}
+
+size_t SessionStore::saved() {
+    lock_guard<mutex> guard(lock);
+    size_t total = 0;
+    for (size_t c : counts)
+        total += c;
+    return total;
+}
+
+void SessionStore::run() {
+    while (true) {
+        {
+            unique_lock<mutex> guard(lock);
+            if (changed.wait_for(guard, milliseconds(SESSION_SNAPSHOT_MS), [this]() { return stopping; }))
+                return;
+        }
+        snapshot();
+    }
+}
+
+// Called with snapshot_lock held.
+void SessionStore::write_file() {
+    SessionHeader head;
+    memcpy(head.magic, SESSION_MAGIC, sizeof(SESSION_MAGIC));
+    head.written_ns = wall_ns();
+    head.history = ABR_HISTORY;
+    head.count = 0;
+    string body;
+    {
+        lock_guard<mutex> guard(lock);
+        for (size_t i = 0; i < shards.size(); i++) {
+            body += shards[i];
+            head.count += counts[i];
+        }
+    }
+
+    string tmp = path + ".tmp";
+    FILE *out = fopen(tmp.c_str(), "w");
+    bool ok = out && fwrite(&head, sizeof(head), 1, out) == 1 &&
+              (body.empty() || fwrite(body.data(), body.size(), 1, out) == 1) && fflush(out) == 0 &&
+              fsync(fileno(out)) == 0;
+    if (out)
+        ok = fclose(out) == 0 && ok;
+    if (!ok || rename(tmp.c_str(), path.c_str()) == -1) {
+        perror(("Error writing session snapshot " + path).c_str());
+        unlink(tmp.c_str());
+    }
+}
@@ -0,0 +1,69 @@
+#ifndef _SESSION_STORE_H_
+#define _SESSION_STORE_H_
+
+#include "EventLoop.h"
+#include <condition_variable>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+struct state_t;
+struct args_t;
+
+/**
+ * ABR sessions (and the origin each client was resolved to) saved to one binary file, so
+ * a restarted proxy picks up every viewer at the bitrate it had reached instead of the
+ * bottom rung:
+ *   "MIPXSES1", written (wall clock ns), ABR_HISTORY, record count,
+ *   then per client a fixed record followed by its ladder (host byte order, like the
+ *   binary chunk log)
+ * Every SESSION_SNAPSHOT_MS, and once more on SIGTERM, the store's thread asks every
+ * worker to encode its own shard on its own thread (save), waits for them and replaces
+ * the file (write to <file>.tmp, rename), so a crash mid-write leaves the last snapshot.
+ * At startup each worker takes back the clients it owns now (restore), whatever the
+ * worker count was before; sessions idle for over SESSION_MAX_AGE_S are dropped.
+ */
+class SessionStore {
+  public:
+    SessionStore(const string &path, int workers);
+    ~SessionStore();
+    // Read what the last run left. Nothing (and no complaint) if there is no file.
+    void load();
+    // A worker's state: restore before the worker starts, save on its thread when ask fires.
+    void restore(size_t worker, size_t workers, args_t *args, state_t *state);
+    void attach(size_t worker, Notifier *ask);
+    void save(size_t worker, const state_t &state);
+    // Ask every worker, wait for their saves (up to SESSION_SAVE_WAIT_MS), write the file.
+    void snapshot();
+
+    size_t restored() const { return restored_count; }
+    size_t saved();
+
+  private:
+    string path;
+    string loaded;         // the file as read, records only
+    size_t loaded_count;
+    uint64_t written_ns;   // when the loaded file was written
+    size_t restored_count; // written once per worker before the workers start
+
+    std::mutex lock;
+    std::condition_variable changed;
+    vector<Notifier *> asks;   // per worker
+    vector<string> shards;     // every worker's latest records
+    vector<size_t> counts;     // ... and how many there are
+    vector<uint64_t> versions; // bumped by every save
+    uint64_t version;          // of the newest save
+    bool stopping;
+    std::mutex snapshot_lock;  // one snapshot at a time
+    std::thread writer;
+
+    void run();
+    void write_file();
+};
+
+#endif
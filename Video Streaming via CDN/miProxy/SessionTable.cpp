@@ -0,0 +1,132 @@
+#include "SessionTable.h"
+#include "params.h"
+#include <algorithm>
+#include <chrono>
+
+using std::chrono::seconds;
+using std::chrono::steady_clock;
+
+SessionTable::SessionTable(size_t max_bytes, WorkerStats *stats) : count(0), hand(0), stats(stats) {
+    max_slots = SESSION_TABLE_MIN_SLOTS;
+    while (max_slots * 2 * sizeof(Slot) <= max_bytes)
+        max_slots *= 2;
+    slots.resize(SESSION_TABLE_MIN_SLOTS);
+    mask = slots.size() - 1;
+}
+
+// All of a worker's clients agree in the bits shard_of looks at, so every bit is mixed in
+// (murmur3's finalizer) before the low ones are taken.
+size_t SessionTable::home(uint32_t client) const {
+    uint32_t h = client;
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+    return h & mask;
+}
+
+BitrateTracker *SessionTable::find(uint32_t client) {
+    for (size_t i = home(client);; i = (i + 1) & mask) {
+        if (slots[i].client == client) {
+            slots[i].referenced = true;
+            return &slots[i].tracker;
+        }
+        if (slots[i].client == 0)
+            return nullptr;
+    }
+}
+
+BitrateTracker *SessionTable::insert(uint32_t client, const BitrateTracker &tracker) {
+    size_t i = home(client);
+    while (slots[i].client != 0 && slots[i].client != client)
+        i = (i + 1) & mask;
+    if (slots[i].client == 0) {
+        // keep probes short: past 3/4 full the table grows, or at the ceiling someone goes
+        if ((count + 1) * 4 > slots.size() * 3) {
+            if (slots.size() < max_slots)
+                grow();
+            else
+                evict_one();
+            return insert(client, tracker);
+        }
+        slots[i].client = client;
+        count++;
+        stats->sessions.add(1);
+    }
+    slots[i].referenced = true;
+    slots[i].tracker = tracker;
+    return &slots[i].tracker;
+}
+
+void SessionTable::grow() {
+    vector<Slot> old(slots.size() * 2);
+    old.swap(slots);
+    mask = slots.size() - 1;
+    hand = 0;
+    for (const Slot &slot : old) {
+        if (slot.client == 0)
+            continue;
+        size_t i = home(slot.client);
+        while (slots[i].client != 0)
+            i = (i + 1) & mask;
+        slots[i] = slot;
+    }
+}
+
+/**
+ * @brief CLOCK: a session looked up since the hand last came by gets another round, the
+ * first one that wasn't goes. Ends within one turn of the hand.
+ */
+void SessionTable::evict_one() {
+    while (true) {
+        Slot &slot = slots[hand];
+        if (slot.client != 0 && !slot.referenced) {
+            erase_at(hand); // whatever moved into hand is looked at next
+            stats->sessions_evicted.add(1);
+            return;
+        }
+        slot.referenced = false;
+        hand = (hand + 1) & mask;
+    }
+}
+
+// The hand goes round once every SESSION_SWEEP_PASS_S however big the table is.
+void SessionTable::sweep() {
+    auto now = steady_clock::now();
+    size_t n = slots.size() * SESSION_SWEEP_MS / (SESSION_SWEEP_PASS_S * 1000) + 1;
+    while (n-- > 0 && count > 0) {
+        Slot &slot = slots[hand];
+        if (slot.client != 0 && !slot.referenced &&
+            now - slot.tracker.get_session().last_delivery > seconds(SESSION_IDLE_S)) {
+            erase_at(hand);
+            stats->sessions_expired.add(1);
+            continue;
+        }
+        slot.referenced = false;
+        hand = (hand + 1) & mask;
+    }
+}
+
+/**
+ * @brief Empty slot i without leaving a hole in anyone's probe sequence: later entries of
+ * the run move back into the gap unless their home slot lies cyclically in (i, j].
+ */
+void SessionTable::erase_at(size_t i) {
+    size_t j = i;
+    while (true) {
+        j = (j + 1) & mask;
+        if (slots[j].client == 0)
+            break;
+        size_t h = home(slots[j].client);
+        bool stays = i <= j ? (i < h && h <= j) : (i < h || h <= j);
+        if (!stays) {
+            slots[i] = slots[j];
+            i = j;
+        }
+    }
+    slots[i].client = 0;
+    slots[i].referenced = false;
+    count--;
+    stats->sessions.add(-1);
+}
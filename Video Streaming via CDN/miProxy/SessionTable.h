@@ -0,0 +1,85 @@
+#ifndef _SESSION_TABLE_H_
+#define _SESSION_TABLE_H_
+
+#include "Abr.h"
+#include "Debug.h"
+#include "Stats.h"
+#include <stdint.h>
+#include <vector>
+
+using std::vector;
+
+// One client's ABR session, decided by whichever policy --abr picked.
+class BitrateTracker {
+  public:
+    BitrateTracker() : policy(nullptr) {} // an empty SessionTable slot
+    BitrateTracker(const AbrPolicy *policy, double alpha, vector<int> avaliable_bitrates)
+        : policy(policy), session(AbrLadder(avaliable_bitrates), alpha) {}
+    // A session saved before a restart, see SessionStore.
+    BitrateTracker(const AbrPolicy *policy, const AbrSession &session) : policy(policy), session(session) {}
+    // A fragment at this bitrate went out at tput kbps.
+    void update(double tput, int bitrate) {
+        policy->update(session, tput);
+        session.delivered(bitrate);
+        DEBUG_OUT("@@@@@ Header:\n" << session.alpha << " " << tput << " " << session.ewma << " @@@@@");
+    }
+    // A fragment went out too fast to say anything about the client's bandwidth.
+    void delivered(int bitrate) { session.delivered(bitrate); }
+    double get_tput() { return session.ewma; }
+    int get_bitrate() { return policy->choose(session); }
+    const AbrSession &get_session() const { return session; }
+
+  private:
+    const AbrPolicy *policy;
+    AbrSession session;
+};
+
+/**
+ * A worker's sessions, keyed by the client's IPv4 address (host order; 0.0.0.0 marks a
+ * free slot). Open addressing with linear probing over flat slots, so a lookup hashes one
+ * integer and touches one or two cache lines. The slot array doubles while it is under
+ * 3/4 full, up to the most slots max_bytes holds; from there a new client takes the place
+ * of the first session the CLOCK hand finds unused since its last pass. The hand also
+ * moves on its own (sweep), dropping sessions idle for over SESSION_IDLE_S.
+ * A tracker pointer is good until the next insert or sweep.
+ */
+class SessionTable {
+  public:
+    SessionTable(size_t max_bytes, WorkerStats *stats);
+    // nullptr if the client has no session
+    BitrateTracker *find(uint32_t client);
+    // The client's session, replaced by tracker if it already had one.
+    BitrateTracker *insert(uint32_t client, const BitrateTracker &tracker);
+    // Advance the hand over a share of the slots, every SESSION_SWEEP_MS.
+    void sweep();
+
+    // Every session, in no particular order; f(client, tracker) must not change the table.
+    template <class F> void for_each(F f) const {
+        for (const Slot &slot : slots) {
+            if (slot.client != 0)
+                f(slot.client, slot.tracker);
+        }
+    }
+    size_t size() const { return count; }
+
+  private:
+    struct Slot {
+        uint32_t client;
+        bool referenced; // looked up since the hand last passed
+        BitrateTracker tracker;
+    };
+
+    vector<Slot> slots;
+    size_t mask;
+    size_t max_slots;
+    size_t count;
+    size_t hand;
+    WorkerStats *stats;
+
+    size_t home(uint32_t client) const;
+    void grow();
+    void evict_one();
+    void erase_at(size_t i);
+};
+
+#endif
@@ -1,5 +1,8 @@
 
 #include "Socket.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/filter.h>
 
 /**
  * @brief Open, configure, and bind socket.
@@ -26,6 +29,58 @@ int socket_init(int port = 0) {
     return fd;
 }
 
+/**
+ * @brief Like socket_init, but several sockets can bind the same port (SO_REUSEPORT)
+ * and the kernel spreads incoming connections over them.
+ */
+int socket_init_shared(int port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd == -1) {
+        perror("Error opening stream socket");
+        return -1;
+    }
+
+    int reuse = 1;
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) == -1 ||
+        setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse)) == -1) {
+        perror("Error setting socket option 'Reuse'");
+        close(fd);
+        return -1;
+    }
+    struct sockaddr_in addr;
+    makeSockAddr(&addr, port);
+
+    if (bind(fd, (sockaddr *)&addr, sizeof(addr)) == -1) {
+        perror("Error binding stream socket");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * @brief Pick the socket in a SO_REUSEPORT group by a hash of the client's IPv4 address,
+ * so every connection from one client lands on the same socket (sockets are numbered in
+ * bind order). Must agree with shard_of. Without it the kernel hashes the whole 4-tuple.
+ */
+int socket_steer_by_source(int fd, int groups) {
+    struct sock_filter code[] = {
+        {BPF_LD | BPF_W | BPF_ABS, 0, 0, (uint32_t)(SKF_NET_OFF + 12)}, // A = ip saddr
+        {BPF_ALU | BPF_MUL | BPF_K, 0, 0, SHARD_HASH_MULT},
+        {BPF_ALU | BPF_RSH | BPF_K, 0, 0, 16},
+        {BPF_ALU | BPF_MOD | BPF_K, 0, 0, (uint32_t)groups},
+        {BPF_RET | BPF_A, 0, 0, 0},
+    };
+    struct sock_fprog prog;
+    prog.len = sizeof(code) / sizeof(code[0]);
+    prog.filter = code;
+    if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) == -1) {
+        perror("Error attaching reuseport steering");
+        return -1;
+    }
+    return 0;
+}
+
 int socket_recv(int fd, void *buf, size_t max_len) {
     int len = recv(fd, buf, max_len, 0);
     if (len == -1) {
@@ -130,20 +185,70 @@ int make_sock(const char *hostname, int port) {
     int sockfd = socket(AF_INET, SOCK_STREAM, 0);
     if (sockfd < 0) {
         perror("socket");
-        exit(-1);
+        return -1;
     }
     struct sockaddr_in serv_addr;
     if (make_sockaddr(&serv_addr, hostname, port) < 0) {
-        exit(-1);
+        close(sockfd);
+        return -1;
     }
     if (connect(sockfd, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0) {
         perror("connect");
-        exit(-1);
+        close(sockfd);
+        return -1;
     }
     return sockfd;
 }
 int make_sock(host_t host) { return make_sock(host.hostname, host.port); }
 
+int socket_set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+        perror("Error setting socket non-blocking");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Start a non-blocking connect to a dotted-quad ip.
+ * Returns the fd with the connect in progress (wait for it to become writable, then check
+ * socket_connect_error), or -1 on failure. Never exits, unlike make_sock.
+ */
+int make_sock_nonblocking(const char *ip, int port) {
+    struct sockaddr_in serv_addr;
+    memset(&serv_addr, 0, sizeof(serv_addr));
+    serv_addr.sin_family = AF_INET;
+    serv_addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, ip, &serv_addr.sin_addr) != 1) {
+        fprintf(stderr, "%s: not an ip address\n", ip);
+        return -1;
+    }
+    int sockfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (sockfd < 0) {
+        perror("socket");
+        return -1;
+    }
+    if (connect(sockfd, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0 && errno != EINPROGRESS) {
+        perror("connect");
+        close(sockfd);
+        return -1;
+    }
+    return sockfd;
+}
+
+/**
+ * @brief Result of a non-blocking connect, 0 if it succeeded.
+ */
+int socket_connect_error(int fd) {
+    int err = 0;
+    socklen_t len = sizeof(err);
+    if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) == -1) {
+        return errno;
+    }
+    return err;
+}
+
 std::string get_ip_addr(int fd) {
 
     struct sockaddr_in addr;
@@ -15,6 +15,8 @@
 #include <unistd.h>     // close()
 
 int socket_init(int);
+int socket_init_shared(int);
+int socket_steer_by_source(int, int);
 int socket_recv(int, void *, size_t);
 int socket_recv_all(int, void *, size_t);
 int socket_send(int, const void *, size_t);
@@ -38,6 +40,11 @@ int make_sockaddr(struct sockaddr_in *, const char *, int);
 int make_sock(const char *, int);
 int make_sock(host_t);
 
+// Non-blocking helpers for the event loop
+int socket_set_nonblocking(int);
+int make_sock_nonblocking(const char *, int);
+int socket_connect_error(int);
+
 std::string get_ip_addr(int);
 
 struct socket_raii {
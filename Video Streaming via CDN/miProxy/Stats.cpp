@@ -0,0 +1,114 @@
+#include "Stats.h"
+
+using std::memory_order_relaxed;
+using std::chrono::duration_cast;
+using std::chrono::microseconds;
+using std::chrono::steady_clock;
+
+static void bump(std::atomic<uint64_t> &a, uint64_t n) {
+    a.store(a.load(memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+LatencyHistogram::LatencyHistogram() : total(0), sum(0), max(0) {
+    for (int i = 0; i < HIST_BUCKETS; i++)
+        counts[i].store(0, memory_order_relaxed);
+}
+
+int LatencyHistogram::bucket(uint64_t value) {
+    if (value < (uint64_t)HIST_SUB_BUCKETS)
+        return value;
+    int exp = 63 - __builtin_clzll(value);
+    int sub = (value >> (exp - HIST_SUB_BITS)) & (HIST_SUB_BUCKETS - 1);
+    return (exp - HIST_SUB_BITS + 1) * HIST_SUB_BUCKETS + sub;
+}
+
+uint64_t LatencyHistogram::bucket_floor(int bucket) {
+    if (bucket < HIST_SUB_BUCKETS)
+        return bucket;
+    int exp = bucket / HIST_SUB_BUCKETS + HIST_SUB_BITS - 1;
+    uint64_t sub = bucket % HIST_SUB_BUCKETS;
+    return (HIST_SUB_BUCKETS + sub) << (exp - HIST_SUB_BITS);
+}
+
+void LatencyHistogram::record(uint64_t us) {
+    bump(counts[bucket(us)], 1);
+    bump(total, 1);
+    bump(sum, us);
+    if (us > max.load(memory_order_relaxed))
+        max.store(us, memory_order_relaxed);
+}
+
+void LatencyHistogram::record(steady_clock::time_point from, steady_clock::time_point to) {
+    int64_t us = duration_cast<microseconds>(to - from).count();
+    record(us > 0 ? (uint64_t)us : 0);
+}
+
+HistogramSnapshot::HistogramSnapshot() : total(0), sum(0), max(0) {
+    for (int i = 0; i < HIST_BUCKETS; i++)
+        counts[i] = 0;
+}
+
+void HistogramSnapshot::add(const LatencyHistogram &h) {
+    for (int i = 0; i < HIST_BUCKETS; i++)
+        counts[i] += h.counts[i].load(memory_order_relaxed);
+    // the buckets were read one at a time, so count what was read rather than h.total
+    total = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++)
+        total += counts[i];
+    sum += h.sum.load(memory_order_relaxed);
+    uint64_t m = h.max.load(memory_order_relaxed);
+    if (m > max)
+        max = m;
+}
+
+uint64_t HistogramSnapshot::percentile(double p) const {
+    if (total == 0)
+        return 0;
+    uint64_t rank = (uint64_t)(p * total);
+    if (rank >= total)
+        rank = total - 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        seen += counts[i];
+        if (seen > rank)
+            return LatencyHistogram::bucket_floor(i);
+    }
+    return max;
+}
+
+const char *phase_name(Phase phase) {
+    switch (phase) {
+    case PHASE_HEADER:
+        return "header";
+    case PHASE_DNS:
+        return "dns";
+    case PHASE_CONNECT:
+        return "connect";
+    case PHASE_FIRST_BYTE:
+        return "first_byte";
+    case PHASE_LAST_BYTE:
+        return "last_byte";
+    default:
+        return "?";
+    }
+}
+
+WorkerStats::WorkerStats() {
+    for (int i = 0; i < STATS_BITRATES; i++)
+        chunk_bitrates[i].store(0, memory_order_relaxed);
+}
+
+void WorkerStats::chunk(int bitrate) {
+    for (int i = 0; i < STATS_BITRATES; i++) {
+        int b = chunk_bitrates[i].load(memory_order_relaxed);
+        if (b == 0) {
+            chunk_bitrates[i].store(bitrate, memory_order_relaxed);
+            b = bitrate;
+        }
+        if (b == bitrate) {
+            chunks[i].add(1);
+            return;
+        }
+    }
+    chunks_other.add(1);
+}
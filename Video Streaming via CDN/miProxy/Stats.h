@@ -0,0 +1,104 @@
+#ifndef _STATS_H_
+#define _STATS_H_
+
+#include <atomic>
+#include <chrono>
+#include <stdint.h>
+#include <string>
+
+using std::string;
+
+/**
+ * Instrumentation shared between a worker, which is the only thread that ever writes its
+ * stats, and the admin thread, which reads everyone's whenever asked. With a single
+ * writer an increment is a relaxed load and store, no locked instruction, and a reader
+ * at worst sees a count one event behind.
+ */
+class Counter {
+  public:
+    Counter() : v(0) {}
+    void add(int64_t n) { v.store(v.load(std::memory_order_relaxed) + n, std::memory_order_relaxed); }
+    int64_t get() const { return v.load(std::memory_order_relaxed); }
+
+  private:
+    std::atomic<int64_t> v;
+};
+
+// Log-linear buckets, HDR histogram style: values below HIST_SUB_BUCKETS are exact, above
+// that every power of two is cut into HIST_SUB_BUCKETS, so a bucket is within 1/16 of
+// any value in it, whatever the scale.
+static const int HIST_SUB_BITS = 4;
+static const int HIST_SUB_BUCKETS = 1 << HIST_SUB_BITS;
+static const int HIST_BUCKETS = (64 - HIST_SUB_BITS + 1) * HIST_SUB_BUCKETS;
+
+class LatencyHistogram {
+  public:
+    LatencyHistogram();
+    void record(uint64_t us);
+    void record(std::chrono::steady_clock::time_point from, std::chrono::steady_clock::time_point to);
+
+    static int bucket(uint64_t value);
+    static uint64_t bucket_floor(int bucket);
+
+  private:
+    friend struct HistogramSnapshot;
+    std::atomic<uint64_t> counts[HIST_BUCKETS];
+    std::atomic<uint64_t> total;
+    std::atomic<uint64_t> sum;
+    std::atomic<uint64_t> max;
+};
+
+// Histograms from several workers added together, for reading.
+struct HistogramSnapshot {
+    uint64_t counts[HIST_BUCKETS];
+    uint64_t total;
+    uint64_t sum;
+    uint64_t max;
+
+    HistogramSnapshot();
+    void add(const LatencyHistogram &h);
+    // lowest value of the bucket holding the p-th fraction of samples, 0 when empty
+    uint64_t percentile(double p) const;
+};
+
+// Phases of one request, all in microseconds:
+//   header      accept (or the first byte of a follow-on request) -> request header complete
+//   dns         waiting for the nameserver, when the answer wasn't cached
+//   connect     waiting for an origin connection, pooled ones included
+//   first_byte  header complete -> first response byte handed to the browser
+//   last_byte   header complete -> last response byte handed to the browser
+enum Phase { PHASE_HEADER, PHASE_DNS, PHASE_CONNECT, PHASE_FIRST_BYTE, PHASE_LAST_BYTE, PHASES };
+const char *phase_name(Phase phase);
+
+// Chunks served per bitrate. The ladder is short, the first STATS_BITRATES bitrates seen
+// get a slot and anything after that is counted in chunks_other.
+static const int STATS_BITRATES = 16;
+
+struct WorkerStats {
+    LatencyHistogram phases[PHASES];
+    Counter connections; // browser connections open right now
+    Counter accepted;
+    Counter requests;
+    Counter failed;        // answered 502
+    Counter failovers;     // requests moved to another origin
+    Counter buffered_bytes; // held on the relay path right now
+    Counter buffer_waits;   // reads held back for the buffer budget
+    Counter bytes_relayed; // to browsers, headers included
+    Counter zerocopy_sends;  // MSG_ZEROCOPY sends of cache hits
+    Counter zerocopy_copied; // ... that the kernel copied after all, turning it off for their connection
+    Counter fragment_hits; // served from the fragment cache
+    Counter prefetch_hits; // served from this worker's prefetches
+    Counter manifest_hits; // served from the manifest cache without asking the origin
+    Counter collapsed;     // followed another request's fetch of the same fragment
+    Counter sessions;          // in the session table right now
+    Counter sessions_evicted;  // to make room for a new client
+    Counter sessions_expired;  // idle for over SESSION_IDLE_S
+    std::atomic<int> chunk_bitrates[STATS_BITRATES]; // 0 for a free slot
+    Counter chunks[STATS_BITRATES];
+    Counter chunks_other;
+
+    WorkerStats();
+    void chunk(int bitrate);
+};
+
+#endif
@@ -0,0 +1,77 @@
+#include "TcpInfo.h"
+#include "params.h"
+#include <algorithm>
+#include <linux/tcp.h> // the libc tcp_info stops short of delivery_rate
+#include <netinet/in.h>
+#include <stddef.h>
+#include <sys/socket.h>
+
+using std::max;
+using std::min;
+
+// Whether the kernel filled in the struct up to and including field.
+#define HAS_FIELD(len, field) ((len) >= offsetof(struct tcp_info, field) + sizeof(((struct tcp_info *)0)->field))
+
+static bool tcp_info(int fd, struct tcp_info *info, socklen_t *len) {
+    *len = sizeof(*info);
+    return getsockopt(fd, IPPROTO_TCP, TCP_INFO, info, len) == 0;
+}
+
+TcpRateEstimator::TcpRateEstimator()
+    : client_rate(0), client_limited_rate(0), cwnd_rate(0), upstream_rate(0), retrans_start(0), retrans(0),
+      sent_start(0), sent(0), mss(0) {}
+
+void TcpRateEstimator::start(int client_fd) {
+    *this = TcpRateEstimator();
+    struct tcp_info info;
+    socklen_t len;
+    if (!tcp_info(client_fd, &info, &len))
+        return;
+    retrans_start = retrans = info.tcpi_total_retrans;
+    if (HAS_FIELD(len, tcpi_bytes_sent))
+        sent_start = sent = info.tcpi_bytes_sent;
+}
+
+void TcpRateEstimator::sample_client(int client_fd) {
+    struct tcp_info info;
+    socklen_t len;
+    if (!tcp_info(client_fd, &info, &len))
+        return;
+    retrans = info.tcpi_total_retrans;
+    mss = info.tcpi_snd_mss;
+    if (HAS_FIELD(len, tcpi_bytes_sent))
+        sent = info.tcpi_bytes_sent;
+    if (info.tcpi_rtt > 0)
+        cwnd_rate = max(cwnd_rate, (double)info.tcpi_snd_cwnd * info.tcpi_snd_mss * 1000000 / info.tcpi_rtt);
+    if (HAS_FIELD(len, tcpi_delivery_rate) && info.tcpi_delivery_rate > 0) {
+        if (info.tcpi_delivery_rate_app_limited)
+            client_limited_rate = max(client_limited_rate, (double)info.tcpi_delivery_rate);
+        else
+            client_rate = max(client_rate, (double)info.tcpi_delivery_rate);
+    }
+}
+
+void TcpRateEstimator::sample_upstream(int upstream_fd) {
+    struct tcp_info info;
+    socklen_t len;
+    if (!tcp_info(upstream_fd, &info, &len) || info.tcpi_rcv_rtt == 0)
+        return;
+    upstream_rate = (double)info.tcpi_rcv_space * 1000000 / info.tcpi_rcv_rtt;
+}
+
+double TcpRateEstimator::estimate() const {
+    double rate = client_rate;
+    // an app-limited rate or a window only says something once the fragment could fill
+    // it; a small one goes out in one burst and measures the loopback, not the client
+    if (rate == 0 && sent - sent_start >= (uint64_t)TCPINFO_SAMPLE_BYTES)
+        rate = client_limited_rate > 0 ? client_limited_rate : cwnd_rate;
+    if (rate == 0)
+        return 0;
+    if (sent > sent_start && retrans > retrans_start) {
+        double lost = (double)(retrans - retrans_start) * mss / (sent - sent_start);
+        rate *= 1 - min(lost, 0.5);
+    }
+    if (upstream_rate > 0)
+        rate = min(rate, upstream_rate);
+    return rate / 125.; // bytes/s -> kbps
+}
@@ -0,0 +1,44 @@
+#ifndef _TCP_INFO_H_
+#define _TCP_INFO_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Throughput estimate for one fragment from the kernel's TCP_INFO instead of a stopwatch.
+ *   client leg:   delivery_rate (bytes acked per interval, as BBR measures it) on the
+ *                 browser socket, sampled during the relay. Samples taken while the socket
+ *                 was app-limited only bound the rate from below; the congestion window
+ *                 over RTT stands in when the kernel has no delivery rate. Neither counts
+ *                 for a fragment under TCPINFO_SAMPLE_BYTES (the stopwatch decides).
+ *                 Retransmitted bytes are taken off in proportion.
+ *   upstream leg: rcv_space / rcv_rtt on the origin socket, the receiver's own measure of
+ *                 what the origin delivers per round trip (origin fetches only).
+ * The sample is the slower leg. With small fragments the wall clock is mostly the request's
+ * round trip; these stay put, because they come from every ACK the connection has seen.
+ */
+class TcpRateEstimator {
+  public:
+    TcpRateEstimator();
+    // A new fragment is about to go out on client_fd.
+    void start(int client_fd);
+    void sample_client(int client_fd);
+    void sample_upstream(int upstream_fd);
+    // kbps, 0 if the kernel told us nothing usable
+    double estimate() const;
+    // The client leg was measured while not app-limited, the estimate is not a lower bound.
+    bool bandwidth_limited() const { return client_rate > 0; }
+
+  private:
+    double client_rate;         // bytes/s, best non app-limited delivery rate
+    double client_limited_rate; // bytes/s, best app-limited delivery rate
+    double cwnd_rate;           // bytes/s, snd_cwnd * mss / rtt
+    double upstream_rate;       // bytes/s, 0 when not fetched from the origin
+    uint32_t retrans_start;
+    uint32_t retrans;
+    uint64_t sent_start;
+    uint64_t sent;
+    uint32_t mss;
+};
+
+#endif
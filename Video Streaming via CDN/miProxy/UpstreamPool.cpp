@@ -0,0 +1,149 @@
+#include "UpstreamPool.h"
+#include "Socket.h"
+#include "params.h"
+#include <algorithm>
+
+using std::chrono::duration;
+using std::chrono::milliseconds;
+using std::chrono::steady_clock;
+
+static const uint32_t UPSTREAM_EVENTS = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+
+UpstreamConn::UpstreamConn(int fd, string origin, UpstreamPool *pool)
+    : fd(fd), origin(origin), owner(nullptr), requests(0), last_used(steady_clock::now()), opened(last_used),
+      connecting(true), timed_out(false), pool(pool) {}
+
+void UpstreamConn::handle_event(uint32_t events) {
+    if (fd == -1)
+        return;
+    if (connecting && (events & (EPOLLOUT | EPOLLERR | EPOLLHUP)))
+        pool->connect_done(this, !(events & (EPOLLERR | EPOLLHUP)));
+    if (owner) {
+        owner->handle_event(events);
+    } else if (events & (EPOLLIN | EPOLLRDHUP | EPOLLERR | EPOLLHUP)) {
+        pool->evict(this);
+    }
+}
+
+UpstreamPool::UpstreamPool(EventLoop *loop, OriginSet *origins, size_t max_idle_per_origin, int idle_timeout_ms)
+    : loop(loop), origins(origins), max_idle_per_origin(max_idle_per_origin), idle_timeout_ms(idle_timeout_ms),
+      sweeper(loop, 1000, [this]() { sweep(); }),
+      connect_timer(loop, ORIGIN_CONNECT_TICK_MS, [this]() { expire_connects(); }) {}
+
+UpstreamPool::~UpstreamPool() {
+    for (auto &origin : idle) {
+        for (UpstreamConn *conn : origin.second) {
+            socket_close(conn->fd);
+            delete conn;
+        }
+    }
+}
+
+UpstreamConn *UpstreamPool::acquire(const string &origin, EventHandler *owner, bool fresh) {
+    UpstreamConn *conn = nullptr;
+    auto it = idle.find(origin);
+    if (!fresh && it != idle.end() && !it->second.empty()) {
+        conn = it->second.back();
+        it->second.pop_back();
+    } else {
+        conn = open(origin);
+    }
+    if (conn)
+        conn->owner = owner;
+    return conn;
+}
+
+void UpstreamPool::release(UpstreamConn *conn, bool reusable) {
+    conn->owner = nullptr;
+    deque<UpstreamConn *> &conns = idle[conn->origin];
+    if (!reusable || conns.size() >= max_idle_per_origin) {
+        destroy(conn);
+        return;
+    }
+    conn->requests++;
+    conn->last_used = steady_clock::now();
+    conns.push_back(conn);
+}
+
+void UpstreamPool::preconnect(const string &origin) {
+    deque<UpstreamConn *> &conns = idle[origin];
+    if (!conns.empty())
+        return;
+    UpstreamConn *conn = open(origin);
+    if (conn)
+        conns.push_back(conn);
+}
+
+UpstreamConn *UpstreamPool::open(const string &origin) {
+    int fd = make_sock_nonblocking(origin.c_str(), 80);
+    if (fd == -1)
+        return nullptr;
+    UpstreamConn *conn = new UpstreamConn(fd, origin, this);
+    if (loop->add(fd, UPSTREAM_EVENTS, conn) == -1) {
+        socket_close(fd);
+        delete conn;
+        return nullptr;
+    }
+    connecting.push_back(conn);
+    return conn;
+}
+
+void UpstreamPool::connect_done(UpstreamConn *conn, bool ok) {
+    conn->connecting = false;
+    connecting.erase(std::find(connecting.begin(), connecting.end(), conn));
+    if (ok)
+        origins->connected(conn->origin, duration<double, std::milli>(steady_clock::now() - conn->opened).count());
+}
+
+/**
+ * @brief Give up on connects past their deadline. The owner sees timed_out when it looks
+ * at the connection again; an idle spare just goes.
+ */
+void UpstreamPool::expire_connects() {
+    auto cutoff = steady_clock::now() - milliseconds(ORIGIN_CONNECT_TIMEOUT_MS);
+    vector<UpstreamConn *> expired;
+    while (!connecting.empty() && connecting.front()->opened < cutoff) {
+        expired.push_back(connecting.front());
+        connecting.front()->connecting = false;
+        connecting.front()->timed_out = true;
+        connecting.erase(connecting.begin());
+    }
+    for (UpstreamConn *conn : expired) {
+        if (conn->owner)
+            conn->owner->handle_event(EPOLLERR);
+        else
+            evict(conn);
+    }
+}
+
+/**
+ * @brief Drop an idle connection the origin gave up on.
+ */
+void UpstreamPool::evict(UpstreamConn *conn) {
+    deque<UpstreamConn *> &conns = idle[conn->origin];
+    auto it = std::find(conns.begin(), conns.end(), conn);
+    if (it != conns.end())
+        conns.erase(it);
+    destroy(conn);
+}
+
+void UpstreamPool::destroy(UpstreamConn *conn) {
+    if (conn->connecting) {
+        conn->connecting = false;
+        connecting.erase(std::find(connecting.begin(), connecting.end(), conn));
+    }
+    socket_close(conn->fd);
+    conn->fd = -1;
+    loop->retire(conn);
+}
+
+void UpstreamPool::sweep() {
+    auto cutoff = steady_clock::now() - milliseconds(idle_timeout_ms);
+    for (auto &origin : idle) {
+        deque<UpstreamConn *> &conns = origin.second;
+        while (!conns.empty() && conns.front()->last_used < cutoff) {
+            destroy(conns.front());
+            conns.pop_front();
+        }
+    }
+}
@@ -0,0 +1,78 @@
+#ifndef _UPSTREAM_POOL_H_
+#define _UPSTREAM_POOL_H_
+
+#include "EventLoop.h"
+#include "OriginSet.h"
+#include <chrono>
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using std::deque;
+using std::string;
+using std::unordered_map;
+using std::vector;
+
+class UpstreamPool;
+
+/**
+ * A keep-alive connection to one origin. While checked out, its events go to owner;
+ * while idle in the pool, any event other than writability means the origin closed it
+ * (or sent something unsolicited) and it is evicted.
+ * A connect that takes longer than ORIGIN_CONNECT_TIMEOUT_MS is given up on: timed_out is
+ * set and the owner gets an EPOLLERR.
+ */
+class UpstreamConn : public EventHandler {
+  public:
+    int fd;
+    string origin;
+    EventHandler *owner;
+    int requests; // requests completed on this connection, 0 if it is fresh
+    std::chrono::steady_clock::time_point last_used;
+    std::chrono::steady_clock::time_point opened;
+    bool connecting; // no writability (or error) seen yet
+    bool timed_out;
+
+    UpstreamConn(int fd, string origin, UpstreamPool *pool);
+    void handle_event(uint32_t events) override;
+
+  private:
+    UpstreamPool *pool;
+};
+
+class UpstreamPool {
+  public:
+    // Connect times go to origins.
+    UpstreamPool(EventLoop *loop, OriginSet *origins, size_t max_idle_per_origin, int idle_timeout_ms);
+    ~UpstreamPool();
+    // A warm idle connection if there is one, else a new one that may still be connecting.
+    // nullptr if a new socket could not be opened.
+    UpstreamConn *acquire(const string &origin, EventHandler *owner, bool fresh = false);
+    // Hand a connection back. Only reusable if the response was read exactly to its end
+    // and the origin did not ask to close.
+    void release(UpstreamConn *conn, bool reusable);
+    // Open a spare connection to the origin in the background if it has none idle.
+    void preconnect(const string &origin);
+
+  private:
+    friend class UpstreamConn;
+    EventLoop *loop;
+    OriginSet *origins;
+    size_t max_idle_per_origin;
+    int idle_timeout_ms;
+    // most recently used at the back
+    unordered_map<string, deque<UpstreamConn *>> idle;
+    PeriodicTimer sweeper;
+    vector<UpstreamConn *> connecting; // oldest first
+    PeriodicTimer connect_timer;
+
+    UpstreamConn *open(const string &origin);
+    void connect_done(UpstreamConn *conn, bool ok);
+    void expire_connects();
+    void evict(UpstreamConn *conn);
+    void destroy(UpstreamConn *conn);
+    void sweep();
+};
+
+#endif
@@ -0,0 +1,125 @@
+#include "Worker.h"
+#include "Connection.h"
+#include "Socket.h"
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+
+static bool would_block() { return errno == EAGAIN || errno == EWOULDBLOCK; }
+
+size_t shard_of(uint32_t client_addr, size_t shards) {
+    // same arithmetic as the steering program: 32 bit multiply, keep the high half
+    uint32_t h = client_addr * SHARD_HASH_MULT;
+    return (h >> 16) % shards;
+}
+
+Listener::Listener(int fd, Worker *worker) : fd(fd), worker(worker) {}
+
+void Listener::handle_event(uint32_t events) {
+    while (true) {
+        struct sockaddr_in addr;
+        socklen_t len = sizeof(addr);
+        int confd = accept4(fd, (struct sockaddr *)&addr, &len, SOCK_NONBLOCK);
+        if (confd == -1) {
+            if (errno == EINTR)
+                continue;
+            if (!would_block())
+                perror("Error accepting connection");
+            return;
+        }
+        worker->accepted(confd, addr);
+    }
+}
+
+Handoff::Handoff(Worker *worker) : worker(worker) {
+    if (pipe2(pipefd, O_NONBLOCK) == -1) {
+        perror("Error creating handoff pipe");
+        exit(-1);
+    }
+}
+
+Handoff::~Handoff() {
+    close(pipefd[0]);
+    close(pipefd[1]);
+}
+
+/**
+ * @brief Called from another worker's thread. A message is far below PIPE_BUF, so the
+ * write is atomic and needs no lock.
+ */
+void Handoff::send(int confd, const struct sockaddr_in &addr) {
+    message m;
+    m.fd = confd;
+    m.addr = addr;
+    if (write(pipefd[1], &m, sizeof(m)) != sizeof(m)) {
+        perror("Error handing off connection");
+        socket_close(confd);
+    }
+}
+
+void Handoff::handle_event(uint32_t events) {
+    message m;
+    while (read(pipefd[0], &m, sizeof(m)) == sizeof(m)) {
+        worker->adopt(m.fd, m.addr);
+    }
+}
+
+Worker::Worker(size_t id, int listen_fd, args_t *args, vector<Worker *> *workers)
+    : id(id), args(args), workers(workers), origins(args->origins),
+      pool(&loop, &origins, POOL_MAX_IDLE_PER_ORIGIN, POOL_IDLE_TIMEOUT_MS),
+      resolver(&loop, args->dns), resolutions(&resolver, DNS_CACHE_MAX_CLIENTS), followers(&loop),
+      trackers(args->session_bytes / args->workers, &stats),
+      sweep(&loop, SESSION_SWEEP_MS, [this]() { trackers.sweep(); }),
+      listener(listen_fd, this), handoff(this) {
+    state.trackers = &trackers;
+    state.origins = &origins;
+    state.pool = &pool;
+    state.resolver = &resolver;
+    state.dns = &resolutions;
+    state.stats = &stats;
+    prefetch = nullptr;
+    if (args->prefetch_kbps > 0) {
+        // the budget is split evenly, clients are spread evenly over the workers
+        prefetch = new Prefetcher(&loop, &pool, std::max(1, args->prefetch_kbps / args->workers),
+                                  (size_t)PREFETCH_MAX_HELD_MB << 20);
+    }
+    state.prefetch = prefetch;
+    egress = nullptr;
+    if (args->egress_kbps > 0)
+        egress = new EgressScheduler(&loop, std::max(1, args->egress_kbps / args->workers), args->egress_weight);
+    state.egress = egress;
+    buffers = new BufferBudget(&loop, args->buffer_bytes / args->workers, &stats);
+    state.buffers = buffers;
+    state.followers = &followers;
+    disk_reads = args->disk ? new DiskReads(&loop, args->disk) : nullptr;
+    state.disk_reads = disk_reads;
+    save_sessions = nullptr;
+    if (args->sessions) {
+        args->sessions->restore(id, args->workers, args, &state);
+        save_sessions = new Notifier(&loop, [this]() { this->args->sessions->save(this->id, state); });
+        args->sessions->attach(id, save_sessions);
+    }
+    loop.add(listen_fd, EPOLLIN | EPOLLET, &listener);
+    loop.add(handoff.read_fd(), EPOLLIN | EPOLLET, &handoff);
+}
+
+void Worker::start() {
+    thread = std::thread([this]() { loop.run(); });
+}
+
+void Worker::join() { thread.join(); }
+
+void Worker::accepted(int confd, const struct sockaddr_in &addr) {
+    size_t owner = shard_of(ntohl(addr.sin_addr.s_addr), workers->size());
+    if (owner == id) {
+        adopt(confd, addr);
+    } else {
+        (*workers)[owner]->handoff.send(confd, addr);
+    }
+}
+
+void Worker::adopt(int confd, const struct sockaddr_in &addr) {
+    char ip[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &addr.sin_addr, ip, INET_ADDRSTRLEN);
+    new Connection(confd, ip, ntohl(addr.sin_addr.s_addr), &loop, args, &state);
+}
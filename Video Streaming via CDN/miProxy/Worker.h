@@ -0,0 +1,98 @@
+#ifndef _WORKER_H_
+#define _WORKER_H_
+
+#include "BufferBudget.h"
+#include "Collapser.h"
+#include "DiskCache.h"
+#include "EgressScheduler.h"
+#include "EventLoop.h"
+#include "OriginSet.h"
+#include "Prefetcher.h"
+#include "ResolutionCache.h"
+#include "Resolver.h"
+#include "Proxy.h"
+#include "Stats.h"
+#include "UpstreamPool.h"
+#include <netinet/in.h>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+
+using std::vector;
+
+class Worker;
+
+// Which worker owns a client. Must agree with the steering program in socket_steer_by_source.
+size_t shard_of(uint32_t client_addr, size_t shards);
+
+// Accepts new browsers on this worker's SO_REUSEPORT socket.
+class Listener : public EventHandler {
+  public:
+    Listener(int fd, Worker *worker);
+    void handle_event(uint32_t events) override;
+
+  private:
+    int fd;
+    Worker *worker;
+};
+
+// Connections another worker accepted for one of our clients, passed over a pipe.
+class Handoff : public EventHandler {
+  public:
+    Handoff(Worker *worker);
+    ~Handoff();
+    void send(int confd, const struct sockaddr_in &addr);
+    int read_fd() { return pipefd[0]; }
+    void handle_event(uint32_t events) override;
+
+  private:
+    struct message {
+        int fd;
+        struct sockaddr_in addr;
+    };
+    int pipefd[2];
+    Worker *worker;
+};
+
+/**
+ * One event loop on one thread with its own listen socket, upstream pool and state shard.
+ * A client's tracker and DNS answer live in exactly one worker (shard_of its address), so
+ * nothing on the request path is shared between threads. The kernel steers each client
+ * to its owner's socket; anything that arrives elsewhere is handed to the owner.
+ */
+class Worker {
+  public:
+    Worker(size_t id, int listen_fd, args_t *args, vector<Worker *> *workers);
+    void start();
+    void join();
+    // A browser connected; serve it here or pass it to the worker that owns it.
+    void accepted(int confd, const struct sockaddr_in &addr);
+    void adopt(int confd, const struct sockaddr_in &addr);
+    // Read from the admin thread while this worker keeps writing it.
+    const WorkerStats &get_stats() const { return stats; }
+
+  private:
+    size_t id;
+    args_t *args;
+    vector<Worker *> *workers;
+    EventLoop loop;
+    OriginSet origins;
+    UpstreamPool pool;
+    Resolver resolver;
+    ResolutionCache resolutions;
+    Prefetcher *prefetch;
+    EgressScheduler *egress;
+    BufferBudget *buffers;
+    FollowerWakeup followers;
+    DiskReads *disk_reads; // nullptr without --disk-cache
+    Notifier *save_sessions; // nullptr unless --session-file
+    WorkerStats stats;
+    SessionTable trackers;
+    PeriodicTimer sweep;
+    state_t state;
+    Listener listener;
+    Handoff handoff;
+    std::thread thread;
+};
+
+#endif
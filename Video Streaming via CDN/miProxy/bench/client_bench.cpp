@@ -0,0 +1,160 @@
+// Connection-count benchmark: n clients on one epoll loop, each asking the proxy for
+// fragment after fragment as fast as the answers come, for a fixed time. Reports
+// completed fragments per second and the latency percentiles of each request.
+//   make client_bench && ./client_bench <proxy-port> <clients> <seconds> [--close]
+// With --close every request opens a new connection, otherwise they are kept alive.
+// bench/connection_bench.sh runs it against a proxy and bench/origin.py.
+#include <algorithm>
+#include <arpa/inet.h>
+#include <chrono>
+#include <errno.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+using std::string;
+using std::vector;
+using std::chrono::duration;
+using std::chrono::steady_clock;
+
+struct Client {
+    int fd;
+    string out;
+    size_t off;
+    string in;
+    steady_clock::time_point sent;
+    int frag;
+};
+
+static int port;
+static bool keep_alive = true;
+static int epfd;
+static vector<double> latencies; // seconds
+static long errors = 0;
+
+static void close_client(Client &c) {
+    epoll_ctl(epfd, EPOLL_CTL_DEL, c.fd, nullptr);
+    close(c.fd);
+    c.fd = -1;
+}
+
+// Queue the client's next request, connecting first if it has no connection.
+static void next_request(Client &c) {
+    if (c.fd == -1) {
+        c.fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        connect(c.fd, (struct sockaddr *)&addr, sizeof(addr));
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+        ev.data.ptr = &c;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, c.fd, &ev);
+    }
+    char req[128];
+    snprintf(req, sizeof(req), "GET /vod/1000Seg1-Frag%d HTTP/1.1\r\nHost: localhost\r\n\r\n", c.frag++);
+    c.out = req;
+    c.off = 0;
+    c.in.clear();
+    c.sent = steady_clock::now();
+}
+
+static void failed(Client &c) {
+    errors++;
+    close_client(c);
+    next_request(c);
+}
+
+// Whether c.in holds a whole response (the proxy always answers with a Content-Length).
+static bool complete(const Client &c) {
+    size_t head_end = c.in.find("\r\n\r\n");
+    if (head_end == string::npos)
+        return false;
+    const char *cl = strcasestr(c.in.c_str(), "\r\nContent-Length:");
+    if (!cl || cl > c.in.c_str() + head_end)
+        return false;
+    return c.in.size() >= head_end + 4 + strtoul(cl + 17, nullptr, 10);
+}
+
+// Edge-triggered: send and read until EAGAIN, going straight on to the next request when
+// a response is complete, its socket won't be reported writable again.
+static void on_event(Client &c) {
+    while (true) {
+        while (c.off < c.out.size()) {
+            ssize_t n = send(c.fd, c.out.data() + c.off, c.out.size() - c.off, MSG_NOSIGNAL);
+            if (n == -1) {
+                if (errno == EAGAIN || errno == ENOTCONN)
+                    break; // still connecting, EPOLLOUT says when
+                failed(c);
+                return;
+            }
+            c.off += n;
+        }
+        char buf[65536];
+        ssize_t n;
+        while ((n = recv(c.fd, buf, sizeof(buf), 0)) > 0) {
+            c.in.append(buf, n);
+            if (complete(c))
+                break;
+        }
+        if (n > 0) {
+            latencies.push_back(duration<double>(steady_clock::now() - c.sent).count());
+            if (!keep_alive) {
+                close_client(c);
+                next_request(c);
+                return; // a new connection, its EPOLLOUT comes once connected
+            }
+            next_request(c);
+            continue;
+        }
+        if (n == -1 && errno == EAGAIN)
+            return;
+        failed(c);
+        return;
+    }
+}
+
+int main(int argc, char **argv) {
+    if (argc < 4) {
+        fprintf(stderr, "usage: %s <proxy-port> <clients> <seconds> [--close]\n", argv[0]);
+        return 1;
+    }
+    port = atoi(argv[1]);
+    int nclients = atoi(argv[2]);
+    double seconds = atof(argv[3]);
+    keep_alive = !(argc > 4 && strcmp(argv[4], "--close") == 0);
+
+    epfd = epoll_create1(0);
+    vector<Client> clients(nclients); // never resized, the epoll data points into it
+    for (Client &c : clients) {
+        c.fd = -1;
+        c.frag = 1;
+        next_request(c);
+    }
+    auto end = steady_clock::now() + duration<double>(seconds);
+    struct epoll_event events[1024];
+    while (steady_clock::now() < end) {
+        int n = epoll_wait(epfd, events, 1024, 100);
+        for (int i = 0; i < n; i++)
+            on_event(*(Client *)events[i].data.ptr);
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+    size_t done = latencies.size();
+    if (done == 0) {
+        printf("clients %d: no completions, %ld errors\n", nclients, errors);
+        return 1;
+    }
+    printf("clients %d: %zu done, %.0f req/s, p50 %.2f ms, p99 %.2f ms, max %.2f ms, %ld errors\n", nclients, done,
+           done / seconds, latencies[done / 2] * 1e3, latencies[done * 99 / 100] * 1e3, latencies[done - 1] * 1e3,
+           errors);
+    return 0;
+}
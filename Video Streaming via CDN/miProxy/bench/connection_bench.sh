@@ -0,0 +1,28 @@
+#!/bin/bash
+# Fragment latency at 1k and 10k clients: bench/origin.py on :80, the proxy on :8888
+# with --nodns, and client_bench driving it for BENCH_SECONDS (10) per client count.
+#   make miProxy client_bench && sudo bench/connection_bench.sh [proxy-binary] [clients...]
+# Run from miProxy/. The proxy binary defaults to ./miProxy; give another build (the old
+# select() proxy, say) to compare. Port 80 needs root, 10k clients a hard fd limit above 10k.
+set -e
+cd "$(dirname "$0")/.."
+PROXY=${1:-./miProxy}
+shift || true
+CLIENTS=${@:-1000 10000}
+SECONDS_PER_RUN=${BENCH_SECONDS:-10}
+LOG=$(mktemp)
+
+ulimit -n "$(ulimit -Hn)" # as far as we are allowed
+python3 bench/origin.py 80 &
+ORIGIN=$!
+trap 'kill $ORIGIN $PROXY_PID 2>/dev/null; rm -f $LOG' EXIT
+sleep 0.5
+
+for n in $CLIENTS; do
+    "$PROXY" --nodns 8888 127.0.0.1 0.5 "$LOG" > /dev/null &
+    PROXY_PID=$!
+    sleep 0.5
+    ./client_bench 8888 "$n" "$SECONDS_PER_RUN" || true
+    kill $PROXY_PID
+    wait $PROXY_PID 2>/dev/null || true
+done
@@ -0,0 +1,85 @@
+#!/usr/bin/env python3
+# Stand-in origin for the benchmarks: keep-alive HTTP/1.1 on 127.0.0.1:<port>, serving
+#   *.f4m                  a manifest with a 10/100/500/1000 kbps ladder (ETag, 304s)
+#   *_nolist.f4m           the player's manifest
+#   /<br>Seg<s>-Frag<f>    br * 250 bytes of one letter (2 s of video at br kbps)
+#   anything else          a small html page
+#   python3 bench/origin.py 80 [--chunked] [--close] [--trickle]
+import argparse
+import asyncio
+import re
+
+LADDER = [10, 100, 500, 1000]
+MANIFEST = ('<?xml version="1.0"?>\n<manifest>\n' +
+            ''.join('<media url="%d" bitrate="%d" />\n' % (b, b) for b in LADDER) + '</manifest>\n').encode()
+NOLIST = b'<?xml version="1.0"?>\n<manifest nolist="1">\n</manifest>\n'
+CHUNK = 1000
+
+parser = argparse.ArgumentParser()
+parser.add_argument('port', type=int)
+parser.add_argument('--chunked', action='store_true', help='send fragments chunked instead of by length')
+parser.add_argument('--close', action='store_true', help='close the connection after every response')
+parser.add_argument('--trickle', action='store_true', help='send fragment bodies in 10 pieces, 30 ms apart')
+args = parser.parse_args()
+
+
+def body_for(path):
+    if path.endswith('_nolist.f4m'):
+        return NOLIST
+    if path.endswith('.f4m'):
+        return MANIFEST
+    m = re.search(r'/(\d+)Seg(\d+)-Frag(\d+)$', path)
+    if m:
+        return bytes([65 + int(m.group(3)) % 26]) * (int(m.group(1)) * 250)
+    return b'<html>index</html>'
+
+
+async def respond(w, path, head, keep_alive):
+    body = body_for(path)
+    close = b'' if keep_alive else b'Connection: close\r\n'
+    if path.endswith('.f4m'):
+        if b'If-None-Match: "v1"' in head:
+            w.write(b'HTTP/1.1 304 Not Modified\r\nETag: "v1"\r\nCache-Control: max-age=2\r\n' + close + b'\r\n')
+        else:
+            w.write(b'HTTP/1.1 200 OK\r\nContent-Length: %d\r\nETag: "v1"\r\nCache-Control: max-age=2\r\n%s\r\n%s' %
+                    (len(body), close, body))
+    elif args.chunked and 'Frag' in path:
+        out = [b'HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n' + close + b'\r\n']
+        for i in range(0, len(body), CHUNK):
+            piece = body[i:i + CHUNK]
+            out.append(b'%x\r\n%s\r\n' % (len(piece), piece))
+        out.append(b'0\r\n\r\n')
+        w.write(b''.join(out))
+    else:
+        w.write(b'HTTP/1.1 200 OK\r\nContent-Length: %d\r\nContent-Type: text/plain\r\n%s\r\n' % (len(body), close))
+        if args.trickle and 'Frag' in path:
+            step = max(1, len(body) // 10)
+            for i in range(0, len(body), step):
+                await asyncio.sleep(0.03)
+                w.write(body[i:i + step])
+                await w.drain()
+        else:
+            w.write(body)
+    await w.drain()
+
+
+async def handle(r, w):
+    try:
+        while True:
+            head = await r.readuntil(b'\r\n\r\n')
+            path = head.split(b'\r\n')[0].split(b' ')[1].decode()
+            keep_alive = not args.close and b'Connection: close' not in head
+            await respond(w, path, head, keep_alive)
+            if not keep_alive:
+                break
+    except (asyncio.IncompleteReadError, ConnectionError):
+        pass
+    w.close()
+
+
+async def main():
+    server = await asyncio.start_server(handle, '127.0.0.1', args.port, backlog=4096)
+    await server.serve_forever()
+
+
+asyncio.run(main())
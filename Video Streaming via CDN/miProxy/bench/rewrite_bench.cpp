@@ -0,0 +1,193 @@
+// Microbenchmark for the head rewrites. Origin requests: the string helpers route_request
+// used to chain (switch_host, set_connection, parseseg_frag, switch_endpoint, a substr for
+// the cache key; kept below as they were) against RequestRewriter. Response heads: a
+// set_connection copy per exchange against set_connection in place in a reused buffer.
+// Counts heap allocations by replacing operator new, and checks the results match.
+//   make rewrite_bench && ./rewrite_bench [iterations]
+#include "../Http.h"
+#include <chrono>
+#include <new>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using std::chrono::duration_cast;
+using std::chrono::nanoseconds;
+using std::chrono::steady_clock;
+
+static size_t allocations = 0;
+
+void *operator new(size_t size) {
+    allocations++;
+    void *p = malloc(size ? size : 1);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+
+static const char REQUEST[] = "GET /vod/1000Seg2-Frag37 HTTP/1.1\r\n"
+                              "Host: localhost:8888\r\n"
+                              "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:102.0) Gecko/20100101 Firefox/102.0\r\n"
+                              "Accept: */*\r\n"
+                              "Accept-Language: en-US,en;q=0.5\r\n"
+                              "Accept-Encoding: gzip, deflate\r\n"
+                              "Connection: close\r\n"
+                              "Referer: http://localhost:8888/StrobeMediaPlayback.swf\r\n"
+                              "\r\n";
+
+static const char RESPONSE[] = "HTTP/1.1 200 OK\r\n"
+                               "Date: Tue, 18 Oct 2022 10:00:00 GMT\r\n"
+                               "Server: Apache/2.4.54 (Ubuntu)\r\n"
+                               "Last-Modified: Mon, 17 Oct 2022 09:00:00 GMT\r\n"
+                               "Content-Length: 20000\r\n"
+                               "Connection: close\r\n"
+                               "Content-Type: video/f4f\r\n"
+                               "\r\n";
+
+static volatile size_t sink;
+
+// The request helpers as route_request used them.
+static pair<int, int> parseseg_frag(const string &s) {
+    size_t spos = s.find("Seg");
+    size_t fpos = s.find("Frag");
+    if (spos == string::npos || fpos == string::npos) {
+        return std::make_pair(0, 0);
+    }
+    return std::make_pair(atoi(s.c_str() + spos + 3), atoi(s.c_str() + fpos + 4));
+}
+
+static string switch_host(string header, string newHost) {
+    size_t hoststart = header.find("Host: ") + 6;
+    header.erase(hoststart, header.find("\r\n", hoststart) - hoststart);
+    header.insert(hoststart, newHost);
+    return header;
+}
+
+static string switch_endpoint(string header, int bitrate, int seg, int frag) {
+    size_t spos = header.find("Seg") + 3;
+    size_t endpos = header.rfind("/", spos) + 1;
+    size_t endend = header.find(" ", endpos);
+    char name[48];
+    int len = snprintf(name, sizeof(name), "%dSeg%d-Frag%d", bitrate, seg, frag);
+    return header.replace(endpos, endend - endpos, name, len);
+}
+
+// set_connection as it was, a copy in and a copy out.
+static string copy_set_connection(string header, const string &value) {
+    set_connection(header, value.c_str());
+    return header;
+}
+
+struct Result {
+    double ns;
+    double allocs;
+};
+
+static Result legacy(const string &request, const string &origin, long iterations) {
+    size_t before = allocations;
+    auto start = steady_clock::now();
+    for (long i = 0; i < iterations; i++) {
+        string header = copy_set_connection(switch_host(request, origin), "keep-alive");
+        pair<int, int> seg = parseseg_frag("/vod/1000Seg2-Frag37");
+        header = switch_endpoint(header, 500, seg.first, seg.second);
+        string key = origin + " " + header.substr(0, header.find("\r\n"));
+        sink += header.size() + key.size();
+    }
+    double ns = duration_cast<nanoseconds>(steady_clock::now() - start).count();
+    return Result{ns / iterations, (double)(allocations - before) / iterations};
+}
+
+static Result rewriter(const string &request, const string &origin, long iterations) {
+    RequestRewriter rewrite;
+    string key;
+    key.reserve(128); // a connection's key keeps its capacity between requests
+    struct iovec iov[REWRITE_MAX_IOV];
+    size_t before = allocations;
+    auto start = steady_clock::now();
+    for (long i = 0; i < iterations; i++) {
+        rewrite.parse(request.data(), request.size());
+        rewrite.set_host(origin);
+        pair<int, int> seg = rewrite.fragment();
+        rewrite.set_fragment(500, seg.first, seg.second);
+        key.assign(origin);
+        key += ' ';
+        rewrite.request_line(key);
+        int n = rewrite.iov(0, iov);
+        sink += n + rewrite.length() + key.size();
+    }
+    double ns = duration_cast<nanoseconds>(steady_clock::now() - start).count();
+    return Result{ns / iterations, (double)(allocations - before) / iterations};
+}
+
+static Result response_copy(const string &response, size_t head_len, long iterations) {
+    string outbuf;
+    size_t before = allocations;
+    auto start = steady_clock::now();
+    for (long i = 0; i < iterations; i++) {
+        outbuf = copy_set_connection(response.substr(0, head_len), "keep-alive");
+        outbuf.append(response, head_len, string::npos);
+        sink += outbuf.size();
+    }
+    double ns = duration_cast<nanoseconds>(steady_clock::now() - start).count();
+    return Result{ns / iterations, (double)(allocations - before) / iterations};
+}
+
+static Result response_in_place(const string &response, size_t head_len, long iterations) {
+    string outbuf;
+    outbuf.reserve(1024); // a connection's outbuf keeps its capacity between exchanges
+    size_t before = allocations;
+    auto start = steady_clock::now();
+    for (long i = 0; i < iterations; i++) {
+        outbuf.assign(response, 0, head_len);
+        set_connection(outbuf, "keep-alive");
+        outbuf.append(response, head_len, string::npos);
+        sink += outbuf.size();
+    }
+    double ns = duration_cast<nanoseconds>(steady_clock::now() - start).count();
+    return Result{ns / iterations, (double)(allocations - before) / iterations};
+}
+
+int main(int argc, char **argv) {
+    long iterations = argc > 1 ? atol(argv[1]) : 1000000;
+    string request = REQUEST;
+    string origin = "10.0.0.1";
+
+    string expected = switch_endpoint(copy_set_connection(switch_host(request, origin), "keep-alive"), 500, 2, 37);
+    RequestRewriter rewrite;
+    rewrite.parse(request.data(), request.size());
+    rewrite.set_host(origin);
+    rewrite.set_fragment(500, 2, 37);
+    if (rewrite.str() != expected || rewrite.length() != expected.size()) {
+        fprintf(stderr, "rewritten requests differ:\n%s\n---\n%s\n", expected.c_str(), rewrite.str().c_str());
+        return 1;
+    }
+    // every resume point of a partial send must give back the rest of the same bytes
+    for (size_t skip = 0; skip < expected.size(); skip++) {
+        struct iovec iov[REWRITE_MAX_IOV];
+        int n = rewrite.iov(skip, iov);
+        string rest;
+        for (int i = 0; i < n; i++)
+            rest.append((const char *)iov[i].iov_base, iov[i].iov_len);
+        if (rest != expected.substr(skip)) {
+            fprintf(stderr, "iov(%zu) is wrong\n", skip);
+            return 1;
+        }
+    }
+
+    string response = RESPONSE;
+    response.append(64, 'v'); // the start of the body, read along with the head
+    size_t head_len = strlen(RESPONSE);
+
+    Result a = legacy(request, origin, iterations);
+    Result b = rewriter(request, origin, iterations);
+    Result c = response_copy(response, head_len, iterations);
+    Result d = response_in_place(response, head_len, iterations);
+    printf("%-16s %10s %14s\n", "", "ns/head", "allocs/head");
+    printf("%-16s %10.1f %14.2f\n", "string helpers", a.ns, a.allocs);
+    printf("%-16s %10.1f %14.2f\n", "RequestRewriter", b.ns, b.allocs);
+    printf("%-16s %10.1f %14.2f\n", "response copy", c.ns, c.allocs);
+    printf("%-16s %10.1f %14.2f\n", "response reused", d.ns, d.allocs);
+    return b.allocs == 0 && d.allocs == 0 ? 0 : 1;
+}
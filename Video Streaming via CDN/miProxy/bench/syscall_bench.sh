@@ -0,0 +1,63 @@
+#!/bin/bash
+# Socket syscalls per fragment and proxy CPU per Gbit served, as quoted for the batched
+# sends: bench/origin.py on :80, the proxy on :8888 under bench/syscall_count.c, and
+# ../loadgen players running ahead of playback so most fragments are cache hits.
+#   make miProxy syscall_count.so && (cd ../loadgen && make)
+#   sudo bench/syscall_bench.sh [proxy-options...]     e.g. --workers 2
+# Run from miProxy/. PLAYERS (10) and BENCH_SECONDS (8) size the measured run; a 3 s run
+# first fills the cache. CPU is the proxy's utime + stime from /proc/<pid>/stat.
+set -e
+cd "$(dirname "$0")/.."
+LOADGEN=../loadgen/loadgen
+PLAYERS=${PLAYERS:-10}
+SECONDS_PER_RUN=${BENCH_SECONDS:-8}
+COUNTS=$(mktemp)
+LOG=$(mktemp)
+
+python3 bench/origin.py 80 &
+ORIGIN=$!
+trap 'kill $ORIGIN $PROXY_PID 2>/dev/null; rm -f $COUNTS $LOG' EXIT
+sleep 0.5
+LD_PRELOAD=./syscall_count.so SYSCALL_COUNTS=$COUNTS ./miProxy "$@" --nodns 8888 127.0.0.1 0.5 "$LOG" > /dev/null &
+PROXY_PID=$!
+sleep 0.5
+
+players() {
+    "$LOADGEN" --players "$PLAYERS" --duration "$1" --max-buffer 100000 --source 127.2.0.1 127.0.0.1 8888
+}
+# The counters, then the CPU ticks, on one line.
+snapshot() {
+    kill -USR2 $PROXY_PID
+    sleep 0.2
+    echo "$(cat $COUNTS) cpu $(awk '{ print $14 + $15 }' /proc/$PROXY_PID/stat)"
+}
+
+players 3 > /dev/null
+BEFORE=$(snapshot)
+RUN=$(players "$SECONDS_PER_RUN")
+AFTER=$(snapshot)
+
+echo "$RUN" | grep -E '^(fragments|throughput)'
+awk -v before="$BEFORE" -v after="$AFTER" -v run="$RUN" -v hz="$(getconf CLK_TCK)" 'BEGIN {
+    split(run, lines, "\n")
+    for (i in lines) {
+        if (lines[i] ~ /^fragments/) { split(lines[i], f, /[ ,]+/); fragments = f[2] }
+        if (lines[i] ~ /^throughput/) { split(lines[i], t, /[ (]+/); bytes = t[4] }
+    }
+    printf "per fragment:"
+    n = split(before, b, " ")
+    split(after, a, " ")
+    for (i = 1; i < n; i += 2) {
+        d = a[i + 1] - b[i + 1]
+        if (b[i] == "cpu")
+            cpu = d / hz
+        else
+            printf " %s %.2f", b[i], d / fragments
+        if (b[i] == "send" || b[i] == "sendmsg" || b[i] == "writev")
+            sends += d
+        if (b[i] == "recv" || b[i] == "recvmsg")
+            recvs += d
+    }
+    printf "\nsends %.2f + recvs %.2f per fragment, %.3f s CPU per Gbit\n",
+           sends / fragments, recvs / fragments, cpu / (bytes * 8 / 1e9)
+}'
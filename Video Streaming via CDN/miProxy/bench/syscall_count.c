@@ -0,0 +1,85 @@
+// LD_PRELOAD shim counting the proxy's socket syscalls, for the per-fragment numbers.
+//   make syscall_count.so
+//   LD_PRELOAD=./syscall_count.so SYSCALL_COUNTS=/tmp/counts ./miProxy ...
+//   kill -USR2 <proxy-pid>   # writes the totals so far to $SYSCALL_COUNTS
+// The file gets one line of "<name> <count>" pairs; take two snapshots and subtract.
+// bench/syscall_bench.sh does that around a loadgen run.
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+enum { SEND, SENDMSG, WRITEV, RECV, RECVMSG, SPLICE, SETSOCKOPT, EPOLL_WAIT, NCOUNTS };
+static const char *names[NCOUNTS] = {"send",   "sendmsg", "writev",     "recv",
+                                     "recvmsg", "splice",  "setsockopt", "epoll_wait"};
+static unsigned long counts[NCOUNTS];
+static const char *path = "syscall_counts";
+
+// Look the real call up once, count, and hand over.
+#define REAL(name, which)                                                                                            \
+    static __typeof__(&name) real;                                                                                   \
+    if (!real)                                                                                                       \
+        real = (__typeof__(&name))dlsym(RTLD_NEXT, #name);                                                           \
+    __atomic_add_fetch(&counts[which], 1, __ATOMIC_RELAXED)
+
+ssize_t send(int fd, const void *buf, size_t len, int flags) {
+    REAL(send, SEND);
+    return real(fd, buf, len, flags);
+}
+ssize_t sendmsg(int fd, const struct msghdr *msg, int flags) {
+    REAL(sendmsg, SENDMSG);
+    return real(fd, msg, flags);
+}
+ssize_t writev(int fd, const struct iovec *iov, int iovcnt) {
+    REAL(writev, WRITEV);
+    return real(fd, iov, iovcnt);
+}
+ssize_t recv(int fd, void *buf, size_t len, int flags) {
+    REAL(recv, RECV);
+    return real(fd, buf, len, flags);
+}
+ssize_t recvmsg(int fd, struct msghdr *msg, int flags) {
+    REAL(recvmsg, RECVMSG);
+    return real(fd, msg, flags);
+}
+ssize_t splice(int fd_in, loff_t *off_in, int fd_out, loff_t *off_out, size_t len, unsigned int flags) {
+    REAL(splice, SPLICE);
+    return real(fd_in, off_in, fd_out, off_out, len, flags);
+}
+int setsockopt(int fd, int level, int optname, const void *optval, socklen_t optlen) {
+    REAL(setsockopt, SETSOCKOPT);
+    return real(fd, level, optname, optval, optlen);
+}
+int epoll_wait(int epfd, struct epoll_event *events, int maxevents, int timeout) {
+    REAL(epoll_wait, EPOLL_WAIT);
+    return real(epfd, events, maxevents, timeout);
+}
+
+static void dump(int sig) {
+    (void)sig;
+    char line[512];
+    int len = 0;
+    for (int i = 0; i < NCOUNTS; i++)
+        len += snprintf(line + len, sizeof(line) - len, "%s%s %lu", i ? " " : "", names[i],
+                        __atomic_load_n(&counts[i], __ATOMIC_RELAXED));
+    line[len++] = '\n';
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1)
+        return;
+    ssize_t written = write(fd, line, len);
+    (void)written;
+    close(fd);
+}
+
+__attribute__((constructor)) static void init(void) {
+    const char *env = getenv("SYSCALL_COUNTS");
+    if (env)
+        path = env;
+    signal(SIGUSR2, dump);
+}
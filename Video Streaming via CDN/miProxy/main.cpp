@@ -1,7 +1,17 @@
 
+#include "Admin.h"
+#include "Connection.h"
 #include "DNSConnection.h"
+#include "DiskCache.h"
+#include "EventLoop.h"
+#include "FragmentCache.h"
 #include "Log.h"
+#include "ManifestCache.h"
+#include "Proxy.h"
+#include "SessionStore.h"
 #include "Socket.h"
+#include "UpstreamPool.h"
+#include "Worker.h"
 #include "params.h"
 #include "utils.h"
 #include <algorithm>
@@ -15,8 +25,10 @@
 #include <getopt.h>
 #include <iostream>
 #include <limits>
+#include <signal.h>
 #include <ostream>
 #include <queue>
+#include <sstream>
 #include <stdexcept>
 #include <thread>
 #include <unordered_map>
@@ -40,20 +52,60 @@ using std::chrono::nanoseconds;
 using std::chrono::steady_clock;
 
 void help_string() {
-    cout << "Usage: ./miProxy --nodns <listen-port> <www-ip> <alpha> <log>" << endl;
-    cout << "       ./miProxy --dns <listen-port> <dns-ip> <dns-port> "
+    cout << "Usage: ./miProxy [options] --nodns <listen-port> <www-ip> <alpha> <log>" << endl;
+    cout << "       ./miProxy [options] --dns <listen-port> <dns-ip> <dns-port> "
             "<alpha> <log>"
          << endl;
+    cout << "Options: --workers <n>   event loop threads (default: one per core)" << endl;
+    cout << "         --cache-mb <n>  fragment cache size, 0 turns it off (default: " << FRAGMENT_CACHE_MB << ")"
+         << endl;
+    cout << "         --disk-cache <dir>" << endl;
+    cout << "                         keep fragments on disk too, in dir; survives restarts (needs the memory cache)"
+         << endl;
+    cout << "         --disk-cache-mb <n>  disk cache size (default: " << DISK_CACHE_MB << ")" << endl;
+    cout << "         --hit-tput <measure|exclude>" << endl;
+    cout << "                         whether fragments served from the cache feed the bitrate estimate" << endl;
+    cout << "         --abr <ewma|harmonic|bba|mpc>" << endl;
+    cout << "                         bitrate adaptation policy (default: ewma)" << endl;
+    cout << "         --log-format <text|binary>" << endl;
+    cout << "                         binary logs are turned back into text with --decode-log" << endl;
+    cout << "       ./miProxy --decode-log <binary-log>" << endl;
+    cout << "         --prefetch-kbps <n>" << endl;
+    cout << "                         fetch each session's next fragment ahead of time, using at most n kbps"
+         << endl;
+    cout << "         --admin-port <n>" << endl;
+    cout << "                         serve latency histograms and counters as plain text on this port" << endl;
+    cout << "         --conn-buffer-kb <n>" << endl;
+    cout << "                         read at most n KB from the origin ahead of a browser (default: "
+         << RELAY_CONN_BUFFER_KB << ")" << endl;
+    cout << "         --buffer-mb <n>  cap on what all connections hold on the way to the browsers (default: "
+         << RELAY_BUFFER_MB << ")" << endl;
+    cout << "         --egress-kbps <n>" << endl;
+    cout << "                         share n kbps towards the browsers fairly between clients" << endl;
+    cout << "         --egress-weight <equal|bitrate>" << endl;
+    cout << "                         equal shares, or in proportion to each client's bitrate (default: equal)"
+         << endl;
+    cout << "         --no-collapse  fetch a fragment once per request even when others want it at the same time"
+         << endl;
+    cout << "         --session-mb <n>  memory for the clients' ABR sessions, idle ones go first once it is used up"
+         << endl;
+    cout << "                         (default: " << SESSION_TABLE_MB << ")" << endl;
+    cout << "         --session-file <path>" << endl;
+    cout << "                         save each client's bitrate estimate here, periodically and on SIGTERM,"
+         << endl;
+    cout << "                         and pick them back up at startup" << endl;
+    cout << "         --origins <ip,ip,...>" << endl;
+    cout << "                         more origins to fail over to and spread fetches across, besides the"
+         << endl;
+    cout << "                         www-ip or the nameserver's answers" << endl;
 }
 
-struct args_t {
-    uint16_t listen_port;
-
-    DNSConnection *dns;
-
-    float alpha;
-    Log *log;
-};
+// Every way out once main is running: the chunk log's last lines reach the file first.
+void quit(args_t &args, int status) {
+    if (args.log)
+        args.log->shutdown();
+    exit(status);
+}
 
 void parse_opts(int argc, char **argv, args_t &args) {
     int option_index = 0, opt = 0;
@@ -66,13 +118,130 @@ void parse_opts(int argc, char **argv, args_t &args) {
         {"nodns", no_argument, nullptr, 'n'},
         {"dns", no_argument, nullptr, 'd'},
         {"help", no_argument, nullptr, 'h'},
+        {"workers", required_argument, nullptr, 'w'},
+        {"cache-mb", required_argument, nullptr, 'c'},
+        {"disk-cache", required_argument, nullptr, 'k'},
+        {"disk-cache-mb", required_argument, nullptr, 'K'},
+        {"hit-tput", required_argument, nullptr, 't'},
+        {"prefetch-kbps", required_argument, nullptr, 'p'},
+        {"abr", required_argument, nullptr, 'a'},
+        {"log-format", required_argument, nullptr, 'l'},
+        {"decode-log", required_argument, nullptr, 'D'},
+        {"admin-port", required_argument, nullptr, 'A'},
+        {"origins", required_argument, nullptr, 'o'},
+        {"no-collapse", no_argument, nullptr, 'N'},
+        {"conn-buffer-kb", required_argument, nullptr, 'b'},
+        {"buffer-mb", required_argument, nullptr, 'B'},
+        {"egress-kbps", required_argument, nullptr, 'e'},
+        {"egress-weight", required_argument, nullptr, 'W'},
+        {"session-mb", required_argument, nullptr, 'M'},
+        {"session-file", required_argument, nullptr, 'S'},
+        {nullptr, 0, nullptr, 0},
     };
 
     bool dns = false;
     bool nodns = false;
-
-    while ((opt = getopt_long(argc, argv, "ndh", longOpts, &option_index)) != -1) {
+    args.workers = std::max(1u, thread::hardware_concurrency());
+    int cache_mb = FRAGMENT_CACHE_MB;
+    string disk_dir;
+    int disk_mb = DISK_CACHE_MB;
+    bool collapse = true;
+    string session_file;
+    args.hit_sample = HIT_SAMPLE_MEASURE;
+    args.prefetch_kbps = 0;
+    args.egress_kbps = 0;
+    args.conn_buffer = (size_t)RELAY_CONN_BUFFER_KB << 10;
+    args.buffer_bytes = (size_t)RELAY_BUFFER_MB << 20;
+    args.session_bytes = (size_t)SESSION_TABLE_MB << 20;
+    args.egress_weight = EGRESS_EQUAL;
+    args.admin_port = 0;
+    args.abr = AbrPolicy::by_name("ewma");
+    args.log = nullptr;
+    Log::Format log_format = Log::TEXT;
+
+    while ((opt = getopt_long(argc, argv, "ndhw:c:k:K:t:p:a:l:D:A:o:e:W:b:B:NS:M:", longOpts, &option_index)) != -1) {
         switch (opt) {
+        case 'c':
+            cache_mb = atoi(optarg);
+            check_or_fail(cache_mb >= 0, "Error: Illegal fragment cache size");
+            break;
+        case 'k':
+            disk_dir = optarg;
+            break;
+        case 'K':
+            disk_mb = atoi(optarg);
+            check_or_fail(disk_mb > 0, "Error: Illegal disk cache size");
+            break;
+        case 't':
+            check_or_fail(string(optarg) == "measure" || string(optarg) == "exclude", "Error: Illegal --hit-tput");
+            args.hit_sample = string(optarg) == "measure" ? HIT_SAMPLE_MEASURE : HIT_SAMPLE_EXCLUDE;
+            break;
+        case 'w':
+            args.workers = atoi(optarg);
+            check_or_fail(args.workers > 0, "Error: Illegal number of workers");
+            break;
+        case 'l':
+            check_or_fail(string(optarg) == "text" || string(optarg) == "binary", "Error: Illegal --log-format");
+            log_format = string(optarg) == "text" ? Log::TEXT : Log::BINARY;
+            break;
+        case 'D':
+            check_or_fail(Log::decode(optarg, stdout), "Error: not a binary miProxy log");
+            quit(args, 0);
+        case 'a':
+            args.abr = AbrPolicy::by_name(optarg);
+            check_or_fail(args.abr != nullptr, "Error: Unknown ABR policy");
+            break;
+        case 'p':
+            args.prefetch_kbps = atoi(optarg);
+            check_or_fail(args.prefetch_kbps >= 0, "Error: Illegal prefetch bandwidth");
+            break;
+        case 'A': {
+            int admin_port = atoi(optarg);
+            check_or_fail(admin_port > 0 && admin_port < 65536, "Error: Illegal admin port number");
+            args.admin_port = admin_port;
+            break;
+        }
+        case 'b': {
+            int kb = atoi(optarg);
+            check_or_fail(kb > 0, "Error: Illegal connection buffer size");
+            args.conn_buffer = (size_t)kb << 10;
+            break;
+        }
+        case 'B': {
+            int mb = atoi(optarg);
+            check_or_fail(mb > 0, "Error: Illegal buffer budget");
+            args.buffer_bytes = (size_t)mb << 20;
+            break;
+        }
+        case 'e':
+            args.egress_kbps = atoi(optarg);
+            check_or_fail(args.egress_kbps >= 0, "Error: Illegal egress bandwidth");
+            break;
+        case 'W':
+            check_or_fail(string(optarg) == "equal" || string(optarg) == "bitrate", "Error: Illegal --egress-weight");
+            args.egress_weight = string(optarg) == "equal" ? EGRESS_EQUAL : EGRESS_BITRATE;
+            break;
+        case 'o': {
+            stringstream ss(optarg);
+            string ip;
+            while (getline(ss, ip, ',')) {
+                check_or_fail(is_valid_ip(ip), "Error: Illegal origin IP address");
+                args.origins.push_back(ip);
+            }
+            break;
+        }
+        case 'N':
+            collapse = false;
+            break;
+        case 'M': {
+            int mb = atoi(optarg);
+            check_or_fail(mb > 0, "Error: Illegal session table size");
+            args.session_bytes = (size_t)mb << 20;
+            break;
+        }
+        case 'S':
+            session_file = optarg;
+            break;
         case 'n':
             nodns = true;
             break;
@@ -81,13 +250,28 @@ void parse_opts(int argc, char **argv, args_t &args) {
             break;
         case 'h':
             help_string();
-            exit(0);
+            quit(args, 0);
         }
     }
 
+    check_or_fail(disk_dir.empty() || cache_mb > 0, "Error: --disk-cache needs the fragment cache");
+    args.disk = nullptr;
+    if (!disk_dir.empty()) {
+        args.disk = DiskCache::open(disk_dir, (size_t)disk_mb << 20);
+        check_or_fail(args.disk != nullptr, "Error: Can't use the disk cache directory");
+    }
+    args.fragments =
+        cache_mb > 0 ? new FragmentCache((size_t)cache_mb << 20, FRAGMENT_CACHE_SHARDS, args.disk) : nullptr;
+    args.collapser = collapse ? new Collapser() : nullptr;
+    args.sessions = nullptr;
+    if (!session_file.empty()) {
+        args.sessions = new SessionStore(session_file, args.workers);
+        args.sessions->load();
+    }
+
     if (!(nodns ^ dns)) {
         help_string();
-        exit(1);
+        quit(args, 1);
     }
 
     if (dns) {
@@ -107,7 +291,7 @@ void parse_opts(int argc, char **argv, args_t &args) {
         args.alpha = alpha;
 
         string logFile = argv[optind + 4];
-        args.log = new Log(logFile);
+        args.log = new Log(logFile, log_format);
     } else {
         check_or_fail(argc - optind == 4, "Error: missing or extra arguments");
         int listen_port = atoi(argv[optind]);
@@ -121,403 +305,68 @@ void parse_opts(int argc, char **argv, args_t &args) {
         float alpha = atof(argv[optind + 2]);
         args.alpha = alpha;
         string logFile = argv[optind + 3];
-        args.log = new Log(logFile);
+        args.log = new Log(logFile, log_format);
     }
 }
 
-// thread
-/*
-make dns query
-find manifest
-while connection is open
-    start sending bitrate
-    move to VBR
-*/
-
-class BitrateTracker {
-  public:
-    BitrateTracker(double alpha, std::vector<int> avaliable_bitrates) {
-        this->alpha = alpha;
-        this->avaliable_bitrates = avaliable_bitrates;
-        this->curTput = avaliable_bitrates[0];
-    }
-    void update(double tput) {
-        this->curTput = alpha * tput + (1 - alpha) * this->curTput;
-        cout << "@@@@@ Header:\n" << alpha << " " << tput << " " << curTput << " @@@@@";
-    }
-    double get_tput() { return this->curTput; }
-    int get_bitrate() {
-        int i = 0;
-        while (i + 1 < avaliable_bitrates.size() && avaliable_bitrates[i + 1] * 1.5 <= this->curTput) {
-            i++;
-        }
-        return avaliable_bitrates[i];
-    }
-
-  private:
-    std::vector<int> avaliable_bitrates;
-    double alpha;
-    double curTput;
-};
-
-struct state_t {
-    unordered_map<string, BitrateTracker> trackers;
-    unordered_map<string, string> dns;
-};
-
-int headerEnd(char *buf, int len, int offset = 0) {
-    if (offset < 3) {
-        offset = 3;
-    }
-    for (int i = offset; i < len; i++)
-        if (buf[i - 3] == '\r' && buf[i - 2] == '\n' && buf[i - 1] == '\r' && buf[i] == '\n')
-            return i + 1;
-    return -1;
-}
-pair<int, int> parseseg_frag(string s) {
-    size_t spos = s.find("Seg") + 3;
-    size_t fpos = s.find("Frag") + 4;
-    if (spos == string::npos || fpos == string::npos) {
-        return std::make_pair(0, 0);
-    } else {
-        size_t send = s.find('-', spos) - spos;
-        size_t fend = s.find(' ', fpos) - fpos;
-        int seg = atoi(s.substr(spos, send).c_str());
-        int frag = atoi(s.substr(fpos, fend).c_str());
-        return std::make_pair(seg, frag);
-    }
-}
+int main(int argc, char **argv) {
+    // SIGTERM and SIGINT are waited for below; blocked before any thread starts so that
+    // none of them takes one.
+    sigset_t stop_signals;
+    sigemptyset(&stop_signals);
+    sigaddset(&stop_signals, SIGTERM);
+    sigaddset(&stop_signals, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &stop_signals, nullptr);
 
-string chunkname(pair<int, int> seg) {
-    stringstream ss;
-    ss << "Seg" << seg.first << "-Frag" << seg.second;
-    return ss.str();
-}
+    args_t args;
+    parse_opts(argc, argv, args);
 
-string switch_host(string header, string newHost) {
-    size_t hoststart = header.find("Host: ") + 6;
-    header.erase(hoststart, header.find("\r\n", hoststart) - hoststart); //  "Host: localhost\r\n"
-    header.insert(hoststart, newHost);
-    return header;
-}
+    // splice() has no MSG_NOSIGNAL, a browser going away must not kill the proxy
+    signal(SIGPIPE, SIG_IGN);
 
-string switch_endpoint(string header, int bitrate, int seg, int frag) {
-    size_t spos = header.find("Seg") + 3;
-    size_t endpos = header.rfind("/", spos) + 1;
-    size_t endend = header.find(" ", endpos);
-    stringstream ss;
-    ss << bitrate << "Seg" << seg << "-Frag" << frag;
-    return header.erase(endpos, endend - endpos).insert(endpos, ss.str());
-}
-// TODO
-/**
-<?xml version="1.0" encoding="UTF-8"?>
-<manifest xmlns="http://ns.adobe.com/f4m/1.0">
-        <id>
-                10
-        </id>
-        <streamType>
-                recorded
-        </streamType>
-        <duration>
-                596.50133333333338
-        </duration>
-        <bootstrapInfo
-                 profile="named"
-                 id="bootstrap5948"
-        >
-                AAAMg2Fic3QAAAAAAAAAjwAAAAPoAAAAAAAJGgAAAAAAAAAAAAAAAAAAAQAAA0Fhc3J0AAAAAAAAAABmAAAAAQAAAAYAAAACAAAABgAAAAMAAAAGAAAABAAAAAYAAAAFAAAABgAAAAYAAAAGAAAABwAAAAYAAAAIAAAABgAAAAkAAAAGAAAACgAAAAYAAAALAAAABgAAAAwAAAAGAAAADQAAAAYAAAAOAAAABQAAAA8AAAAGAAAAEAAAAAYAAAARAAAABgAAABIAAAAGAAAAEwAAAAYAAAAUAAAABQAAABUAAAAGAAAAFgAAAAYAAAAXAAAABgAAABgAAAAGAAAAGQAAAAYAAAAaAAAABgAAABsAAAAGAAAAHAAAAAUAAAAdAAAABgAAAB4AAAAGAAAAHwAAAAUAAAAgAAAABgAAACEAAAAGAAAAIgAAAAUAAAAjAAAABgAAACQAAAAGAAAAJQAAAAYAAAAmAAAABgAAACcAAAAFAAAAKAAAAAYAAAApAAAABgAAACoAAAAGAAAAKwAAAAUAAAAsAAAABgAAAC0AAAAFAAAALgAAAAYAAAAvAAAABgAAADAAAAAFAAAAMQAAAAYAAAAyAAAABgAAADMAAAAGAAAANAAAAAYAAAA1AAAABgAAADYAAAAGAAAANwAAAAYAAAA4AAAABQAAADkAAAAGAAAAOgAAAAUAAAA7AAAABgAAADwAAAAGAAAAPQAAAAYAAAA+AAAABgAAAD8AAAAGAAAAQAAAAAYAAABBAAAABgAAAEIAAAAGAAAAQwAAAAYAAABEAAAABgAAAEUAAAAFAAAARgAAAAYAAABHAAAABgAAAEgAAAAGAAAASQAAAAUAAABKAAAABgAAAEsAAAAGAAAATAAAAAYAAABNAAAABQAAAE4AAAAGAAAATwAAAAYAAABQAAAABQAAAFEAAAAGAAAAUgAAAAYAAABTAAAABgAAAFQAAAAGAAAAVQAAAAYAAABWAAAABgAAAFcAAAAGAAAAWAAAAAYAAABZAAAABgAAAFoAAAAGAAAAWwAAAAYAAABcAAAABgAAAF0AAAAGAAAAXgAAAAYAAABfAAAABgAAAGAAAAAGAAAAYQAAAAYAAABiAAAABgAAAGMAAAAGAAAAZAAAAAUAAABlAAAABgAAAGYAAAAGAQAACRZhZnJ0AAAAAAAAA+gAAAAAkAAAAAEAAAAAAAAAAAAAA+gAAAAMAAAAAAAAKvgAAAdsAAAADQAAAAAAADJCAAAD6AAAAA8AAAAAAAA6EgAAA4QAAAAQAAAAAAAAPXUAAAPoAAAARQAAAAAAAQw6AAACvAAAAEYAAAAAAAEPGAAAA+gAAABHAAAAAAABEwAAAAOEAAAASAAAAAAAARZiAAAD6AAAAFAAAAAAAAE1ogAABqQAAABRAAAAAAABPCUAAAPoAAAAWQAAAAAAAVtlAAADIAAAAFoAAAAAAAFehQAAA+gAAABbAAAAAAABYm0AAAK8AAAAXAAAAAAAAWUIAAAD6AAAAHYAAAAAAAHKmAAABdwAAAB3AAAAAAAB0JUAAAPoAAAAeAAAAAAAAdR9AAADhAAAAHkAAAAAAAHYIgAAA+gAAAB7AAAAAAAB3/IAAAJYAAAAfAAAAAAAAeIpAAAD6AAAAJIAAAAAAAI4GQAAA4QAAACTAAAAAAACO74AAAPoAAAAlQAAAAAAAkOOAAACvAAAAJYAAAAAAAJGSgAAA+gAAACcAAAAAAACXboAAAOEAAAAnQAAAAAAAmFgAAAD6AAAAKEAAAAAAAJxAAAABwgAAACiAAAAAAACeCkAAAPoAAAAqQAAAAAAApOBAAACvAAAAKoAAAAAAAKWPQAAA+gAAACwAAAAAAACra0AAAJYAAAAsQAAAAAAAq/kAAAD6AAAALIAAAAAAAKzzAAABkAAAACzAAAAAAACui0AAAPoAAAAtAAAAAAAAr4VAAADIAAAALUAAAAAAALBFAAAA+gAAAC6AAAAAAAC1JwAAAOEAAAAuwAAAAAAAthBAAAD6AAAAL0AAAAAAALgEQAAA4QAAAC+AAAAAAAC45UAAAPoAAAAwAAAAAAAAutlAAADIAAAAMEAAAAAAALupgAAA+gAAADEAAAAAAAC+l4AAAXcAAAAxQAAAAAAAwBcAAAD6AAAAM8AAAAAAAMnbAAAArwAAADQAAAAAAADKkkAAAPoAAAA3QAAAAAAA10RAAACvAAAAN4AAAAAAANfrAAAA+gAAADgAAAAAAADZ3wAAAakAAAA4QAAAAAAA23+AAAD6AAAAOgAAAAAAAOJVgAAArwAAADpAAAAAAADi/EAAAPoAAAA8gAAAAAAA68ZAAACWAAAAPMAAAAAAAOxcQAAA+gAAAD7AAAAAAAD0LEAAAakAAAA/AAAAAAAA9dVAAAD6AAAAP0AAAAAAAPbPQAAA4QAAAD+AAAAAAAD3uIAAAPoAAAA/wAAAAAAA+LKAAACvAAAAQAAAAAAAAPlZQAAA+gAAAEBAAAAAAAD6U0AAAK8AAABAgAAAAAAA+voAAAD6AAAAQMAAAAAAAPv0AAABdwAAAEEAAAAAAAD9awAAAPoAAABBQAAAAAAA/mUAAACvAAAAQYAAAAAAAP8LgAAA+gAAAEHAAAAAAAEABYAAAakAAABCAAAAAAABAaZAAACvAAAAQkAAAAAAAQJNAAAA+gAAAEKAAAAAAAEDRwAAAK8AAABCwAAAAAABA+2AAAD6AAAARQAAAAAAAQy3gAABwgAAAEVAAAAAAAEOcUAAAPoAAABFwAAAAAABEF0AAADIAAAARgAAAAAAARElAAAA+gAAAEZAAAAAAAESHwAAAK8AAABGgAAAAAABEsWAAAD6AAAASQAAAAAAARyJgAAAyAAAAElAAAAAAAEdWgAAAPoAAABKQAAAAAABITmAAADhAAAASoAAAAAAASIjAAAA+gAAAFEAAAAAAAE7foAAAZAAAABRQAAAAAABPRcAAAD6AAAAU4AAAAAAAUXhAAAAlgAAAFPAAAAAAAFGf0AAAPoAAABUQAAAAAABSHNAAAF3AAAAVIAAAAAAAUnygAAA+gAAAFTAAAAAAAFK7IAAAOEAAABVAAAAAAABS8VAAAD6AAAAWMAAAAAAAVprQAAArwAAAFkAAAAAAAFbEgAAAPoAAABcwAAAAAABabgAAACvAAAAXQAAAAAAAWpnAAAA+gAAAF1AAAAAAAFrYQAAAZAAAABdgAAAAAABbPEAAAD6AAAAXcAAAAAAAW3rAAAArwAAAF4AAAAAAAFukYAAAPoAAABfQAAAAAABc2tAAADIAAAAX4AAAAAAAXQ7gAAA+gAAAGHAAAAAAAF9BYAAAZAAAABiAAAAAAABfpWAAACvAAAAYkAAAAAAAX9NAAAA+gAAAGMAAAAAAAGCOwAAAJYAAABjQAAAAAABgtEAAAD6AAAAY8AAAAAAAYTFAAABkAAAAGQAAAAAAAGGVQAAAPoAAABlAAAAAAABij0AAACvAAAAZUAAAAAAAYr0QAAA+gAAAGYAAAAAAAGN4kAAAK8AAABmQAAAAAABjokAAAD6AAAAaAAAAAAAAZVfAAAA4QAAAGhAAAAAAAGWQAAAAPoAAABpQAAAAAABmigAAAGpAAAAaYAAAAAAAZvZQAAA+gAAAGoAAAAAAAGdzUAAAJYAAABqQAAAAAABnmNAAAD6AAAAa0AAAAAAAaJLQAAA4QAAAGuAAAAAAAGjNIAAAPoAAABrwAAAAAABpCZAAAF3AAAAbAAAAAAAAaWlgAAA+gAAAGxAAAAAAAGmn4AAAOEAAABsgAAAAAABp4kAAAD6AAAAbMAAAAAAAaiDAAAAyAAAAG0AAAAAAAGpU0AAAJYAAABtQAAAAAABqfGAAAD6AAAAb0AAAAAAAbHBgAABkAAAAG+AAAAAAAGzUYAAAPoAAABygAAAAAABvwFAAAB9AAAAcsAAAAAAAb+GgAAA+gAAAHNAAAAAAAHBeoAAAZAAAABzgAAAAAABwwqAAAD6AAAAeEAAAAAAAdWYgAAAyAAAAHiAAAAAAAHWYIAAAPoAAAB5gAAAAAAB2kiAAACWAAAAecAAAAAAAdregAAA+gAAAHqAAAAAAAHdzIAAAMgAAAB6wAAAAAAB3p0AAAD6AAAAe4AAAAAAAeGLAAAA4QAAAHvAAAAAAAHibAAAAPoAAACRAAAAAAACNW4AAAHbAAAAkUAAAAAAAjdJAAAA+gAAAJUAAAAAAAJF7wAAAJYAAAAAAAAAAAAAAAAAAAAAAA=
-        </bootstrapInfo>
-        <media
-                 streamId="10"
-                 url="10"
-                 bitrate="10"
-                 bootstrapInfoId="bootstrap5948"
-        >
-                <metadata>
-                        AgAKb25NZXRhRGF0YQgAAAAAAAhkdXJhdGlvbgBAgqQCuwz4fgAFd2lkdGgAQIqwAAAAAAAABmhlaWdodABAfgAAAAAAAAAMdmlkZW9jb2RlY2lkAgAEYXZjMQAMYXVkaW9jb2RlY2lkAgAEbXA0YQAKYXZjcHJvZmlsZQBAU0AAAAAAAAAIYXZjbGV2ZWwAQEQAAAAAAAAADnZpZGVvZnJhbWVyYXRlAEA+AAAAAAAAAA9hdWRpb3NhbXBsZXJhdGUAQOdwAAAAAAAADWF1ZGlvY2hhbm5lbHMAQAAAAAAAAAAACXRyYWNraW5mbwoAAAACAwAGbGVuZ3RoAEGJmJzAAAAAAAl0aW1lc2NhbGUAQPX5AAAAAAAACGxhbmd1YWdlAgADdW5kAAAJAwAGbGVuZ3RoAEF7TkAAAAAAAAl0aW1lc2NhbGUAQOdwAAAAAAAACGxhbmd1YWdlAgADZW5nAAAJAAAJ
-                </metadata>
-        </media>
-        <media
-                 streamId="100"
-                 url="100"
-                 bitrate="100"
-                 bootstrapInfoId="bootstrap5948"
-        >
-                <metadata>
-                        AgAKb25NZXRhRGF0YQgAAAAAAAhkdXJhdGlvbgBAgqQCuwz4fgAFd2lkdGgAQIqwAAAAAAAABmhlaWdodABAfgAAAAAAAAAMdmlkZW9jb2RlY2lkAgAEYXZjMQAMYXVkaW9jb2RlY2lkAgAEbXA0YQAKYXZjcHJvZmlsZQBAU0AAAAAAAAAIYXZjbGV2ZWwAQEQAAAAAAAAADnZpZGVvZnJhbWVyYXRlAEA+AAAAAAAAAA9hdWRpb3NhbXBsZXJhdGUAQOdwAAAAAAAADWF1ZGlvY2hhbm5lbHMAQAAAAAAAAAAACXRyYWNraW5mbwoAAAACAwAGbGVuZ3RoAEGJmJzAAAAAAAl0aW1lc2NhbGUAQPX5AAAAAAAACGxhbmd1YWdlAgADdW5kAAAJAwAGbGVuZ3RoAEF7TkAAAAAAAAl0aW1lc2NhbGUAQOdwAAAAAAAACGxhbmd1YWdlAgADZW5nAAAJAAAJ
-                </metadata>
-        </media>
-        <media
-                 streamId="500"
-                 url="500"
-                 bitrate="500"
-                 bootstrapInfoId="bootstrap5948"
-        >
-                <metadata>
-                        AgAKb25NZXRhRGF0YQgAAAAAAAhkdXJhdGlvbgBAgqQCuwz4fgAFd2lkdGgAQIqwAAAAAAAABmhlaWdodABAfgAAAAAAAAAMdmlkZW9jb2RlY2lkAgAEYXZjMQAMYXVkaW9jb2RlY2lkAgAEbXA0YQAKYXZjcHJvZmlsZQBAU0AAAAAAAAAIYXZjbGV2ZWwAQEQAAAAAAAAADnZpZGVvZnJhbWVyYXRlAEA+AAAAAAAAAA9hdWRpb3NhbXBsZXJhdGUAQOdwAAAAAAAADWF1ZGlvY2hhbm5lbHMAQAAAAAAAAAAACXRyYWNraW5mbwoAAAACAwAGbGVuZ3RoAEGJmJzAAAAAAAl0aW1lc2NhbGUAQPX5AAAAAAAACGxhbmd1YWdlAgADdW5kAAAJAwAGbGVuZ3RoAEF7TkAAAAAAAAl0aW1lc2NhbGUAQOdwAAAAAAAACGxhbmd1YWdlAgADZW5nAAAJAAAJ
-                </metadata>
-        </media>
-        <media
-                 streamId="1000"
-                 url="1000"
-                 bitrate="1000"
-                 bootstrapInfoId="bootstrap5948"
-        >
-                <metadata>
-                        AgAKb25NZXRhRGF0YQgAAAAAAAhkdXJhdGlvbgBAgqQCuwz4fgAFd2lkdGgAQIqwAAAAAAAABmhlaWdodABAfgAAAAAAAAAMdmlkZW9jb2RlY2lkAgAEYXZjMQAMYXVkaW9jb2RlY2lkAgAEbXA0YQAKYXZjcHJvZmlsZQBAU0AAAAAAAAAIYXZjbGV2ZWwAQEQAAAAAAAAADnZpZGVvZnJhbWVyYXRlAEA+AAAAAAAAAA9hdWRpb3NhbXBsZXJhdGUAQOdwAAAAAAAADWF1ZGlvY2hhbm5lbHMAQAAAAAAAAAAACXRyYWNraW5mbwoAAAACAwAGbGVuZ3RoAEGJmJzAAAAAAAl0aW1lc2NhbGUAQPX5AAAAAAAACGxhbmd1YWdlAgADdW5kAAAJAwAGbGVuZ3RoAEF7TkAAAAAAAAl0aW1lc2NhbGUAQOdwAAAAAAAACGxhbmd1YWdlAgADZW5nAAAJAAAJ
-                </metadata>
-        </media>
-</manifest>
+    args.manifests = new ManifestCache(MANIFEST_CACHE_MAX_ENTRIES, MANIFEST_MAX_AGE_MS);
 
-*/
-vector<int> parse_manifest(string manifest) {
-    size_t cur_loc = manifest.find("bitrate=") + 9;
-    vector<int> brs;
-    while (cur_loc != string::npos) {
-        size_t endloc = manifest.find("\"", cur_loc);
-        string br_s = manifest.substr(cur_loc, endloc - cur_loc);
-        cur_loc = manifest.find("bitrate=", endloc) + 9;
-        brs.push_back(stoi(br_s));
+    // One listen socket per worker, bound in worker order so the steering program's
+    // index matches the worker id.
+    vector<int> sockfds;
+    for (int i = 0; i < args.workers; i++) {
+        int sockfd = socket_init_shared(args.listen_port);
+        if (sockfd == -1) {
+            quit(args, -1);
+        }
+        sockfds.push_back(sockfd);
     }
-    return brs;
-}
-
-size_t content_length(string header) {
-    size_t contstart = header.find("Content-Length: ") + 16;
-    string cont = header.substr(contstart, header.find("\r\n", contstart)); //  "Content-Length: 7015\r\n"
-    return stoi(cont);
-}
-
-void handle_request(int fd, args_t *args, state_t *state) {
-    socket_raii s(fd);
-
-    string client_ip = get_ip_addr(fd);
-    string server_ip;
-
-    // first parse the request  - is this manifest or something else?
-    char buf[BUF_SIZE];
-    memset(buf, 0, BUF_SIZE);
-    int offset = 0;
-    int read_len = 0;
-    while (headerEnd(buf, offset, offset - read_len) == -1) {
-        read_len = socket_recv(fd, buf, BUF_SIZE - offset);
-        offset += read_len;
+    args.listen_port = socket_getPort(sockfds[0]);
+    if (args.workers > 1 && socket_steer_by_source(sockfds[0], args.workers) == -1) {
+        cout << "Warning: clients not steered by address, workers will hand connections over" << endl;
     }
 
-    // now i have the header...
-    string header = string(buf, buf + offset);
-    cout << "@@@@@ Header:\n" << header << "@@@@@";
-
-    cout << "@@@@@ header: " << header << "\n@@@@@\n\n";
-
-    // DNS request needed?
-    string host = "video.cse.umich.edu"; //  "Host: localhost\r\n"
-    {
-        if (state->dns.find(client_ip) != state->dns.end()) { // I have it already
-            server_ip = state->dns[client_ip];
-        } else {
-            server_ip = args->dns->resolve(host);
-            state->dns[client_ip] = server_ip;
+    // (4) Begin listening for incoming connections.
+    for (int sockfd : sockfds) {
+        if (socket_set_nonblocking(sockfd) == -1 || socket_listen(sockfd, SOMAXCONN) == -1) {
+            quit(args, -1);
         }
     }
 
-    header = switch_host(header, server_ip);
-
-    size_t manPos = header.find(".f4m");
-
-    pair<int, int> seg = parseseg_frag(header);
-    if (manPos != string::npos) {
-        {
-            if (state->trackers.find(client_ip) != state->trackers.end()) {
-                // Request 1 - build my tracker
-                int full_manifest_fd = make_sock(server_ip.c_str(), 80);
-                socket_raii fm(full_manifest_fd);
-                socket_send_all(full_manifest_fd, header.c_str(), header.length());
-                memset(buf, 0, BUF_SIZE);
-                offset = 0;
-                read_len = 0;
-                while (headerEnd(buf, offset, offset - read_len) == -1) {
-                    read_len = socket_recv(full_manifest_fd, buf, BUF_SIZE - offset);
-                    offset += read_len;
-                }
-                char buf2[BUF_SIZE];
-                int hend = headerEnd(buf, offset);
-                memcpy(buf2, buf + hend, offset - hend);
-                string full_man_resp_header = string(buf, buf + hend); // came back from server
-                int cont_len = content_length(full_man_resp_header);
-                socket_recv_all(full_manifest_fd, buf2 + (offset - hend), cont_len - (offset - hend));
-                string manifest(buf, buf + cont_len);
-                vector<int> man = parse_manifest(manifest);
-                state->trackers.insert(make_pair(client_ip, BitrateTracker(args->alpha, man)));
-            }
-        }
-        // So I have established a tracker here
-        // No state for the below section
-        {
-            // Request 2
-            header.insert(manPos, "_nolist");
-            int nolist_manifest_fd = make_sock(server_ip.c_str(), 80);
-            socket_raii nlm(nolist_manifest_fd);
-            socket_send_all(nolist_manifest_fd, header.c_str(), header.length());
-            memset(buf, 0, BUF_SIZE);
-            offset = 0;
-            read_len = 0;
-            while (headerEnd(buf, offset, offset - read_len) == -1) {
-                read_len = socket_recv(nolist_manifest_fd, buf, BUF_SIZE - offset);
-                offset += read_len;
-            }
-            char buf2[BUF_SIZE];
-            int hend = headerEnd(buf, offset);
-            memcpy(buf2, buf + hend, offset - hend);
-            string full_man_resp_header = string(buf, buf + hend); // came back from server
-            // full_man_resp_header = switch_host(full_man_resp_header, host); // proxy host addr
-            int cont_len = content_length(full_man_resp_header);
-            // forward here - idc about contents
-            socket_send_all(fd, full_man_resp_header.c_str(), full_man_resp_header.length());
-            socket_send_all(fd, buf + hend, offset - hend);
-
-            memset(buf2, 0, BUF_SIZE);
-            offset = offset - hend;
-            read_len = 0;
-            while (offset < cont_len) {
-                read_len = socket_recv(nolist_manifest_fd, buf2, min(cont_len - offset, BUF_SIZE));
-                socket_send_all(fd, buf2, read_len);
-                offset += read_len;
-            }
-        }
-    } else if (seg.first != 0 && seg.second != 0) {
-        int seg_fd = make_sock(server_ip.c_str(), 80);
-        socket_raii seg_sr(seg_fd);
-        {
-            if (state->trackers.find(client_ip) == state->trackers.end()) {
-                state->trackers.insert(make_pair(client_ip, BitrateTracker(args->alpha, {10, 100, 500, 1000})));
-                cout << "@@@@@ Please don't run:"
-                     << "@@@@@";
-            }
-            // assert(state->trackers.find(client_ip) != state->trackers.end());
-            header = switch_endpoint(header, state->trackers.at(client_ip).get_bitrate(), seg.first, seg.second);
-
-            socket_send_all(seg_fd, header.c_str(), header.length());
-            cout << "@@@@@ Header:\n" << header << "@@@@@";
-            memset(buf, 0, BUF_SIZE);
-            offset = 0;
-            read_len = 0;
-            while (headerEnd(buf, offset, offset - read_len) == -1) {
-                read_len = socket_recv(seg_fd, buf, BUF_SIZE - offset);
-                offset += read_len;
-            }
-            char buf2[BUF_SIZE];
-            int hend = headerEnd(buf, offset);
-            memcpy(buf2, buf + hend, offset - hend);
-            string resp_header = string(buf, buf + hend); // came back from server
-            // resp_header = switch_host(resp_header, host); // proxy host addr
-            int cont_len = content_length(resp_header);
-            socket_send_all(fd, resp_header.c_str(), resp_header.length());
-            socket_send_all(fd, buf + hend, offset - hend);
-            memset(buf2, 0, BUF_SIZE);
-            offset = offset - hend;
-            read_len = 0;
-            auto start = steady_clock::now();
-            while (offset < cont_len) {
-                read_len = socket_recv(seg_fd, buf2, min(cont_len - offset, BUF_SIZE));
-                socket_send_all(fd, buf2, read_len);
-                offset += read_len;
-            }
-            auto end = steady_clock::now();
-            auto duration = duration_cast<nanoseconds>(end - start).count() / 1000000000.0;
-
-            double tput = offset / 125. / duration;
-            double brate = state->trackers.at(client_ip).get_bitrate();
-
-            state->trackers.at(client_ip).update(tput);
-
-            args->log->write(client_ip, chunkname(seg), server_ip, duration, tput,
-                             state->trackers.at(client_ip).get_tput(), brate);
-            args->log->flush_log();
-        }
-        // so the segment has been forwarded?
-    } else { // index or others...
-        int other_fd = make_sock(server_ip.c_str(), 80);
-        socket_raii sr(other_fd);
-        socket_send_all(other_fd, header.c_str(), header.length());
-        memset(buf, 0, BUF_SIZE);
-        offset = 0;
-        read_len = 0;
-        while (headerEnd(buf, offset, offset - read_len) == -1) {
-            read_len = socket_recv(other_fd, buf, BUF_SIZE - offset);
-            offset += read_len;
-        }
-        char buf2[BUF_SIZE];
-        int hend = headerEnd(buf, offset);
-        memcpy(buf2, buf + hend, offset - hend);
-        string resp_header = string(buf, buf + hend); // came back from server
-
-        // resp_header = switch_host(resp_header, host); // proxy host addr
-        int cont_len = content_length(resp_header);
-        cout << "@@@@@ Response Len: " << hend << "\n" << resp_header << "\n@@@@@\n\n";
-        // forward here - idc about contents
-        socket_send_all(fd, resp_header.c_str(), resp_header.length());
-        socket_send_all(fd, buf + hend, offset - hend);
-        // cout << "@@@@@ Piece Len: " << offset - hend << "\n" << string(buf + hend, buf + offset) << "\n@@@@@\n\n";
-        memset(buf2, 0, BUF_SIZE);
-        offset = offset - hend;
-        read_len = 0;
-        while (offset < cont_len) {
-            read_len = socket_recv(other_fd, buf2, min(cont_len - offset, BUF_SIZE));
-            socket_send_all(fd, buf2, read_len);
-            // cout << "@@@@@ Piece Len: " << read_len << "\n" << string(buf2, buf2 + read_len) << "\n@@@@@\n\n";
-            offset += read_len;
-        }
+    // (5) Serve incoming connections, one event loop per worker.
+    vector<Worker *> workers;
+    for (int i = 0; i < args.workers; i++) {
+        workers.push_back(new Worker(i, sockfds[i], &args, &workers));
     }
-}
-
-int main(int argc, char **argv) {
-    args_t args;
-    parse_opts(argc, argv, args);
-
-    int sockfd = socket_init(args.listen_port);
-    if (sockfd == -1) {
-        return -1;
+    for (Worker *w : workers) {
+        w->start();
     }
-
-    args.listen_port = socket_getPort(sockfd);
-    // (4) Begin listening for incoming connections.
-    listen(sockfd, 10);
-
-    state_t state;
-
-    fd_set readfds;
-    vector<int> fds;
-    // (5) Serve incoming connections one by one forever.
-    while (true) {
-        FD_ZERO(&readfds);
-        FD_SET(sockfd, &readfds);
-        for (int fd : fds) {
-            FD_SET(fd, &readfds);
-        }
-        if (select(FD_SETSIZE, &readfds, NULL, NULL, NULL) == -1) {
-            perror("Error in select");
-            return -1;
-        }
-        if (FD_ISSET(sockfd, &readfds)) {
-            int confd = socket_accept(sockfd);
-            if (confd == -1) {
-                perror("Error accepting connection");
-                return -1;
-            }
-            fds.push_back(confd);
-        }
-        for (int i = 0; i < fds.size(); i++) {
-            if (FD_ISSET(fds[i], &readfds)) {
-                handle_request(fds[i], &args, &state);
-                // std::thread worker(handle_request, fds[i], &args, &state);
-                // worker.detach();
-                fds.erase(fds.begin() + i);
-                i--;
-            }
+    if (args.admin_port) {
+        int adminfd = socket_init(args.admin_port);
+        if (adminfd == -1 || socket_set_nonblocking(adminfd) == -1 || socket_listen(adminfd, SOMAXCONN) == -1) {
+            quit(args, -1);
         }
-        // std::thread worker(handle_request, confd, &args, &state);
-        // worker.detach();
+        Admin *admin = new Admin(adminfd, &workers, &args);
+        admin->start();
     }
+    int sig;
+    sigwait(&stop_signals, &sig);
+    if (args.sessions)
+        args.sessions->snapshot();
+    quit(args, 0);
 }
@@ -4,4 +4,113 @@
 
 static const char WHITESPACE = ' ';
 static const int BUF_SIZE = 8 * 1024;
+static const int MAX_HEADER_SIZE = 64 * 1024;
+static const int MAX_REQUEST_BODY = 64 * 1024; // browser request bodies are buffered whole, bigger ones get a 413
+
+// upstream keep-alive pool
+static const int POOL_MAX_IDLE_PER_ORIGIN = 32;
+static const int POOL_IDLE_TIMEOUT_MS = 30 * 1000;
+
+// zero-copy body relay (falls back to BUF_SIZE copies when off or unsupported)
+static const bool RELAY_SPLICE = true;
+static const int SPLICE_MIN_BYTES = BUF_SIZE;
+static const int PIPE_SIZE = 64 * 1024; // default pipe capacity
+
+// browser-bound sends, see Connection::send_hit
+static const bool SEND_ZEROCOPY = true;             // MSG_ZEROCOPY for cache hits, where the kernel supports it
+static const int ZEROCOPY_MIN_BYTES = 64 * 1024;    // below this the page pinning costs more than the copy
+static const int ZEROCOPY_LINGER_MS = 60 * 1000;    // a closed connection's bodies are kept this long for the kernel
+
+// shared manifest cache
+static const int MANIFEST_CACHE_MAX_ENTRIES = 1024;
+static const int MANIFEST_MAX_AGE_MS = 30 * 1000; // unless the origin sends Cache-Control: max-age
+static const int MANIFEST_MAX_BYTES = 1024 * 1024;  // manifests are read whole to parse, bigger ones fail
+
+// shared fragment cache (W-TinyLFU), --cache-mb overrides the size
+static const int FRAGMENT_CACHE_MB = 64;
+static const int FRAGMENT_CACHE_SHARDS = 16;
+static const int FRAGMENT_CACHE_WINDOW_PERCENT = 1;     // of each shard, the rest is main
+static const int FRAGMENT_CACHE_PROTECTED_PERCENT = 80; // of main
+static const int FRAGMENT_CACHE_SKETCH_BYTES = 16 * 1024; // one sketch counter per this many cached bytes
+
+// on-disk tier under the fragment cache, see DiskCache.h; off unless --disk-cache is given
+static const int DISK_CACHE_MB = 4096;                  // --disk-cache-mb overrides
+static const int DISK_SEGMENT_MB = 64;                  // the cache is a whole number of these, at least 2
+static const int DISK_INDEX_BYTES_PER_SLOT = 8 * 1024;  // one index slot per this much disk
+static const int DISK_QUEUE_MB = 64;                    // waiting for the writer, more is dropped
+static const int DISK_READERS = 2;                      // threads reading fragments back for the workers
+static const int DISK_FORGET_BATCH = 256;               // index slots dropped per hold of the lock on a recycle
+
+// next-fragment prefetch, off unless --prefetch-kbps is given
+static const int PREFETCH_TICK_MS = 10;                       // token bucket refill period
+static const int PREFETCH_SLOT_TTL_MS = 10 * 1000;            // unclaimed results are dropped after this
+static const int PREFETCH_MAX_HELD_MB = 32;                   // per worker
+
+// bitrate adaptation, see Abr.h
+static const int ABR_HISTORY = 5;                     // throughput samples kept per session
+static const int ABR_MAX_RUNGS = 16;                  // longer ladders are thinned to this
+static const double ABR_SAFETY_MARGIN = 1.5;          // throughput needed per kbps of bitrate
+static const float ABR_FRAGMENT_SECONDS = 1.0f;       // video per fragment (the test video's afrt)
+static const float ABR_MAX_BUFFER_SECONDS = 30.0f;    // players stop fetching around here
+static const float ABR_BBA_RESERVOIR_SECONDS = 5.0f;
+static const float ABR_BBA_CUSHION_SECONDS = 15.0f;
+static const int ABR_MPC_HORIZON = 5;                 // fragments looked ahead
+static const int ABR_MPC_MAX_PLANS = 4096;            // shorter horizon for long ladders
+static const double ABR_MPC_SWITCH_PENALTY = 1.0;
+
+// TCP_INFO bandwidth estimate, see TcpInfo.h
+static const int TCPINFO_SAMPLE_BYTES = 64 * 1024; // client socket sampled once per this much relayed
+
+// nameserver lookups, see Resolver.h
+static const int DNS_TIMEOUT_MS = 1000; // per attempt
+static const int DNS_ATTEMPTS = 3;
+static const int DNS_TICK_MS = 100;     // how often deadlines are checked
+
+// per-worker client -> origin cache, see ResolutionCache.h
+static const int DNS_MIN_TTL_MS = 1000;            // the nameserver sends TTL 0
+static const int DNS_MAX_STALE_MS = 5 * 60 * 1000; // served while a refresh runs, up to this late
+static const int DNS_NEGATIVE_TTL_MS = 5 * 1000;   // NXDOMAIN
+static const int DNS_CACHE_MAX_CLIENTS = 64 * 1024;
+
+// chunk log, see Log.h
+static const int LOG_RING_RECORDS = 4096;         // per thread, a power of two
+static const int LOG_FLUSH_MS = 10;               // writer wakes this often
+static const int LOG_WRITE_BUFFER = 256 * 1024;
+
+// relay buffering, see BufferBudget.h; --conn-buffer-kb and --buffer-mb override
+static const int RELAY_CONN_BUFFER_KB = 64;
+static const int RELAY_BUFFER_MB = 256; // across all workers
+static const int BUFFER_TICK_MS = 5;    // how often reads held back for the budget are retried
+
+// egress scheduling, see EgressScheduler.h
+static const int EGRESS_TICK_MS = 5;
+static const int EGRESS_QUANTUM = 16 * 1024;   // bytes per round for a client at EGRESS_WEIGHT_KBPS
+static const int EGRESS_MIN_QUANTUM = 1460;    // weighted quanta never drop below one segment
+static const int EGRESS_WEIGHT_KBPS = 1000;
+
+// origin failover and ranking, see OriginSet.h
+static const int ORIGIN_CONNECT_TIMEOUT_MS = 2000;
+static const int ORIGIN_CONNECT_TICK_MS = 100;  // how often connect deadlines are checked
+static const int ORIGIN_BACKOFF_MIN_MS = 1000;  // first failure
+static const int ORIGIN_BACKOFF_MAX_MS = 60 * 1000;
+static const double ORIGIN_EWMA_ALPHA = 0.2;
+static const int ORIGIN_SCORE_BYTES = 256 * 1024; // a typical fragment, for ranking
+static const double ORIGIN_SWITCH_FACTOR = 2.0;   // the nameserver's pick stays unless this much slower
+static const double ORIGIN_SWITCH_SLACK_MS = 5;   // ... plus this, so near-equal origins don't flap
+static const int ORIGIN_MAX_ATTEMPTS = 3;         // origins one request may go through
+
+// per-worker session table, see SessionTable.h; --session-mb overrides the ceiling
+static const int SESSION_TABLE_MB = 64;           // across all workers
+static const int SESSION_TABLE_MIN_SLOTS = 1024;  // to start with, and the floor however low the ceiling
+static const int SESSION_IDLE_S = 10 * 60;        // sessions idle longer than this are dropped
+static const int SESSION_SWEEP_MS = 1000;
+static const int SESSION_SWEEP_PASS_S = 60;       // the CLOCK hand goes round this often without new clients
+
+// ABR session snapshots, see SessionStore.h; off unless --session-file is given
+static const int SESSION_SNAPSHOT_MS = 15 * 1000;
+static const int SESSION_MAX_AGE_S = 10 * 60;  // sessions idle longer than this are neither saved nor restored
+static const int SESSION_SAVE_WAIT_MS = 2000;  // for the workers' saves, each snapshot
+
+// client -> worker sharding, see shard_of
+static const unsigned SHARD_HASH_MULT = 2654435761u;
 #endif
\ No newline at end of file
@@ -0,0 +1,101 @@
+#!/usr/bin/env python3
+# Request collapsing end to end: bench/origin.py trickles each fragment in over ~300 ms, a
+# leader asks for one and hangs up after its first bytes, and the followers that joined its
+# fetch must still get the whole fragment, from that one origin fetch.
+#   make miProxy && sudo tests/collapse_test.py
+# Run from miProxy/. The origin listens on :80 (the proxy only talks to port 80).
+import os
+import re
+import socket
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+
+PROXY_PORT = 8890
+ADMIN_PORT = 8891
+FOLLOWERS = 3
+REQUEST = b'GET /vod/10Seg1-Frag3 HTTP/1.1\r\nHost: localhost\r\n\r\n'
+
+failures = 0
+
+
+def check(cond, what):
+    global failures
+    if not cond:
+        print('collapse_test: %s failed' % what, file=sys.stderr)
+        failures += 1
+
+
+def read_response(s):
+    data = b''
+    while b'\r\n\r\n' not in data:
+        piece = s.recv(65536)
+        if not piece:
+            return None
+        data += piece
+    head, body = data.split(b'\r\n\r\n', 1)
+    length = int(re.search(rb'(?i)\r\ncontent-length: *(\d+)', head + b'\r\n').group(1))
+    while len(body) < length:
+        piece = s.recv(65536)
+        if not piece:
+            break
+        body += piece
+    return body
+
+
+def counter(name):
+    with socket.create_connection(('127.0.0.1', ADMIN_PORT)) as s:
+        s.sendall(b'GET / HTTP/1.0\r\n\r\n')
+        text = b''
+        while True:
+            piece = s.recv(65536)
+            if not piece:
+                break
+            text += piece
+    return int(re.search(rb'\n' + name.encode() + rb' (\d+)', text).group(1))
+
+
+def follow(results, i):
+    with socket.create_connection(('127.0.0.1', PROXY_PORT)) as s:
+        s.sendall(REQUEST)
+        results[i] = read_response(s)
+
+
+def main():
+    os.chdir(os.path.join(os.path.dirname(os.path.abspath(__file__)), '..'))
+    log = tempfile.NamedTemporaryFile()
+    origin = subprocess.Popen([sys.executable, 'bench/origin.py', '80', '--trickle'])
+    time.sleep(0.5)
+    # without the cache every fragment request collapses, not just those seen before
+    proxy = subprocess.Popen(['./miProxy', '--workers', '1', '--cache-mb', '0', '--admin-port', str(ADMIN_PORT),
+                              '--nodns', str(PROXY_PORT), '127.0.0.1', '0.5', log.name], stdout=subprocess.DEVNULL)
+    time.sleep(0.5)
+    try:
+        leader = socket.create_connection(('127.0.0.1', PROXY_PORT))
+        leader.sendall(REQUEST)
+        time.sleep(0.05)  # its fetch is on, the followers join it
+        results = [None] * FOLLOWERS
+        threads = [threading.Thread(target=follow, args=(results, i)) for i in range(FOLLOWERS)]
+        for t in threads:
+            t.start()
+        first = leader.recv(100)
+        check(first.startswith(b'HTTP/1.1 200'), 'leader answer')
+        leader.close()  # mid-body, the origin is far from done
+        for t in threads:
+            t.join(5)
+        for body in results:
+            check(body == b'D' * 2500, 'whole fragment for a follower')
+        check(counter('hits_collapsed') == FOLLOWERS, 'one fetch for all')
+    finally:
+        proxy.terminate()
+        origin.terminate()
+        proxy.wait()
+        origin.wait()
+    if failures:
+        sys.exit(1)
+    print('collapse_test: ok')
+
+
+main()
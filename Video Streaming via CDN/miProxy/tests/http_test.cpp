@@ -0,0 +1,140 @@
+// Head helpers against the spellings peers actually send: header names in any case, with
+// or without the space after the colon; request body lengths the proxy won't buffer; and
+// manifests with bitrates that aren't numbers.
+//   make test
+#include "../Http.h"
+#include <stdio.h>
+
+static int failures = 0;
+
+#define CHECK(cond)                                                                                                    \
+    do {                                                                                                               \
+        if (!(cond)) {                                                                                                 \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond);                                  \
+            failures++;                                                                                                \
+        }                                                                                                              \
+    } while (0)
+
+static void test_content_length() {
+    size_t len = 1;
+    CHECK(content_length("HTTP/1.1 200 OK\r\nContent-Length: 20000\r\n\r\n", string::npos, &len) && len == 20000);
+    CHECK(content_length("HTTP/1.1 200 OK\r\ncontent-length: 20000\r\n\r\n", string::npos, &len) && len == 20000);
+    CHECK(content_length("HTTP/1.1 200 OK\r\nCONTENT-LENGTH:20000\r\n\r\n", string::npos, &len) && len == 20000);
+    CHECK(content_length("HTTP/1.1 200 OK\r\nContent-Length:\t20000 \r\n\r\n", string::npos, &len) && len == 20000);
+    CHECK(content_length("HTTP/1.1 304 Not Modified\r\nETag: x\r\n\r\n", string::npos, &len) && len == 0);
+    CHECK(!content_length("HTTP/1.1 200 OK\r\nContent-Length: 12ab\r\n\r\n", string::npos, &len));
+    CHECK(!content_length("HTTP/1.1 200 OK\r\nContent-Length: -5\r\n\r\n", string::npos, &len));
+    CHECK(!content_length("HTTP/1.1 200 OK\r\nContent-Length: \r\n\r\n", string::npos, &len));
+    CHECK(!content_length("HTTP/1.1 200 OK\r\nContent-Length: 99999999999999999999999\r\n\r\n", string::npos, &len));
+    // a header-like line in the body isn't the head's
+    string resp = "HTTP/1.1 200 OK\r\nServer: x\r\n\r\nContent-Length: 5\r\n";
+    CHECK(content_length(resp, 30, &len) && len == 0);
+}
+
+static void test_body_framing() {
+    size_t len = 0;
+    string resp = "HTTP/1.1 200 OK\r\ncontent-length: 20000\r\n\r\n";
+    CHECK(body_framing(resp, resp.size(), false, &len) == BODY_LENGTH && len == 20000);
+    resp = "HTTP/1.1 200 OK\r\nContent-length:20000\r\n\r\n";
+    CHECK(body_framing(resp, resp.size(), false, &len) == BODY_LENGTH && len == 20000);
+    resp = "HTTP/1.1 200 OK\r\ntransfer-encoding: Chunked\r\n\r\n";
+    CHECK(body_framing(resp, resp.size(), false, &len) == BODY_CHUNKED);
+    resp = "HTTP/1.1 200 OK\r\nContent-Length: twenty\r\n\r\n";
+    CHECK(body_framing(resp, resp.size(), false, &len) == BODY_INVALID);
+    resp = "HTTP/1.1 200 OK\r\nServer: x\r\n\r\n";
+    CHECK(body_framing(resp, resp.size(), false, &len) == BODY_UNTIL_CLOSE);
+}
+
+static void test_keeps_alive() {
+    CHECK(keeps_alive("HTTP/1.1 200 OK\r\nContent-Length: 0\r\n\r\n"));
+    CHECK(!keeps_alive("HTTP/1.1 200 OK\r\nConnection: close\r\n\r\n"));
+    CHECK(!keeps_alive("HTTP/1.1 200 OK\r\nconnection: Close\r\n\r\n"));
+    CHECK(!keeps_alive("HTTP/1.1 200 OK\r\nCONNECTION:close\r\n\r\n"));
+    CHECK(keeps_alive("HTTP/1.1 200 OK\r\nConnection: keep-alive\r\n\r\n"));
+    CHECK(!keeps_alive("HTTP/1.0 200 OK\r\n\r\n"));
+    string resp = "HTTP/1.1 200 OK\r\nServer: x\r\n\r\nConnection: close\r\n";
+    CHECK(keeps_alive(resp, 30));
+}
+
+static string with_connection(string header, const char *value) {
+    set_connection(header, value);
+    return header;
+}
+
+static void test_set_connection() {
+    CHECK(with_connection("HTTP/1.1 200 OK\r\nConnection: close\r\n\r\n", "keep-alive") ==
+          "HTTP/1.1 200 OK\r\nConnection: keep-alive\r\n\r\n");
+    CHECK(with_connection("HTTP/1.1 200 OK\r\nconnection: close\r\n\r\n", "keep-alive") ==
+          "HTTP/1.1 200 OK\r\nconnection: keep-alive\r\n\r\n");
+    CHECK(with_connection("HTTP/1.1 200 OK\r\nConnection:close\r\n\r\n", "keep-alive") ==
+          "HTTP/1.1 200 OK\r\nConnection:keep-alive\r\n\r\n");
+    CHECK(with_connection("HTTP/1.1 200 OK\r\nServer: x\r\n\r\n", "close") ==
+          "HTTP/1.1 200 OK\r\nServer: x\r\nConnection: close\r\n\r\n");
+    // a buffer that already held a longer head has room for the next one
+    string buf(256, 'x');
+    buf.assign("HTTP/1.1 200 OK\r\nConnection: close\r\n\r\n");
+    const char *data = buf.data();
+    set_connection(buf, "keep-alive");
+    CHECK(buf == "HTTP/1.1 200 OK\r\nConnection: keep-alive\r\n\r\n" && buf.data() == data);
+}
+
+static void test_parse_manifest() {
+    CHECK(parse_manifest("<media url=\"/vod/10\" bitrate=\"10\"/><media bitrate=\"1000\"/>") == vector<int>({10, 1000}));
+    // bad rungs are skipped, the good ones kept
+    CHECK(parse_manifest("<media bitrate=\"\"/><media bitrate=\"500\"/>") == vector<int>({500}));
+    CHECK(parse_manifest("<media bitrate=\"abc\"/><media bitrate=\"12ab\"/>").empty());
+    CHECK(parse_manifest("<media bitrate=\"99999999999999999999\"/>").empty());
+    CHECK(parse_manifest("<media bitrate=\"4294967296\"/>").empty());
+    CHECK(parse_manifest("<media bitrate=\"-5\"/><media bitrate=\" 5\"/><media bitrate=\"0\"/>").empty());
+    // cut off mid-attribute
+    CHECK(parse_manifest("<media bitrate=\"100\"/><media bitrate=\"50").size() == 1);
+    CHECK(parse_manifest("<media bitrate=").empty());
+    CHECK(parse_manifest("").empty());
+}
+
+static int parse(const string &req, size_t *length, int *error) {
+    HttpParser parser(64 * 1024, 1000);
+    parser.feed(req.data(), req.size());
+    int r = parser.parse();
+    *length = parser.content_length;
+    *error = parser.error;
+    return r;
+}
+
+static void test_request_body_length() {
+    size_t len;
+    int error;
+    CHECK(parse("POST / HTTP/1.1\r\ncontent-length:10\r\n\r\n", &len, &error) == 1 && len == 10);
+    CHECK(parse("POST / HTTP/1.1\r\nContent-Length: 1000 \r\n\r\n", &len, &error) == 1 && len == 1000);
+    CHECK(parse("POST / HTTP/1.1\r\nContent-Length: 1001\r\n\r\n", &len, &error) == -1 && error == 413);
+    CHECK(parse("POST / HTTP/1.1\r\nContent-Length: 99999999999\r\n\r\n", &len, &error) == -1 && error == 413);
+    CHECK(parse("POST / HTTP/1.1\r\nContent-Length: 99999999999999999999999\r\n\r\n", &len, &error) == -1 &&
+          error == 400);
+    CHECK(parse("POST / HTTP/1.1\r\nContent-Length: ten\r\n\r\n", &len, &error) == -1 && error == 400);
+    CHECK(parse("POST / HTTP/1.1\r\nContent-Length: -1\r\n\r\n", &len, &error) == -1 && error == 400);
+    CHECK(parse("POST / HTTP/1.1\r\nContent-Length: 5\r\nContent-Length: 6\r\n\r\n", &len, &error) == -1 &&
+          error == 400);
+    // bodies are taken by length only, a chunked one must not be read as the next request
+    CHECK(parse("POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n5\r\nhello\r\n0\r\n\r\n", &len, &error) == -1 &&
+          error == 501);
+    CHECK(parse("POST / HTTP/1.1\r\ntransfer-encoding:chunked\r\n\r\n", &len, &error) == -1 && error == 501);
+    CHECK(parse("POST / HTTP/1.1\r\nContent-Length: 5\r\nTransfer-Encoding: chunked\r\n\r\n", &len, &error) == -1 &&
+          error == 400);
+    CHECK(parse("POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\nContent-Length: 5\r\n\r\n", &len, &error) == -1 &&
+          error == 400);
+    CHECK(parse("GET / HTTP/1.1\r\nHost: x\r\n\r\n", &len, &error) == 1 && len == 0 && error == 0);
+}
+
+int main() {
+    test_content_length();
+    test_body_framing();
+    test_keeps_alive();
+    test_set_connection();
+    test_parse_manifest();
+    test_request_body_length();
+    if (failures)
+        fprintf(stderr, "http_test: %d failed\n", failures);
+    else
+        printf("http_test: ok\n");
+    return failures ? 1 : 0;
+}
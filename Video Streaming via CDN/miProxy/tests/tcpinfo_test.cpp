@@ -0,0 +1,81 @@
+// TcpRateEstimator over a loopback connection: a small first fragment goes out in one
+// app-limited burst and must leave the estimate to the stopwatch, a large one may use it.
+//   make test
+#include "../TcpInfo.h"
+#include "../params.h"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+static int failures = 0;
+
+#define CHECK(cond)                                                                                                    \
+    do {                                                                                                               \
+        if (!(cond)) {                                                                                                 \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond);                                  \
+            failures++;                                                                                                \
+        }                                                                                                              \
+    } while (0)
+
+// A connected loopback pair, sender first.
+static bool loopback_pair(int *out, int *in) {
+    int lfd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    if (lfd == -1 || bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) == -1 || listen(lfd, 1) == -1 ||
+        getsockname(lfd, (struct sockaddr *)&addr, &len) == -1)
+        return false;
+    *out = socket(AF_INET, SOCK_STREAM, 0);
+    if (*out == -1 || connect(*out, (struct sockaddr *)&addr, sizeof(addr)) == -1)
+        return false;
+    *in = accept(lfd, nullptr, nullptr);
+    close(lfd);
+    return *in != -1;
+}
+
+// Relay size bytes the way a fragment goes out, sampling as Connection does.
+static double fragment(size_t size) {
+    int out, in;
+    if (!loopback_pair(&out, &in)) {
+        perror("loopback");
+        return -1;
+    }
+    TcpRateEstimator rate;
+    rate.start(out);
+    std::vector<char> buf(64 * 1024, 'x');
+    size_t sent = 0, received = 0;
+    while (received < size) {
+        if (sent < size) {
+            ssize_t n = send(out, buf.data(), std::min(buf.size(), size - sent), 0);
+            if (n > 0)
+                sent += n;
+        }
+        ssize_t n = recv(in, buf.data(), buf.size(), 0);
+        if (n <= 0)
+            break;
+        received += n;
+    }
+    rate.sample_client(out);
+    close(out);
+    close(in);
+    return rate.estimate();
+}
+
+int main() {
+    // the first fragment of a new session is at the bottom rung: 10 kbps, one second
+    CHECK(fragment(2500) == 0);
+    CHECK(fragment(4 * 1024 * 1024) > 0);
+    if (failures)
+        fprintf(stderr, "tcpinfo_test: %d failed\n", failures);
+    else
+        printf("tcpinfo_test: ok\n");
+    return failures ? 1 : 0;
+}